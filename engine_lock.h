@@ -0,0 +1,41 @@
+#ifndef ENGINE_LOCK_H
+#define ENGINE_LOCK_H
+
+#include <pthread.h>
+
+// The lock the frontends (malloc_preload.cpp, malloc_new.cpp) take around every engine call,
+// the engines themselves are single threaded. Each frontend is built with an engine of its
+// own, so each gets a lock of its own. The lock is statically initialized, calls coming in
+// before any constructor ran are fine.
+
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+class EngineLock {
+public:
+    EngineLock() {
+        pthread_mutex_lock(&engine_lock);
+    }
+    ~EngineLock() {
+        pthread_mutex_unlock(&engine_lock);
+    }
+};
+
+// Hold the lock across fork so the child never sees the engine mid-update.
+static void lockBeforeFork() {
+    pthread_mutex_lock(&engine_lock);
+}
+
+static void unlockAfterFork() {
+    pthread_mutex_unlock(&engine_lock);
+}
+
+class ForkHandlers {
+public:
+    ForkHandlers() {
+        pthread_atfork(lockBeforeFork, unlockAfterFork, unlockAfterFork);
+    }
+};
+
+static ForkHandlers fork_handlers = ForkHandlers();
+
+#endif /* ENGINE_LOCK_H */
@@ -15,11 +15,12 @@ class BlocksLinkedList {
         MetaData list;
     public:
         BlocksLinkedList() : list(NULL) {};
-        void* allocateBlock(size_t size);
+        void* allocateBlock(size_t size, size_t* dirty_bytes = NULL);
         void insertNewBlock(MetaData new_block);
         void freeBlock(void* block);
         // get methods - useful for required stats methods
         MetaData getMetaData(void* block);
+        size_t getDirtyBytes(void* old_break, void* payload);
         size_t getNumOfTotalBlocks();
         size_t getNumOfTotalBytes();
         size_t getNumOfFreeBlocks();
@@ -30,12 +31,15 @@ class BlocksLinkedList {
 // Class methods implementations //
 //////////////////////////////////
 
-void* BlocksLinkedList::allocateBlock(size_t size) {
+void* BlocksLinkedList::allocateBlock(size_t size, size_t* dirty_bytes) {
     size_t allocation_size = size + sizeof(MallocMetaData);
     MetaData iterator = this->list;
     while(iterator) {
         if (iterator->size >= size && iterator->is_free) {
             iterator->is_free = false;
+            if (dirty_bytes) {
+                *dirty_bytes = iterator->size; // a reused block holds whatever its last owner wrote
+            }
             return iterator;
         }
         iterator = iterator->next;
@@ -50,6 +54,9 @@ void* BlocksLinkedList::allocateBlock(size_t size) {
     new_alloc_block->next = NULL;
     new_alloc_block->prev = NULL;
     insertNewBlock(new_alloc_block); 
+    if (dirty_bytes) {
+        *dirty_bytes = getDirtyBytes(prog_break, (char*) prog_break + sizeof(MallocMetaData));
+    }
     return prog_break;
 }
 
@@ -75,6 +82,17 @@ void BlocksLinkedList::freeBlock(void* block) {
     getMetaData(block)->is_free = true;
 }
 
+// Memory handed out by sbrk is zero-filled by the kernel, except for the rest of the page
+// the old break was in: if the break was ever lowered, the bytes there are stale.
+size_t BlocksLinkedList::getDirtyBytes(void* old_break, void* payload) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t page_end = ((size_t) old_break + page_size - 1) & ~(page_size - 1);
+    if (page_end <= (size_t) payload) {
+        return 0;
+    }
+    return page_end - (size_t) payload;
+}
+
 size_t BlocksLinkedList::getNumOfTotalBlocks() {
     MetaData iterator = this->list;
     size_t counter = 0;
@@ -127,23 +145,29 @@ MetaData BlocksLinkedList::getMetaData(void *block) {
 }
 BlocksLinkedList blocks_list =  BlocksLinkedList(); // init our global list
 
-void* smalloc(size_t size) {
+static void* allocate(size_t size, size_t* dirty_bytes) {
     if (size == 0 || size > MAX_VAL) {
         return NULL;
     }
-    void* prog_break = blocks_list.allocateBlock(size);
-    if (prog_break == (void*) -1) {
+    void* prog_break = blocks_list.allocateBlock(size, dirty_bytes);
+    if (prog_break == NULL) {
         return NULL;
     }
     return (char*) prog_break + sizeof(MallocMetaData); // return the address of prog_break with an offset of the meta-data struct size
 }
 
+void* smalloc(size_t size) {
+    return allocate(size, NULL);
+}
+
 void* scalloc(size_t num, size_t size) {
-    void* ptr = smalloc(num * size);
+    size_t dirty_bytes = num * size;
+    void* ptr = allocate(num * size, &dirty_bytes);
     if (ptr == NULL) {
         return NULL;
     }
-    memset(ptr, 0, num * size);
+    // only clear what may hold old data, fresh heap pages are already zero
+    memset(ptr, 0, dirty_bytes < num * size ? dirty_bytes : num * size);
     return ptr;
 }
 
@@ -1,46 +1,423 @@
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/membarrier.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unwind.h>
 #include <iostream>
+#include <new>
 
-#define MAX_VAL (100000000)
+// defaults of the tunables below
 #define MAP_SIZE (128 * 1024)
+#define MIN_SPLIT_SIZE (128) // smallest free block split off the end of a block
+#define MAX_TUNABLE_SIZE (PTRDIFF_MAX) // larger blocks could not be told apart by pointer subtraction
+#define MAX_PROFILE_RATE (1 << 30) // sampling rarer than once a GiB leaves nothing to profile
+// Every payload and block size is a multiple of this. The builds that stand in for the
+// system allocator use 16, what malloc and operator new promise on x86-64.
+#ifndef SMALLOC_ALIGNMENT
+#define SMALLOC_ALIGNMENT (8)
+#endif
+// Default of max_size. The builds that stand in for the system allocator take anything
+// up to PTRDIFF_MAX, sizes from map_size up are mapped on their own.
+#ifndef SMALLOC_MAX_SIZE
+#define SMALLOC_MAX_SIZE (100000000)
+#endif
+#define DECAY_MS (10000) // default time a free page stays resident before it is purged
+#define DECAY_EPOCHS (4) // purge clock ticks per decay period
+#define PURGE_TICK_OPS (64) // allocator calls between two looks at the purge clock
+#define DEFAULT_TOP_PAD (0) // bytes left in the wilderness when it is trimmed
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define FILLER_PAGE_SIZE (4096)
+#define FILLER_PAGES (HUGE_PAGE_SIZE / FILLER_PAGE_SIZE)
+#define FILLER_MIN_SIZE (4 * 1024) // smallest block served by the huge page filler
+#define FILLER_MAX_SIZE (128 * 1024) // blocks from here on are never packed, whatever map_size is
+#define HEAP_SEGMENT_SIZE (1024 * 1024) // smallest mapping a heap handle grows by
+#define POOL_SLAB_SIZE (64 * 1024) // objects a pool carves at once, unless 16 of them do not fit
+#define POOL_CACHE_THREADS (64) // threads at a time with a front cache in a pool, the rest take its lock
+#define CACHE_LINE_SIZE (64)
+#define FRAG_BUCKETS (32) // free block size classes of smalloc_frag, powers of two
+#define PROFILE_DEFAULT_RATE (512 * 1024) // mean bytes allocated between two samples
+#define PROFILE_SAMPLES (65536) // live sampled blocks the profiler first has room for, a power of two
+#define PROFILE_MAX_SAMPLES (1 << 24) // its table doubles up to this many
+#define PROFILE_STACKS (4096) // distinct sampled stacks, a power of two
+#define PROFILE_DEPTH (32) // frames kept of a stack
+#define RETAIN_TOP_SITES (20) // sites in the SMALLOC_RETAIN report
+#define LIFETIME_BUCKETS (48) // log2 classes of sampled lifetimes, in allocations and in ns
+#define LIFETIME_SIZES (32) // log2 size classes of the lifetime profile
+#define LIFETIME_SHORT (1024) // allocations within which nine in ten objects of a short-lived site die
+#define LIFETIME_MIN_SAMPLES (16) // samples a site or size needs before it is called short-lived or immortal
+#define TRACE_THREADS (64) // threads with a trace ring of their own, the rest share the last one
+#define TRACE_RING_EVENTS (65536) // events a trace ring holds, a power of two
+#define TRACE_BUFFER_SIZE (64 * 1024) // encoded events the trace writer gathers for one write
+#define TRACE_IDLE_NS (1000000) // how long the trace writer sleeps when the rings are empty
+#define STATS_INTERVAL_MS (100) // least time between two updates of the stats page
+
+#ifndef MADV_FREE
+#define MADV_FREE (8)
+#endif
+
+// smallopt parameters, keep in sync with my_stdlib.h
+#define SM_DECAY_MS (1)
+#define SM_PURGE_ADVICE (2)
+#define SM_TRIM_THRESHOLD (3)
+#define SM_TOP_PAD (4)
+#define SM_HUGEPAGE_FILLER (5)
+#define SM_MAP_SIZE (6)
+#define SM_MIN_SPLIT_SIZE (7)
+#define SM_MAX_SIZE (8)
+#define SM_PROFILE_RATE (9)
+
+// Thresholds that used to be compile time constants, set with smallopt, smallctl or
+// SMALLOC_CONF. Plain globals, the hot paths read them like they read the constants.
+static size_t map_size = MAP_SIZE; // blocks this large are mapped on their own
+static size_t min_split_size = MIN_SPLIT_SIZE;
+static size_t max_alloc_size = SMALLOC_MAX_SIZE; // largest allocation
+
+// srealloc cases as the assignment names them, for the per-case counters
+enum ReallocCase {
+    REALLOC_A, // the block is large enough
+    REALLOC_B, // merged with the free block before it
+    REALLOC_C, // the last block grows with the break
+    REALLOC_D, // merged with the free block after it
+    REALLOC_E, // merged with both
+    REALLOC_F, // merged with the free last block after it, which grows with the break
+    REALLOC_G, // copied to a block the engine already had
+    REALLOC_H, // copied to memory the engine had to get
+    REALLOC_CASES
+};
+
+// System calls made by the engine, for smalloc_info. sbrk(0) only reads the break and
+// is not counted, mremap counts as an mmap call. Pools with front caches grow their heaps
+// from several threads at once, so the counts are atomic.
+static struct SyscallCounts {
+    size_t sbrk;
+    size_t mmap;
+    size_t munmap;
+    size_t madvise;
+} syscalls;
+
+static void* sysSbrk(intptr_t increment) {
+    __atomic_fetch_add(&syscalls.sbrk, 1, __ATOMIC_RELAXED);
+    return sbrk(increment);
+}
+
+static void* sysMmap(void* address, size_t length, int prot, int flags) {
+    __atomic_fetch_add(&syscalls.mmap, 1, __ATOMIC_RELAXED);
+    return mmap(address, length, prot, flags, -1, 0);
+}
+
+static int sysMunmap(void* address, size_t length) {
+    __atomic_fetch_add(&syscalls.munmap, 1, __ATOMIC_RELAXED);
+    return munmap(address, length);
+}
+
+static void* sysMremap(void* address, size_t old_length, size_t new_length, int flags) {
+    __atomic_fetch_add(&syscalls.mmap, 1, __ATOMIC_RELAXED);
+    return mremap(address, old_length, new_length, flags);
+}
+
+static int sysMadvise(void* address, size_t length, int advice) {
+    __atomic_fetch_add(&syscalls.madvise, 1, __ATOMIC_RELAXED);
+    return madvise(address, length, advice);
+}
+
+enum BlockKind {
+    BLOCK_HEAP, BLOCK_MMAP, BLOCK_FILLER, BLOCK_RESERVE, BLOCK_FENCE
+};
 
 typedef struct MallocMetaData {
     size_t size;
     bool is_free;
+    unsigned char free_epoch; // purge clock value when the block became free
+    unsigned char kind; // BlockKind, where the block's memory comes from
+    unsigned char sampled; // the heap profiler has a record of the block
+    unsigned int purged_pages; // whole pages of the free block given back to the kernel
     MallocMetaData* next;
     MallocMetaData* prev;
     MallocMetaData* next_by_size;
     MallocMetaData* prev_by_size;
 } *MetaData;
 
+// a block's payload is as aligned as its header
+static_assert(sizeof(MallocMetaData) % SMALLOC_ALIGNMENT == 0, "header breaks the alignment");
+
+// Start of every mapping a heap handle gets its memory from.
+typedef struct HeapSegment {
+    HeapSegment* next;
+    size_t length;
+} *Segment;
+
+// Sits right before the header of a sreserve block, at the start of its mapping.
+typedef struct ReserveData {
+    size_t reserved; // bytes of address space, this record and the header included
+    size_t committed; // bytes from the start of the mapping that are readable and writable
+} *Reservation;
+
+// Blocks outside the heap are kept in lists of their own through next and prev, which
+// otherwise only the address list of the heap uses. Newest first.
+static void linkBlock(MetaData* head, MetaData block) {
+    block->prev = NULL;
+    block->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = block;
+    }
+    *head = block;
+}
+
+static void unlinkBlock(MetaData* head, MetaData block) {
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        *head = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+}
+
+///////////////////////////////
+// Instrumentation policies //
+/////////////////////////////
+
+// The heap code reports its internal events to the Instrumentation policy chosen at build
+// time: splits, merges, the wilderness grown with the break, blocks mapped and unmapped on
+// their own and the srealloc case taken. Every public entry point also opens an
+// Instrumentation::Call for the time of the call. A policy is a struct of static inline
+// hooks, NoInstrumentation's are empty and the default build compiles them to nothing.
+// One policy per build: -DSMALLOC_COUNTING, -DSMALLOC_TRACING or -DSMALLOC_LATENCY.
+
+// sinstrument events, keep in sync with my_stdlib.h
+#define SI_SPLIT (0) // bytes: the free block split off
+#define SI_MERGE (1) // bytes: the block merged into its neighbour, header included
+#define SI_GROW (2) // bytes: the break increment, the block is the one that grew
+#define SI_MMAP (3) // bytes: the block's payload
+#define SI_MUNMAP (4)
+#define SI_REALLOC_A (5) // srealloc case A, B to H follow, bytes: the size asked for
+#define SI_EVENTS (SI_REALLOC_A + REALLOC_CASES)
+#define INSTRUMENT_TRACE_EVENTS (4096) // events the tracing policy keeps, a power of two
+
+#if defined(SMALLOC_COUNTING) + defined(SMALLOC_TRACING) + defined(SMALLOC_LATENCY) > 1
+#error "SMALLOC_COUNTING, SMALLOC_TRACING and SMALLOC_LATENCY are different instrumentation policies, pick one"
+#endif
+
+// sinstrument results, keep in sync with my_stdlib.h
+struct sinstrument {
+    size_t count;
+    size_t bytes;
+};
+
+struct sinstrument_event {
+    uint64_t seq; // events seen before this one
+    int32_t op; // SL_ operation of the call it happened in, -1 outside of one
+    int32_t event;
+    uint64_t address; // block header
+    uint64_t bytes;
+};
+
+struct NoInstrumentation {
+    struct Call {
+        explicit Call(int) {}
+    };
+    static void split(MetaData, MetaData) {}
+    static void merge(MetaData) {}
+    static void grow(MetaData, size_t) {}
+    static void map(MetaData) {}
+    static void unmap(MetaData) {}
+    static void realloc(ReallocCase, size_t) {}
+};
+
+#if defined(SMALLOC_COUNTING)
+static struct sinstrument instrument_counts[SI_EVENTS];
+
+struct CountingInstrumentation : NoInstrumentation {
+    static void count(int event, size_t bytes) { // pool heaps count from several threads
+        __atomic_fetch_add(&instrument_counts[event].count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&instrument_counts[event].bytes, bytes, __ATOMIC_RELAXED);
+    }
+    static void split(MetaData, MetaData rest) { count(SI_SPLIT, rest->size); }
+    static void merge(MetaData block) { count(SI_MERGE, block->size + sizeof(MallocMetaData)); }
+    static void grow(MetaData, size_t increment) { count(SI_GROW, increment); }
+    static void map(MetaData block) { count(SI_MMAP, block->size); }
+    static void unmap(MetaData block) { count(SI_MUNMAP, block->size); }
+    static void realloc(ReallocCase which, size_t size) { count(SI_REALLOC_A + which, size); }
+};
+typedef CountingInstrumentation Instrumentation;
+#elif defined(SMALLOC_TRACING)
+// The last INSTRUMENT_TRACE_EVENTS events, in memory until sinstrument_trace reads them.
+static struct sinstrument_event instrument_trace[INSTRUMENT_TRACE_EVENTS];
+static uint64_t instrument_seq = 0;
+static int instrument_op = -1;
+
+struct TracingInstrumentation {
+    class Call {
+    private:
+        int outer;
+
+    public:
+        explicit Call(int op) : outer(instrument_op) { instrument_op = op; }
+        ~Call() { instrument_op = outer; }
+    };
+    static void trace(int event, MetaData block, size_t bytes) {
+        uint64_t seq = __atomic_fetch_add(&instrument_seq, 1, __ATOMIC_RELAXED); // pool heaps too
+        struct sinstrument_event* entry = &instrument_trace[seq % INSTRUMENT_TRACE_EVENTS];
+        entry->seq = seq;
+        entry->op = instrument_op;
+        entry->event = event;
+        entry->address = (uint64_t) block;
+        entry->bytes = bytes;
+    }
+    static void split(MetaData block, MetaData rest) { trace(SI_SPLIT, block, rest->size); }
+    static void merge(MetaData block) { trace(SI_MERGE, block, block->size + sizeof(MallocMetaData)); }
+    static void grow(MetaData block, size_t increment) { trace(SI_GROW, block, increment); }
+    static void map(MetaData block) { trace(SI_MMAP, block, block->size); }
+    static void unmap(MetaData block) { trace(SI_MUNMAP, block, block->size); }
+    static void realloc(ReallocCase which, size_t size) { trace(SI_REALLOC_A + which, NULL, size); }
+};
+typedef TracingInstrumentation Instrumentation;
+#elif defined(SMALLOC_LATENCY)
+// Times the calls and tells their path from the engine's own counters, see LatencyScope.
+class LatencyScope;
+
+struct LatencyInstrumentation : NoInstrumentation {
+    typedef LatencyScope Call;
+};
+typedef LatencyInstrumentation Instrumentation;
+#else
+typedef NoInstrumentation Instrumentation;
+#endif
+
+#if defined(SMALLOC_COUNTING) || defined(SMALLOC_TRACING)
+static const char* instrument_exit_path = NULL; // SMALLOC_INSTRUMENT, where sinstrument_dump goes at exit
+#endif
+
 class BlocksLinkedList {
 private:
     MetaData list;
     MetaData list_by_size;
+    MetaData last_block; // end of the address list, where the heap grows
+    // Where new heap memory comes from: sbrk for the global list, the current segment
+    // (between core_break and core_end) for the list of a heap handle.
+    bool own_core;
+    Segment segments;
+    char* core_break;
+    char* core_end;
 
 public:
+    MetaData mapped; // mapped and reserved blocks, see linkBlock
     size_t num_of_map;
     size_t bytes_of_map;
-    BlocksLinkedList() : list(NULL),list_by_size(NULL),
-                         num_of_map(0),bytes_of_map(0) {};
-    void* allocateBlock(size_t size);
+    size_t num_of_reserved;
+    size_t bytes_of_reserved; // committed bytes of sreserve blocks
+    size_t bytes_of_reserved_space;
+    size_t num_of_segments;
+    size_t bytes_of_segments;
+    // smalloc_info counters, all kept up to date as the list changes
+    size_t core_bytes; // moreCore bytes, the sbrk heap for the global list
+    size_t num_of_free; // blocks in list_by_size
+    MetaData largest_free; // its last block
+    size_t num_of_splits;
+    size_t num_of_merges;
+    size_t moved_bytes; // data srealloc moved or copied
+    size_t realloc_cases[REALLOC_CASES];
+    // smalloc_frag counters, kept as blocks enter and leave the lists
+    size_t num_of_blocks; // in the address list, fences included
+    size_t free_bytes; // payload bytes of the blocks in list_by_size
+    size_t stranded_blocks; // free blocks smaller than min_split_size
+    size_t stranded_bytes;
+    size_t free_histogram[FRAG_BUCKETS]; // free blocks by size class, see fragBucket
+    size_t free_histogram_bytes[FRAG_BUCKETS];
+    size_t page_size; // read lazily, see pageSize
+    // decay purging state
+    long decay_ms;
+    int purge_advice;
+    size_t purged_bytes;
+    unsigned char epoch;
+    bool dirty_free; // list_by_size may hold blocks with unpurged whole pages
+    unsigned char dirty_epoch; // and none of them became free before this epoch
+    long epoch_start_ms;
+    unsigned int ops_since_tick;
+    // heap trimming state
+    size_t trim_threshold;
+    size_t top_pad;
+    // constexpr so the global list is ready before any constructor runs, malloc may be
+    // called that early when we are preloaded
+    constexpr BlocksLinkedList() : list(NULL),list_by_size(NULL),last_block(NULL),
+                         own_core(false),segments(NULL),core_break(NULL),core_end(NULL),
+                         mapped(NULL),num_of_map(0),bytes_of_map(0),num_of_reserved(0),bytes_of_reserved(0),
+                         bytes_of_reserved_space(0),num_of_segments(0),bytes_of_segments(0),
+                         core_bytes(0),num_of_free(0),largest_free(NULL),num_of_splits(0),num_of_merges(0),
+                         moved_bytes(0),realloc_cases(),num_of_blocks(0),free_bytes(0),stranded_blocks(0),
+                         stranded_bytes(0),free_histogram(),free_histogram_bytes(),page_size(0),
+                         decay_ms(DECAY_MS),purge_advice(MADV_DONTNEED),purged_bytes(0),
+                         epoch(0),dirty_free(false),dirty_epoch(0),epoch_start_ms(0),ops_since_tick(0),
+                         trim_threshold((size_t) -1),top_pad(DEFAULT_TOP_PAD) {};
+    void* allocateBlock(size_t size, size_t* dirty_bytes = NULL);
+    MetaData resizeInPlace(MetaData oldb, size_t size);
+    size_t expandInPlace(MetaData block, size_t min_size, size_t preferred_size);
+    size_t resizeMapped(MetaData block, size_t size);
+    // the memory the list grows into
+    void useSegments(char* start, char* end, Segment first);
+    void releaseSegments();
+    bool ensureCore(size_t size);
+    void* moreCore(intptr_t increment);
+    void* coreBreak();
+    // aligned blocks inside the heap
+    MetaData allocateAligned(size_t size, size_t alignment);
+    size_t alignedPad(MetaData block, size_t alignment);
+    bool alignedFits(MetaData block, size_t size, size_t alignment);
+    MetaData carveAligned(MetaData block, size_t size, size_t alignment);
+    // blocks with a mapping of their own
+    MetaData mapBlock(size_t size, size_t alignment);
+    void unmapBlock(MetaData block, size_t size);
+    // reserve-then-commit blocks
+    void* reserveBlock(size_t max_size);
+    bool commitBlock(MetaData block, size_t size);
+    void releaseBlock(MetaData block);
+    Reservation get_reservation(MetaData block);
     void insertNewBlock(MetaData new_block);
     void freeBlock(void* block);
     //void addToList(MetaData block);
     //void removeFromList(MetaData block);
     void split(MetaData block,size_t size);
-    void insertToListSize(MetaData block);
-    void removeFromListAddress(MetaData block);
+    void reallocCase(ReallocCase which, size_t size);
+    void insertToListSize(MetaData block, unsigned int purged_pages = 0);
+    void removeFromListAddress(MetaData block, bool merged = true);
     void removeFromListSize(MetaData block);
-    int alignTo8(size_t size);
+    void countFree(MetaData block, bool added);
+    void countStranded();
+    size_t alignSize(size_t size);
+    size_t pageSize();
+    bool isTop(MetaData block);
+    bool inHeap(MetaData block);
+    // decay purging of free heap pages
+    void tick();
+    size_t purgeFreeBlocks(bool force);
+    void unpurge(MetaData block);
+    size_t wholePages(MetaData block);
+    bool isPurged(MetaData block);
+    // shrinking the program break
+    size_t trimTop(MetaData last, size_t pad);
+    MetaData getFirstBlock();
+    MetaData getLastBlock();
     // get methods - useful for required stats methods
     MetaData get_metadata(void *block);
+    size_t getDirtyBytes(void* old_break, void* payload);
     size_t getNumOfTotalBlocks();
     size_t getNumOfTotalBytes();
     size_t getNumOfFreeBlocks();
     size_t getNumOfFreeBytes();
+    size_t getNumOfDirtyBytes();
     //size_t _size_meta_data();
 
     void printFreeBlocks();
@@ -54,9 +431,9 @@ public:
 MetaData BlocksLinkedList::get_metadata(void *block) {
     return (MetaData) ((size_t) block - sizeof(MallocMetaData));
 }
-void* BlocksLinkedList::allocateBlock(size_t size) {
+void* BlocksLinkedList::allocateBlock(size_t size, size_t* dirty_bytes) {
     size_t allocation_size = size + sizeof(MallocMetaData);
-    MetaData iterator = this->list_by_size, wilderness = NULL;
+    MetaData iterator = this->list_by_size;
     while(iterator)
     {
         if (iterator->size >= size && iterator->is_free)
@@ -64,102 +441,141 @@ void* BlocksLinkedList::allocateBlock(size_t size) {
             split(iterator, size);
             iterator->is_free = false;
             removeFromListSize(iterator);
+            if (dirty_bytes) {
+                *dirty_bytes = iterator->size; // a reused block holds whatever its last owner wrote
+            }
             return iterator;
         }
-        wilderness = iterator;
-        iterator = iterator->next;
+        iterator = iterator->next_by_size;
     }
-    if(wilderness && wilderness->is_free)
+    if (!ensureCore(alignSize(allocation_size) + sizeof(MallocMetaData))) {
+        return NULL;
+    }
+    MetaData wilderness = getLastBlock();
+    if(wilderness && wilderness->is_free && isTop(wilderness))
     {
-        void* prog_break = sbrk(alignTo8(size-wilderness->size));
+        void* prog_break = moreCore(alignSize(size-wilderness->size));
         if (prog_break == (void*) -1) {
             return NULL;
         }
+        Instrumentation::grow(wilderness, alignSize(size-wilderness->size));
         removeFromListSize(wilderness);
-        wilderness->size=alignTo8(allocation_size - sizeof(MallocMetaData));
+        if (dirty_bytes) {
+            // only the old part of the wilderness was used, the extension is fresh
+            *dirty_bytes = getDirtyBytes(prog_break, (char*) wilderness + sizeof(MallocMetaData));
+            if (*dirty_bytes < wilderness->size) {
+                *dirty_bytes = wilderness->size;
+            }
+        }
+        wilderness->size=alignSize(allocation_size - sizeof(MallocMetaData));
         wilderness->is_free= false;
         return wilderness;
     }
-    void* prog_break = sbrk(alignTo8(allocation_size));
+    // Someone else (e.g. glibc) moved the break since our last block, or a heap handle went
+    // on to a new segment. Start the new memory with a fence, a used empty block that keeps
+    // merges from spanning the gap.
+    bool fenced = wilderness != NULL && !isTop(wilderness);
+    size_t fence_size = fenced ? sizeof(MallocMetaData) : 0;
+    void* prog_break = moreCore(alignSize(allocation_size) + fence_size);
     if (prog_break == (void*) -1) {
         return NULL;
     }
+    if (fenced) {
+        MetaData fence = (MetaData) prog_break;
+        fence->size = 0;
+        fence->is_free = false;
+        fence->kind = BLOCK_FENCE;
+        fence->purged_pages = 0;
+        fence->sampled = 0;
+        fence->next = NULL;
+        fence->prev = NULL;
+        fence->next_by_size = NULL;
+        fence->prev_by_size = NULL;
+        insertNewBlock(fence);
+        prog_break = (char*) prog_break + fence_size;
+    }
     MetaData new_alloc_block = (MetaData) prog_break;
-    new_alloc_block->size = alignTo8(size);
+    new_alloc_block->size = alignSize(size);
     new_alloc_block->is_free = false;
     new_alloc_block->next = NULL;
     new_alloc_block->prev = NULL;
     new_alloc_block->next_by_size = NULL;
     new_alloc_block->prev_by_size = NULL;
+    new_alloc_block->free_epoch = 0;
+    new_alloc_block->kind = BLOCK_HEAP;
+    new_alloc_block->purged_pages = 0;
+    new_alloc_block->sampled = 0;
     insertNewBlock(new_alloc_block);
+    if (dirty_bytes) {
+        *dirty_bytes = getDirtyBytes(prog_break, (char*) prog_break + sizeof(MallocMetaData));
+    }
     return prog_break;
 }
 
 void BlocksLinkedList::insertNewBlock(MetaData new_block) {
+    this->num_of_blocks++;
 
     //to list by address to the end
     if(this->list==NULL)
     {
         this->list = new_block;
+        this->last_block = new_block;
         return;
     }
-    MetaData last = this->list;
-    MetaData prev1 = last;
-
-    while(last) {
-        prev1 = last;
-        last = last->next;
-    }
-    prev1->next = new_block;
-    new_block->prev = prev1;
+    this->last_block->next = new_block;
+    new_block->prev = this->last_block;
+    this->last_block = new_block;
 
 }
-void BlocksLinkedList::insertToListSize(MetaData block) {
+// purged_pages are the block's whole pages that are already purged, when it is made of
+// free blocks that were.
+void BlocksLinkedList::insertToListSize(MetaData block, unsigned int purged_pages) {
+    block->free_epoch = this->epoch;
+    block->purged_pages = purged_pages;
+    this->purged_bytes += purged_pages * pageSize();
+    if (!this->dirty_free && !isPurged(block)) {
+        this->dirty_free = true;
+        this->dirty_epoch = this->epoch;
+    }
+    // sorted by size, equal sizes by address
     MetaData iterator = this->list_by_size,prev=NULL;
-    while (iterator) {
-        if (iterator->size > block->size || (iterator->size == block->size && iterator > block)) {
-            if (iterator->prev_by_size == NULL) {
-                block->next_by_size= this->list_by_size;
-                block->next_by_size->prev_by_size=block;
-                this->list_by_size =block;
-            } else if (iterator == NULL) {
-                prev->next_by_size= block;
-                block->prev_by_size=prev;
-                block->next_by_size=NULL;
-            }
-            else
-            {
-                block->next_by_size= iterator;
-                block->next_by_size->prev_by_size=block;
-                block->prev_by_size=prev;
-                if(prev!=NULL)
-                {
-                    block->prev_by_size->next_by_size=block;
-                }
-            }
-            return;
-        }
+    while (iterator && (iterator->size < block->size || (iterator->size == block->size && iterator < block))) {
         prev=iterator;
         iterator = iterator->next_by_size;
     }
+    block->prev_by_size=prev;
+    block->next_by_size=iterator;
+    this->num_of_free++;
+    countFree(block, true);
+    if (iterator == NULL) {
+        this->largest_free = block;
+    }
     if(prev==NULL)
     {
         this->list_by_size=block;
-        block->next_by_size=NULL;
-        block->prev_by_size=NULL;
-        return;
     }
-    prev->next_by_size=block;
-    block->prev_by_size=prev;
-    block->next_by_size=iterator;
+    else
+    {
+        prev->next_by_size=block;
+    }
     if(iterator!=NULL)
     {
         iterator->prev_by_size=block;
     }
 }
 
-void BlocksLinkedList::removeFromListAddress(MetaData block)
+// The block leaves the address list, normally because it merged into a neighbour.
+void BlocksLinkedList::removeFromListAddress(MetaData block, bool merged)
 {
+    this->num_of_merges += merged;
+    if (merged) {
+        Instrumentation::merge(block);
+    }
+    this->num_of_blocks--;
+    if (block == this->last_block)
+    {
+        this->last_block = block->prev;
+    }
     if (block->prev== NULL)//block is first
     {
         this->list = block->next;
@@ -187,6 +603,16 @@ void BlocksLinkedList::removeFromListAddress(MetaData block)
 
 void BlocksLinkedList::removeFromListSize(MetaData block)
 {
+    unpurge(block); // the block is about to be reused or merged
+    if (block->prev_by_size == NULL && this->list_by_size != block)
+    {//not in the list (any more), nothing to unlink
+        return;
+    }
+    this->num_of_free--;
+    countFree(block, false);
+    if (block->next_by_size == NULL) {
+        this->largest_free = block->prev_by_size;
+    }
     if (block->prev_by_size == NULL)//block is smallest
     {
         this->list_by_size = block->next_by_size;
@@ -211,231 +637,244 @@ void BlocksLinkedList::removeFromListSize(MetaData block)
     }
 
 }
-int BlocksLinkedList::alignTo8(size_t size) {
-    if(size%8==0) {
+// Size class of a free block for the histogram: class i holds sizes from 2^(i-1) up to
+// 2^i, the last one everything larger.
+static size_t fragBucket(size_t size) {
+    size_t bucket = size != 0 ? 64 - __builtin_clzll(size) : 0;
+    return bucket < FRAG_BUCKETS ? bucket : FRAG_BUCKETS - 1;
+}
+
+// A block entered or left list_by_size. Its size must be the one it was inserted with, so
+// sizes of free blocks only change while they are out of the list.
+void BlocksLinkedList::countFree(MetaData block, bool added) {
+    size_t bucket = fragBucket(block->size);
+    bool stranded = block->size < min_split_size;
+    if (added) {
+        this->free_bytes += block->size;
+        this->free_histogram[bucket]++;
+        this->free_histogram_bytes[bucket] += block->size;
+        this->stranded_blocks += stranded;
+        this->stranded_bytes += stranded ? block->size : 0;
+    } else {
+        this->free_bytes -= block->size;
+        this->free_histogram[bucket]--;
+        this->free_histogram_bytes[bucket] -= block->size;
+        this->stranded_blocks -= stranded;
+        this->stranded_bytes -= stranded ? block->size : 0;
+    }
+}
+
+// min_split_size changed: the stranded blocks are the ones at the small end of list_by_size.
+void BlocksLinkedList::countStranded() {
+    this->stranded_blocks = 0;
+    this->stranded_bytes = 0;
+    for (MetaData iterator = this->list_by_size; iterator && iterator->size < min_split_size;
+         iterator = iterator->next_by_size) {
+        this->stranded_blocks++;
+        this->stranded_bytes += iterator->size;
+    }
+}
+
+size_t BlocksLinkedList::pageSize() {
+    if (this->page_size == 0) {
+        this->page_size = sysconf(_SC_PAGESIZE);
+    }
+    return this->page_size;
+}
+
+// whether the block ends at the break, so moreCore can grow it in place
+bool BlocksLinkedList::isTop(MetaData block) {
+    return coreBreak() == (char*) block + sizeof(MallocMetaData) + block->size;
+}
+
+// Hand the list the memory between start and end, from a segment it owns.
+void BlocksLinkedList::useSegments(char* start, char* end, Segment first) {
+    this->own_core = true;
+    this->segments = first;
+    this->core_break = start;
+    this->core_end = end;
+    this->num_of_segments = 1;
+    this->bytes_of_segments = first->length;
+}
+
+// Unmap every segment at once, the blocks in them are not looked at. The list may live in
+// one of the segments, so nothing of it is touched after the first munmap.
+void BlocksLinkedList::releaseSegments() {
+    Segment segment = this->segments;
+    while (segment != NULL) {
+        Segment next = segment->next;
+        sysMunmap(segment, segment->length);
+        segment = next;
+    }
+}
+
+// Make sure the next size bytes of moreCore come from one piece of memory. The sbrk heap
+// always has the room, a heap handle maps a new segment when the current one is too full.
+bool BlocksLinkedList::ensureCore(size_t size) {
+    if (!this->own_core || (size_t) (this->core_end - this->core_break) >= size) {
+        return true;
+    }
+    size_t length = sizeof(HeapSegment) + size;
+    length = length < HEAP_SEGMENT_SIZE ? HEAP_SEGMENT_SIZE : (length + pageSize() - 1) & ~(pageSize() - 1);
+    void* mapping = sysMmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    Segment segment = (Segment) mapping;
+    segment->length = length;
+    segment->next = this->segments;
+    this->segments = segment;
+    this->core_break = (char*) mapping + sizeof(HeapSegment);
+    this->core_end = (char*) mapping + length;
+    this->num_of_segments++;
+    this->bytes_of_segments += length;
+    return true;
+}
+
+// sbrk for the list: grows or shrinks the memory at the break. A heap handle only moves
+// inside its current segment and gives shrunk pages back to the kernel.
+void* BlocksLinkedList::moreCore(intptr_t increment) {
+    if (!this->own_core) {
+        void* old_break = sysSbrk(increment);
+        if (old_break != (void*) -1) {
+            this->core_bytes += increment;
+        }
+        return old_break;
+    }
+    char* old_break = this->core_break;
+    if (increment > this->core_end - old_break || -increment > old_break - (char*) this->segments) {
+        return (void*) -1;
+    }
+    this->core_break += increment;
+    this->core_bytes += increment;
+    if (increment < 0) {
+        size_t first_page = ((size_t) this->core_break + pageSize() - 1) & ~(pageSize() - 1);
+        if (first_page < (size_t) old_break) {
+            sysMadvise((void*) first_page, (size_t) old_break - first_page, MADV_DONTNEED);
+        }
+    }
+    return old_break;
+}
+
+void* BlocksLinkedList::coreBreak() {
+    return this->own_core ? this->core_break : sbrk(0);
+}
+
+size_t BlocksLinkedList::alignSize(size_t size) {
+    if(size%SMALLOC_ALIGNMENT==0) {
         return size;
     }
-    return size+8-(size%8);
+    return size+SMALLOC_ALIGNMENT-(size%SMALLOC_ALIGNMENT);
 }
 
 void BlocksLinkedList::freeBlock(void* ptr) {
     MetaData block = get_metadata(ptr);
     block->is_free = true;
+    MetaData merged = (block->prev != NULL && block->prev->is_free) ? block->prev : block;
 
     if(block->next != NULL && block->next->is_free &&
        block->prev != NULL && block->prev->is_free)
     {
         MetaData prev_block = block->prev;
+        unsigned int purged_pages = block->prev->purged_pages + block->next->purged_pages;
         removeFromListSize(block->prev);
         removeFromListSize(block->next);
-        block->prev->size = alignTo8(block->prev->size + block->size + 2 * sizeof(MallocMetaData)+ block->next->size);
+        block->prev->size = alignSize(block->prev->size + block->size + 2 * sizeof(MallocMetaData)+ block->next->size);
         removeFromListAddress(block->next);
         removeFromListAddress(block);
-        insertToListSize(prev_block);
+        insertToListSize(prev_block, purged_pages);
     }
     else if(block->prev != NULL && block->prev->is_free)//need to merge block with block before
     {
         MetaData prev_block = block->prev;
+        unsigned int purged_pages = block->prev->purged_pages;
         removeFromListSize(block);
         removeFromListSize(block->prev);
 
-        block->prev->size = alignTo8(block->prev->size + block->size + sizeof(MallocMetaData));
+        block->prev->size = alignSize(block->prev->size + block->size + sizeof(MallocMetaData));
         removeFromListAddress(block);
-        insertToListSize(prev_block);
+        insertToListSize(prev_block, purged_pages);
     }
     else if(block->next != NULL && block->next->is_free)//need to merge block with block before
     {
+        unsigned int purged_pages = block->next->purged_pages;
         removeFromListSize(block);
         removeFromListSize(block->next);
 
-        block->size = alignTo8(block->size + block->next->size + sizeof(MallocMetaData));
+        block->size = alignSize(block->size + block->next->size + sizeof(MallocMetaData));
         removeFromListAddress(block->next);
-        insertToListSize(block);
+        insertToListSize(block, purged_pages);
     }
     else
     {
         insertToListSize(block);
     }
+
+    if(merged->next == NULL && merged->size > this->trim_threshold)
+    {
+        trimTop(merged, this->top_pad);
+    }
 }
 
 void BlocksLinkedList::split(MetaData block, size_t size)
 {
-    if(block->size < 128 + size + sizeof(MallocMetaData))
+    if(block->size < min_split_size + size + sizeof(MallocMetaData))
     {
         return;
     }
     // split blocks challenge 1
-    MetaData new_alloc = (MetaData) ((char *) block + size + sizeof(MallocMetaData));
+    this->num_of_splits++;
+    this->num_of_blocks++;
+    // the whole pages of the rest are whole pages of the block, at most its dirty ones are not purged
+    size_t dirty_pages = block->is_free ? wholePages(block) - block->purged_pages : (size_t) -1;
+    removeFromListSize(block); // before its size changes
+    MetaData new_alloc = (MetaData) ((char *) block + alignSize(size) + sizeof(MallocMetaData));
     new_alloc->is_free = true;
-    new_alloc->size = block->size - alignTo8(size) - sizeof(MallocMetaData);
-    block->size = alignTo8(size);
+    new_alloc->kind = BLOCK_HEAP;
+    new_alloc->purged_pages = 0;
+    new_alloc->sampled = 0;
+    new_alloc->size = block->size - alignSize(size) - sizeof(MallocMetaData);
+    block->size = alignSize(size);
+    unsigned int purged_pages = wholePages(new_alloc) > dirty_pages ? wholePages(new_alloc) - dirty_pages : 0;
     if(block->next && block->next->is_free)
     {
         new_alloc->size += block->next->size + sizeof(MallocMetaData);
+        purged_pages += block->next->purged_pages;
         removeFromListSize(block->next);
         removeFromListAddress(block->next);
     }
-    insertToListSize(new_alloc);
-    removeFromListSize(block);
+    insertToListSize(new_alloc, purged_pages);
     new_alloc->next = block->next;
     new_alloc->prev = block;
     if(block->next != NULL)
     {
         block->next->prev = new_alloc;
     }
-    block->next = new_alloc;
-}
-
-size_t BlocksLinkedList::getNumOfTotalBlocks() {
-    MetaData iterator = this->list;
-    size_t counter = 0;
-    while (iterator) {
-        if (iterator->size <= MAP_SIZE) {
-            counter++;
-            iterator = iterator->next;
-        }
-    }
-    counter+=this->num_of_map;
-    return counter;
-}
-
-size_t BlocksLinkedList::getNumOfTotalBytes() {
-    MetaData iterator = this->list;
-    size_t counter = 0;
-    while (iterator) {
-        if(iterator->size <= MAP_SIZE) {
-            counter += iterator->size;
-            iterator = iterator->next;
-        }
-    }
-    counter += this->bytes_of_map;
-    return counter;
-}
-
-size_t BlocksLinkedList::getNumOfFreeBlocks() {
-    MetaData iterator = this->list;
-    size_t counter = 0;
-    while (iterator) {
-        if(iterator->is_free&&iterator->size<=MAP_SIZE) {
-            counter++;
-        }
-        iterator = iterator->next;
-    }
-    return counter;
-}
-
-size_t BlocksLinkedList::getNumOfFreeBytes() {
-    MetaData iterator = this->list;
-    size_t counter = 0;
-    while (iterator) {
-        if (iterator->is_free&&iterator->size<=MAP_SIZE) {
-            counter += iterator->size;
-        }
-        iterator = iterator->next;
-    }
-    return counter;
-}
-
-void BlocksLinkedList::printFreeBlocks() {
-    MetaData iterator = this->list_by_size;
-    int counter = 1;
-    while (iterator) {
-        std::cout << "#########" << std::endl;
-        std::cout << "#########" << std::endl;
-        std::cout << "size of block number " << counter++ << " in bytes is " << iterator->size << std::endl;
-        std::cout << "#########" << std::endl;
-        std::cout << "#########" << std::endl;
-        std::cout << std::endl;
-        iterator = iterator->next;
-    }
-}
-
-///////////////////////////////////
-// Basic malloc implementations //
-/////////////////////////////////
-
-BlocksLinkedList blocks_list =  BlocksLinkedList(); // init our global list
-
-void* smalloc(size_t size) {
-    if (size == 0 || size > MAX_VAL) {
-        return NULL;
-    }
-    size_t left = ((size_t)sbrk(0)) % 8;
-    if (left != 0)
+    else
     {
-        sbrk(8 - left);
-    }
-    if (size >= MAP_SIZE) {
-        void *block = mmap(NULL, blocks_list.alignTo8(sizeof(MallocMetaData) + size), PROT_READ | PROT_WRITE,
-                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (block == MAP_FAILED) {
-            return NULL;
-        }
-        MetaData my_block=(MetaData)block;
-        my_block->is_free = false;
-        my_block->size = blocks_list.alignTo8(size);
-        blocks_list.bytes_of_map+=blocks_list.alignTo8(size);
-        blocks_list.num_of_map++;
-        return (char*)block+sizeof(MallocMetaData);
-    }
-
-    void* prog_break = blocks_list.allocateBlock(size);
-    if (prog_break == (void*) -1) {
-        return NULL;
-    }
-    return (char*) prog_break + sizeof(MallocMetaData); // return the address of prog_break with an offset of the meta-data struct size
-}
-
-void* scalloc(size_t num, size_t size) {
-    void* ptr = smalloc(num * size);
-    if (ptr == NULL) {
-        return NULL;
+        this->last_block = new_alloc;
     }
-    memset(ptr, 0, num * size);
-    return ptr;
+    block->next = new_alloc;
+    Instrumentation::split(block, new_alloc);
 }
 
-void sfree(void* p) {
-    if (p == NULL) {
-        return;
-    }
-    MetaData data = blocks_list.get_metadata(p);
-
-    if(data->size >= MAP_SIZE)
-    {
-        blocks_list.num_of_map--;
-        blocks_list.bytes_of_map -= data->size;
-        munmap(data, sizeof(MallocMetaData) + data->size);
-    }
-    else
-    {
-        blocks_list.freeBlock(p);
-    }
+void BlocksLinkedList::reallocCase(ReallocCase which, size_t size) {
+    this->realloc_cases[which]++;
+    Instrumentation::realloc(which, size);
 }
 
-void* srealloc(void* oldp, size_t size) {
-    if (size == 0 || size > MAX_VAL) {
-        return NULL;
-    }
-    if (oldp == NULL) {
-        return smalloc(size);
-    }
-    MetaData oldb = blocks_list.get_metadata(oldp);
-    if (oldb->size >= MAP_SIZE)
-    {
-        if (oldb->size == size)
-        {
-            return oldp;
-        }
-        sfree(oldp);
-        return smalloc(size);
-    }
+// Grow or shrink a heap block with its free neighbours and the break, cases A to F of
+// srealloc. The data moves down when a free block before it is used. Returns the block the
+// data is in now, or NULL when it has to be copied to a new block.
+MetaData BlocksLinkedList::resizeInPlace(MetaData oldb, size_t size) {
+    void* oldp = (char*) oldb + sizeof(MallocMetaData);
     size_t size_old = oldb->size;
     if (size <= size_old) { //case A use same block
-        blocks_list.split(oldb,size);
-        return oldp;
+        split(oldb,size);
+        reallocCase(REALLOC_A, size);
+        return oldb;
     }
-    unsigned int possible_size = size_old;
+    size_t possible_size = size_old;
     if(oldb->prev && oldb->prev->is_free)
     {
         possible_size += oldb->prev->size + sizeof(MallocMetaData);
@@ -443,37 +882,48 @@ void* srealloc(void* oldp, size_t size) {
     if (possible_size >= size)
     {//case B try adjacent prev block
         MetaData prev_block = oldb->prev;
-        blocks_list.removeFromListSize(oldb);
-        blocks_list.removeFromListSize(oldb->prev);
-        oldb->prev->size = blocks_list.alignTo8(possible_size);
+        removeFromListSize(oldb);
+        removeFromListSize(oldb->prev);
+        oldb->prev->size = alignSize(possible_size);
         oldb->prev->is_free = false;
-        blocks_list.removeFromListAddress(oldb);
-        blocks_list.split(prev_block, size);
-
-        memmove( (char *) prev_block + sizeof(MallocMetaData), oldp, oldb->size);
-        return (char *) prev_block + sizeof(MallocMetaData);
+        removeFromListAddress(oldb);
+        // move before splitting, the new free block's header may land on the old data
+        memmove( (char *) prev_block + sizeof(MallocMetaData), oldp, size_old);
+        split(prev_block, size);
+        this->moved_bytes += size_old;
+        reallocCase(REALLOC_B, size);
+        return prev_block;
     }
     else
     {
         if(oldb->next == NULL) //wilderness case B2 + C
         {
-            void* prog_break = sbrk(blocks_list.alignTo8(size - possible_size));
-            if (prog_break == (void*) -1) {
+            if (!isTop(oldb))
+            {//the break moved past us, the block cannot grow
                 return NULL;
             }
+            void* prog_break = moreCore(alignSize(size - possible_size));
+            if (prog_break == (void*) -1) {
+                return NULL; // no room to grow, copy
+            }
+            Instrumentation::grow(oldb, alignSize(size - possible_size));
             if(oldb->prev != NULL && oldb->prev->is_free)
             {
                 MetaData prev_block = oldb->prev;
-                oldb->prev->size = blocks_list.alignTo8(size);
+                removeFromListSize(prev_block);
+                oldb->prev->size = alignSize(size);
                 oldb->prev->is_free = false;
-                blocks_list.removeFromListAddress(oldb);
+                removeFromListAddress(oldb);
                 memmove( (char *) prev_block + sizeof(MallocMetaData), oldp, oldb->size);
-                return  ((char *) prev_block) + sizeof(MallocMetaData);
+                this->moved_bytes += size_old;
+                reallocCase(REALLOC_B, size);
+                return prev_block;
             }
             else {
-                oldb->size = blocks_list.alignTo8(size);
+                oldb->size = alignSize(size);
                 oldb->is_free = false;
-                return oldp;
+                reallocCase(REALLOC_C, size);
+                return oldb;
             }
         }
         else
@@ -485,12 +935,13 @@ void* srealloc(void* oldp, size_t size) {
             }
             if(possible_size >= size)
             {//case D merge higher address
-                blocks_list.removeFromListSize(oldb);
-                blocks_list.removeFromListSize(oldb->next);
-                oldb->size = blocks_list.alignTo8(oldb->next->size + oldb->size + sizeof(MallocMetaData));
-                blocks_list.removeFromListAddress(oldb->next);
-                blocks_list.split(oldb,size);
-                return oldp;
+                removeFromListSize(oldb);
+                removeFromListSize(oldb->next);
+                oldb->size = alignSize(oldb->next->size + oldb->size + sizeof(MallocMetaData));
+                removeFromListAddress(oldb->next);
+                split(oldb,size);
+                reallocCase(REALLOC_D, size);
+                return oldb;
             }
         }
     }//case A to D failed
@@ -506,67 +957,3177 @@ void* srealloc(void* oldp, size_t size) {
     }
     if(possible_size >= size)
     {//case E try all three blocks
-        //blocks_list.printFreeBlocks();
+        //printFreeBlocks();
         MetaData prev_block = oldb->prev;
         oldb->prev->is_free=false;
-        blocks_list.removeFromListSize(oldb->prev);
-        blocks_list.removeFromListSize(oldb->next);
-        blocks_list.removeFromListSize(oldb);
+        removeFromListSize(oldb->prev);
+        removeFromListSize(oldb->next);
+        removeFromListSize(oldb);
 
-        //blocks_list.printFreeBlocks();
-        oldb->prev->size = blocks_list.alignTo8(possible_size);
-        blocks_list.removeFromListAddress(oldb->next);
-        blocks_list.removeFromListAddress(oldb);
-        blocks_list.split(prev_block, size);
-        memmove( (char *) prev_block + sizeof(MallocMetaData), oldp, oldb->size);
-
-        return (char *) prev_block + sizeof(MallocMetaData);
+        //printFreeBlocks();
+        oldb->prev->size = alignSize(possible_size);
+        removeFromListAddress(oldb->next);
+        removeFromListAddress(oldb);
+        memmove( (char *) prev_block + sizeof(MallocMetaData), oldp, size_old);
+        split(prev_block, size);
+        this->moved_bytes += size_old;
+        reallocCase(REALLOC_E, size);
+        return prev_block;
     }
     else
     {
-        if(oldb->next->next == NULL) //wilderness case F1 F2
+        if(oldb->next->is_free && oldb->next->next == NULL && isTop(oldb->next)) //wilderness case F1 F2
         {
-            void* prog_break = sbrk(blocks_list.alignTo8(size - possible_size));
+            void* prog_break = moreCore(alignSize(size - possible_size));
             if (prog_break == (void*) -1) {
-                return NULL;
+                return NULL; // no room to grow, copy
             }
-            blocks_list.removeFromListSize(oldb);
-            blocks_list.removeFromListSize(oldb->next);
-            oldb->size = blocks_list.alignTo8(size);
+            Instrumentation::grow(oldb->next, alignSize(size - possible_size));
+            removeFromListSize(oldb);
+            removeFromListSize(oldb->next);
+            oldb->size = alignSize(size);
             oldb->is_free = false;
-            blocks_list.removeFromListAddress(oldb->next);
+            removeFromListAddress(oldb->next);
             if(oldb->prev && oldb->prev->is_free)
             {
                 MetaData prev_block = oldb->prev; //case F1
+                removeFromListSize(prev_block);
                 prev_block->size = oldb->size;
                 prev_block->is_free = false;
-                blocks_list.removeFromListSize(oldb);
-                blocks_list.removeFromListSize(oldb->prev);
-                blocks_list.removeFromListAddress(oldb);
-                memmove( (char *) prev_block + sizeof(MallocMetaData), oldp, oldb->size);
-                return (char *) prev_block + sizeof(MallocMetaData);
+                removeFromListAddress(oldb);
+                memmove( (char *) prev_block + sizeof(MallocMetaData), oldp, size_old);
+                this->moved_bytes += size_old;
+                reallocCase(REALLOC_F, size);
+                return prev_block;
             }
-
-            return oldp;
-        }
-        else
-        {
-            void* newp = smalloc(size);
-            memmove(newp, oldp, oldb->size);
-            sfree(oldp);//case G + H
-            return newp;
+            reallocCase(REALLOC_F, size);
+            return oldb;
         }
     }
+    return NULL; // case G + H, copy to a new block
+}
 
-    void* newp = smalloc(size);
-    if (newp == NULL) {
-        return NULL;
+// Grow or shrink a heap block without moving it: only a free block right after it and the
+// break are used, never the block before. Grows to preferred_size if it can, else to as
+// much as is there as long as that is min_size. Returns the new size, or 0 with the block
+// unchanged.
+size_t BlocksLinkedList::expandInPlace(MetaData block, size_t min_size, size_t preferred_size) {
+    if (preferred_size <= block->size) {
+        split(block, preferred_size);
+        return block->size;
     }
-    memmove(newp, oldp, oldb->size);
-    sfree(oldp);
-    return newp;
+    MetaData next = block->next;
+    bool next_free = next != NULL && next->is_free;
+    size_t available = block->size + (next_free ? next->size + sizeof(MallocMetaData) : 0);
+    MetaData top = next_free ? next : block;
+    size_t grow = 0;
+    if (available < preferred_size && top->next == NULL && isTop(top)) {
+        // preferred_size from the break if we get it, just min_size otherwise
+        grow = alignSize(preferred_size - available);
+        if (moreCore(grow) == (void*) -1) {
+            grow = min_size > available ? alignSize(min_size - available) : 0;
+            if (grow != 0 && moreCore(grow) == (void*) -1) {
+                return 0;
+            }
+        }
+    }
+    if (available + grow < min_size) {
+        return 0;
+    }
+    if (grow != 0) {
+        Instrumentation::grow(top, grow);
+    }
+    if (next_free) {
+        removeFromListSize(next);
+        removeFromListAddress(next);
+    }
+    block->size = alignSize(available + grow);
+    split(block, preferred_size);
+    return block->size;
 }
 
+// Grow or shrink a mapped block with mremap, without letting it move. Returns the new size,
+// or 0 if the pages after the mapping are taken.
+size_t BlocksLinkedList::resizeMapped(MetaData block, size_t size) {
+    size_t first_page = (size_t) block & ~(pageSize() - 1);
+    size_t payload = (size_t) block + sizeof(MallocMetaData);
+    size_t old_end = (payload + block->size + pageSize() - 1) & ~(pageSize() - 1);
+    size_t new_end = (payload + size + pageSize() - 1) & ~(pageSize() - 1);
+    if (new_end != old_end &&
+        sysMremap((void*) first_page, old_end - first_page, new_end - first_page, 0) == MAP_FAILED) {
+        return 0;
+    }
+    this->bytes_of_map += alignSize(size) - block->size;
+    block->size = alignSize(size);
+    return block->size;
+}
+
+// Memory handed out by sbrk is zero-filled by the kernel, except for the rest of the page
+// the old break was in: if the break was ever lowered, the bytes there are stale.
+size_t BlocksLinkedList::getDirtyBytes(void* old_break, void* payload) {
+    size_t page_end = ((size_t) old_break + pageSize() - 1) & ~(pageSize() - 1);
+    if (page_end <= (size_t) payload) {
+        return 0;
+    }
+    return page_end - (size_t) payload;
+}
+
+// Called once per allocator operation. Every PURGE_TICK_OPS calls we read the clock,
+// and when a purge epoch has passed, free blocks that sat unused for decay_ms are purged.
+void BlocksLinkedList::tick() {
+    if (this->decay_ms < 0 || ++this->ops_since_tick < PURGE_TICK_OPS) {
+        return;
+    }
+    this->ops_since_tick = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    long now_ms = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    long epoch_ms = this->decay_ms / DECAY_EPOCHS;
+    if (epoch_ms > 0) {
+        long passed = (now_ms - this->epoch_start_ms) / epoch_ms;
+        if (passed == 0) {
+            return;
+        }
+        // after a long idle period everything is old enough, no need to wrap the clock
+        this->epoch += passed < DECAY_EPOCHS ? passed : DECAY_EPOCHS;
+        this->epoch_start_ms = now_ms;
+    }
+    purgeFreeBlocks(false);
+}
+
+// Give the whole pages inside free heap blocks back to the kernel. Unless forced, only
+// blocks that became free at least DECAY_EPOCHS purge epochs ago are touched.
+// Only list_by_size is walked, and only when one of its dirty blocks may be old enough.
+// A block that merged with purged blocks is purged whole again, but counts only its new
+// pages. Returns the number of bytes purged by this call.
+size_t BlocksLinkedList::purgeFreeBlocks(bool force) {
+    unsigned char min_age = this->decay_ms > 0 ? DECAY_EPOCHS : 0;
+    if (!this->dirty_free ||
+        (!force && (unsigned char) (this->epoch - this->dirty_epoch) < min_age)) {
+        return 0;
+    }
+    size_t purged = 0;
+    unsigned char oldest_age = 0; // of the dirty blocks left
+    this->dirty_free = false;
+    for (MetaData iterator = this->list_by_size; iterator; iterator = iterator->next_by_size) {
+        if (isPurged(iterator)) {
+            continue;
+        }
+        unsigned char age = this->epoch - iterator->free_epoch;
+        if (force || age >= min_age) {
+            size_t start = (size_t) iterator + sizeof(MallocMetaData);
+            size_t first_page = (start + pageSize() - 1) & ~(pageSize() - 1);
+            size_t pages = wholePages(iterator);
+            if (sysMadvise((void*) first_page, pages * pageSize(), this->purge_advice) == 0) {
+                purged += (pages - iterator->purged_pages) * pageSize();
+                iterator->purged_pages = pages;
+                continue;
+            }
+        }
+        if (!this->dirty_free || age > oldest_age) {
+            oldest_age = age;
+        }
+        this->dirty_free = true;
+    }
+    this->dirty_epoch = this->epoch - oldest_age;
+    this->purged_bytes += purged;
+    return purged;
+}
+
+// whole pages inside the block's payload, the ones a purge can give back
+size_t BlocksLinkedList::wholePages(MetaData block) {
+    size_t start = (size_t) block + sizeof(MallocMetaData);
+    size_t first_page = (start + pageSize() - 1) & ~(pageSize() - 1);
+    size_t last_page = (start + block->size) & ~(pageSize() - 1);
+    return last_page > first_page ? (last_page - first_page) / pageSize() : 0;
+}
+
+bool BlocksLinkedList::isPurged(MetaData block) {
+    return block->purged_pages == wholePages(block);
+}
+
+// The block is leaving the free pool (reused or merged), its pages no longer count as purged.
+void BlocksLinkedList::unpurge(MetaData block) {
+    this->purged_bytes -= block->purged_pages * pageSize();
+    block->purged_pages = 0;
+}
+
+// Give the free wilderness block back to the kernel with a negative sbrk, keeping pad bytes
+// of it so that the next allocation does not have to grow the break right away.
+// Nothing happens if someone else moved the break past our last block.
+// Returns the number of bytes released.
+size_t BlocksLinkedList::trimTop(MetaData last, size_t pad) {
+    if (last == NULL || !last->is_free || !isTop(last)) {
+        return 0;
+    }
+    size_t keep = alignSize(pad);
+    if (last->size <= keep) {
+        return 0;
+    }
+    size_t release = last->size - keep;
+    bool purged = isPurged(last);
+    removeFromListSize(last);
+    if (keep == 0) {
+        release += sizeof(MallocMetaData); // the whole block goes away
+        removeFromListAddress(last, false);
+    } else {
+        last->size = keep;
+        insertToListSize(last, purged ? wholePages(last) : 0);
+    }
+    moreCore(-(intptr_t) release);
+    return release;
+}
+
+// Every heap block lies between the first block and the break, no mapped block does.
+bool BlocksLinkedList::inHeap(MetaData block) {
+    return this->list != NULL && block >= this->list && (void*) block < sbrk(0);
+}
+
+MetaData BlocksLinkedList::getFirstBlock() {
+    return this->list;
+}
+
+MetaData BlocksLinkedList::getLastBlock() {
+    return this->last_block;
+}
+
+// Bytes to skip from the payload of block so that it is aligned. The pad is split off as a
+// free block of its own, so it is at least a header and min_split_size.
+size_t BlocksLinkedList::alignedPad(MetaData block, size_t alignment) {
+    size_t payload = (size_t) block + sizeof(MallocMetaData);
+    size_t pad = (alignment - payload % alignment) % alignment;
+    if (pad == 0) {
+        return pad;
+    }
+    while (pad < sizeof(MallocMetaData) + min_split_size) {
+        pad += alignment;
+    }
+    return pad;
+}
+
+bool BlocksLinkedList::alignedFits(MetaData block, size_t size, size_t alignment) {
+    size_t pad = alignedPad(block, alignment);
+    if (block->size < pad + size) {
+        return false;
+    }
+    // a pad block is cut off with split, which leaves at least min_split_size after it
+    return pad == 0 || block->size >= pad + min_split_size;
+}
+
+// Move the used block up to its aligned place and cut it down to size. Whatever is left on
+// either side goes back to the free list.
+MetaData BlocksLinkedList::carveAligned(MetaData block, size_t size, size_t alignment) {
+    size_t pad = alignedPad(block, alignment);
+    if (pad > 0)
+    {//the pad becomes a free block
+        split(block, pad - sizeof(MallocMetaData));
+        MetaData aligned = block->next;
+        removeFromListSize(aligned);
+        aligned->is_free = false;
+        freeBlock((char*) block + sizeof(MallocMetaData));
+        block = aligned;
+    }
+    split(block, size);
+    return block;
+}
+
+MetaData BlocksLinkedList::allocateAligned(size_t size, size_t alignment) {
+    MetaData iterator = this->list_by_size;
+    while (iterator)
+    {
+        if (iterator->is_free && alignedFits(iterator, size, alignment))
+        {
+            removeFromListSize(iterator);
+            iterator->is_free = false;
+            return carveAligned(iterator, size, alignment);
+        }
+        iterator = iterator->next_by_size;
+    }
+    // room for the worst placement, the rest is split off again
+    size_t room = (size > min_split_size ? size : min_split_size) + alignment +
+                  sizeof(MallocMetaData) + min_split_size;
+    MetaData block = (MetaData) allocateBlock(room);
+    if (block == NULL) {
+        return NULL;
+    }
+    return carveAligned(block, size, alignment);
+}
+
+// Map a block of its own, placing the header so that the payload is aligned to alignment.
+// Whole pages before the header's page are unmapped again, so the mapping always starts
+// at the page of the header and sfree can find it.
+MetaData BlocksLinkedList::mapBlock(size_t size, size_t alignment) {
+    size_t length = alignSize(sizeof(MallocMetaData) + size);
+    if (alignment > SMALLOC_ALIGNMENT) {
+        length += alignment;
+    }
+    char* mapping = (char*) sysMmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    size_t payload = ((size_t) mapping + sizeof(MallocMetaData) + alignment - 1) & ~(alignment - 1);
+    MetaData block = (MetaData) (payload - sizeof(MallocMetaData));
+    char* first_page = (char*) ((size_t) block & ~(pageSize() - 1));
+    char* end = (char*) ((payload + size + pageSize() - 1) & ~(pageSize() - 1));
+    char* mapping_end = (char*) (((size_t) mapping + length + pageSize() - 1) & ~(pageSize() - 1));
+    if (first_page > mapping) {
+        sysMunmap(mapping, first_page - mapping);
+    }
+    if (mapping_end > end) {
+        sysMunmap(end, mapping_end - end);
+    }
+    block->is_free = false;
+    block->kind = BLOCK_MMAP;
+    block->purged_pages = 0;
+    block->sampled = 0;
+    block->size = alignSize(size);
+    linkBlock(&this->mapped, block);
+    this->bytes_of_map += block->size;
+    this->num_of_map++;
+    Instrumentation::map(block);
+    return block;
+}
+
+// size is the block's size, sfree_sized knows it without reading the header
+void BlocksLinkedList::unmapBlock(MetaData block, size_t size) {
+    size_t first_page = (size_t) block & ~(pageSize() - 1);
+    Instrumentation::unmap(block);
+    unlinkBlock(&this->mapped, block);
+    this->num_of_map--;
+    this->bytes_of_map -= size;
+    sysMunmap((void*) first_page, (size_t) block + sizeof(MallocMetaData) + size - first_page);
+}
+
+Reservation BlocksLinkedList::get_reservation(MetaData block) {
+    return (Reservation) ((size_t) block - sizeof(ReserveData));
+}
+
+// Reserve address space for a block that can grow to max_size without moving.
+// Only the page holding the headers is committed, commitBlock does the rest.
+void* BlocksLinkedList::reserveBlock(size_t max_size) {
+    size_t overhead = sizeof(ReserveData) + sizeof(MallocMetaData);
+    size_t reserved = (overhead + max_size + pageSize() - 1) & ~(pageSize() - 1);
+    void* mapping = sysMmap(NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    if (mprotect(mapping, pageSize(), PROT_READ | PROT_WRITE) != 0) {
+        sysMunmap(mapping, reserved);
+        return NULL;
+    }
+    Reservation reservation = (Reservation) mapping;
+    reservation->reserved = reserved;
+    reservation->committed = pageSize();
+    MetaData block = (MetaData) ((char*) mapping + sizeof(ReserveData));
+    block->size = 0;
+    block->is_free = false;
+    block->kind = BLOCK_RESERVE;
+    block->purged_pages = 0;
+    block->sampled = 0;
+    linkBlock(&this->mapped, block);
+    this->num_of_reserved++;
+    this->bytes_of_reserved_space += reserved;
+    return block;
+}
+
+// Make the first size bytes of the block usable. Growing commits more pages in place,
+// shrinking hands the pages past the new end back to the kernel.
+bool BlocksLinkedList::commitBlock(MetaData block, size_t size) {
+    Reservation reservation = get_reservation(block);
+    char* mapping = (char*) reservation;
+    size_t overhead = sizeof(ReserveData) + sizeof(MallocMetaData);
+    if (size > reservation->reserved - overhead) {
+        return false;
+    }
+    size_t needed = (overhead + size + pageSize() - 1) & ~(pageSize() - 1);
+    if (needed > reservation->committed) {
+        if (mprotect(mapping + reservation->committed, needed - reservation->committed,
+                     PROT_READ | PROT_WRITE) != 0) {
+            return false;
+        }
+    } else if (needed < reservation->committed) {
+        sysMadvise(mapping + needed, reservation->committed - needed, MADV_DONTNEED);
+        mprotect(mapping + needed, reservation->committed - needed, PROT_NONE);
+    }
+    reservation->committed = needed;
+    this->bytes_of_reserved += alignSize(size) - block->size;
+    block->size = alignSize(size);
+    return true;
+}
+
+void BlocksLinkedList::releaseBlock(MetaData block) {
+    Reservation reservation = get_reservation(block);
+    unlinkBlock(&this->mapped, block);
+    this->num_of_reserved--;
+    this->bytes_of_reserved -= block->size;
+    this->bytes_of_reserved_space -= reservation->reserved;
+    sysMunmap(reservation, reservation->reserved);
+}
+
+size_t BlocksLinkedList::getNumOfTotalBlocks() {
+    MetaData iterator = this->list;
+    size_t counter = 0;
+    while (iterator) { // heap blocks only, merged ones may be larger than map_size
+        if (iterator->kind != BLOCK_FENCE) {
+            counter++;
+        }
+        iterator = iterator->next;
+    }
+    counter+=this->num_of_map;
+    counter+=this->num_of_reserved;
+    return counter;
+}
+
+size_t BlocksLinkedList::getNumOfTotalBytes() {
+    MetaData iterator = this->list;
+    size_t counter = 0;
+    while (iterator) {
+        counter += iterator->size;
+        iterator = iterator->next;
+    }
+    counter += this->bytes_of_map;
+    counter += this->bytes_of_reserved;
+    return counter;
+}
+
+size_t BlocksLinkedList::getNumOfFreeBlocks() {
+    MetaData iterator = this->list;
+    size_t counter = 0;
+    while (iterator) {
+        if(iterator->is_free) {
+            counter++;
+        }
+        iterator = iterator->next;
+    }
+    return counter;
+}
+
+size_t BlocksLinkedList::getNumOfFreeBytes() {
+    MetaData iterator = this->list;
+    size_t counter = 0;
+    while (iterator) {
+        if (iterator->is_free) {
+            counter += iterator->size;
+        }
+        iterator = iterator->next;
+    }
+    return counter;
+}
+
+size_t BlocksLinkedList::getNumOfDirtyBytes() {
+    MetaData iterator = this->list;
+    size_t counter = 0;
+    while (iterator) {
+        if (iterator->is_free) {
+            counter += iterator->size - iterator->purged_pages * pageSize();
+        }
+        iterator = iterator->next;
+    }
+    return counter;
+}
+
+void BlocksLinkedList::printFreeBlocks() {
+    MetaData iterator = this->list_by_size;
+    int counter = 1;
+    while (iterator) {
+        std::cout << "#########" << std::endl;
+        std::cout << "#########" << std::endl;
+        std::cout << "size of block number " << counter++ << " in bytes is " << iterator->size << std::endl;
+        std::cout << "#########" << std::endl;
+        std::cout << "#########" << std::endl;
+        std::cout << std::endl;
+        iterator = iterator->next;
+    }
+}
+
+////////////////////////////////////
+// Huge page filler for medium blocks //
+//////////////////////////////////////
+
+// Medium blocks are carved out of 2MB huge page regions in FILLER_PAGE_SIZE pages.
+// Allocation prefers the fullest region that fits, so few regions stay dense and the
+// rest drain; an empty region is unmapped as a whole huge page.
+typedef struct HugeRegion {
+    HugeRegion* next;
+    HugeRegion* prev;
+    size_t used_pages; // pages held by blocks, the header page is not counted
+    size_t longest_free; // longest run of free pages
+    bool is_hugetlb; // backed by a reserved huge page, otherwise advised for THP
+    unsigned long long used[FILLER_PAGES / 64]; // page bitmap
+} *Region;
+
+class HugePageFiller {
+private:
+    Region regions; // sorted by used_pages, fullest first
+
+public:
+    MetaData blocks; // every filler block, see linkBlock
+    bool enabled;
+    size_t num_of_blocks;
+    size_t bytes_of_blocks;
+    size_t num_of_regions;
+    size_t num_of_hugetlb_regions;
+    size_t used_pages;
+    constexpr HugePageFiller() : regions(NULL),blocks(NULL),enabled(false),num_of_blocks(0),bytes_of_blocks(0),
+                       num_of_regions(0),num_of_hugetlb_regions(0),used_pages(0) {};
+    void* allocateBlock(size_t size);
+    void freeBlock(MetaData block);
+    Region newRegion();
+    void insertRegion(Region region);
+    void removeRegion(Region region);
+    size_t findFreeRun(Region region, size_t pages);
+    void markPages(Region region, size_t first, size_t pages, bool used);
+    size_t longestFreeRun(Region region);
+    Region get_region(MetaData block);
+    size_t runPages(size_t size);
+};
+
+Region HugePageFiller::get_region(MetaData block) {
+    return (Region) ((size_t) block & ~((size_t) HUGE_PAGE_SIZE - 1));
+}
+
+size_t HugePageFiller::runPages(size_t size) {
+    return (size + sizeof(MallocMetaData) + FILLER_PAGE_SIZE - 1) / FILLER_PAGE_SIZE;
+}
+
+// Map a new 2MB aligned region, preferring reserved huge pages and falling back to
+// transparent huge pages.
+Region HugePageFiller::newRegion() {
+    bool is_hugetlb = true;
+    void* region = sysMmap(NULL, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB);
+    if (region == MAP_FAILED) {
+        is_hugetlb = false;
+        char* mapping = (char*) sysMmap(NULL, 2 * HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS);
+        if (mapping == MAP_FAILED) {
+            return NULL;
+        }
+        // keep only the aligned 2MB in the middle
+        char* aligned = (char*) (((size_t) mapping + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1));
+        if (aligned != mapping) {
+            sysMunmap(mapping, aligned - mapping);
+        }
+        sysMunmap(aligned + HUGE_PAGE_SIZE, mapping + HUGE_PAGE_SIZE - aligned);
+        sysMadvise(aligned, HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+        region = aligned;
+    }
+    Region new_region = (Region) region;
+    new_region->next = NULL;
+    new_region->prev = NULL;
+    new_region->used_pages = 0;
+    new_region->is_hugetlb = is_hugetlb;
+    memset(new_region->used, 0, sizeof(new_region->used));
+    markPages(new_region, 0, 1, true); // the region header lives in page 0
+    new_region->longest_free = FILLER_PAGES - 1;
+    this->num_of_regions++;
+    if (is_hugetlb) {
+        this->num_of_hugetlb_regions++;
+    }
+    return new_region;
+}
+
+void HugePageFiller::insertRegion(Region region) {
+    Region iterator = this->regions, prev = NULL;
+    while (iterator && iterator->used_pages > region->used_pages) {
+        prev = iterator;
+        iterator = iterator->next;
+    }
+    region->prev = prev;
+    region->next = iterator;
+    if (prev) {
+        prev->next = region;
+    } else {
+        this->regions = region;
+    }
+    if (iterator) {
+        iterator->prev = region;
+    }
+}
+
+void HugePageFiller::removeRegion(Region region) {
+    if (region->prev) {
+        region->prev->next = region->next;
+    } else {
+        this->regions = region->next;
+    }
+    if (region->next) {
+        region->next->prev = region->prev;
+    }
+    region->next = NULL;
+    region->prev = NULL;
+}
+
+void HugePageFiller::markPages(Region region, size_t first, size_t pages, bool used) {
+    for (size_t page = first; page < first + pages; page++) {
+        if (used) {
+            region->used[page / 64] |= 1ULL << (page % 64);
+        } else {
+            region->used[page / 64] &= ~(1ULL << (page % 64));
+        }
+    }
+}
+
+// first page of a free run of the given length, or 0 if there is none
+size_t HugePageFiller::findFreeRun(Region region, size_t pages) {
+    size_t run = 0;
+    for (size_t page = 1; page < FILLER_PAGES; page++) {
+        if (region->used[page / 64] & (1ULL << (page % 64))) {
+            run = 0;
+        } else if (++run == pages) {
+            return page + 1 - pages;
+        }
+    }
+    return 0;
+}
+
+size_t HugePageFiller::longestFreeRun(Region region) {
+    size_t run = 0, longest = 0;
+    for (size_t page = 1; page < FILLER_PAGES; page++) {
+        if (region->used[page / 64] & (1ULL << (page % 64))) {
+            run = 0;
+        } else if (++run > longest) {
+            longest = run;
+        }
+    }
+    return longest;
+}
+
+void* HugePageFiller::allocateBlock(size_t size) {
+    size_t pages = runPages(size);
+    Region region = this->regions;
+    while (region && region->longest_free < pages) {
+        region = region->next;
+    }
+    if (region == NULL) {
+        region = newRegion();
+        if (region == NULL) {
+            return NULL;
+        }
+    } else {
+        removeRegion(region);
+    }
+    size_t first = findFreeRun(region, pages);
+    markPages(region, first, pages, true);
+    region->used_pages += pages;
+    region->longest_free = longestFreeRun(region);
+    insertRegion(region);
+
+    MetaData block = (MetaData) ((char*) region + first * FILLER_PAGE_SIZE);
+    block->size = size;
+    block->is_free = false;
+    block->kind = BLOCK_FILLER;
+    block->purged_pages = 0;
+    block->sampled = 0;
+    block->next_by_size = NULL;
+    block->prev_by_size = NULL;
+    linkBlock(&this->blocks, block);
+    this->num_of_blocks++;
+    this->bytes_of_blocks += size;
+    this->used_pages += pages;
+    return block;
+}
+
+void HugePageFiller::freeBlock(MetaData block) {
+    Region region = get_region(block);
+    size_t pages = runPages(block->size);
+    size_t first = ((size_t) block - (size_t) region) / FILLER_PAGE_SIZE;
+    unlinkBlock(&this->blocks, block);
+    this->num_of_blocks--;
+    this->bytes_of_blocks -= block->size;
+    this->used_pages -= pages;
+
+    removeRegion(region);
+    markPages(region, first, pages, false);
+    region->used_pages -= pages;
+    if (region->used_pages == 0) {
+        // the whole huge page is empty, give it back
+        this->num_of_regions--;
+        if (region->is_hugetlb) {
+            this->num_of_hugetlb_regions--;
+        }
+        sysMunmap(region, HUGE_PAGE_SIZE);
+        return;
+    }
+    region->longest_free = longestFreeRun(region);
+    insertRegion(region);
+}
+
+///////////////////////////////
+// Sampling heap profiler //
+/////////////////////////////
+
+// About one allocation per rate bytes is sampled. The distance to the next sample is drawn
+// from an exponential distribution, so every allocated byte has the same chance of being
+// the sampled one and pprof can scale the samples back up (heap_v2). A sampled block has
+// the sampled flag in its header and a record in an open addressing table keyed by the
+// header, so sfree only looks for a record when the flag is set. That table doubles when
+// it fills up. Stacks are interned in a second table that only grows. Both tables are
+// mapped, the profiler never allocates from the engine. At rate 1 every allocation is
+// sampled, which makes the stack records an exact account of who holds the heap.
+// A sample also notes when it was taken, so that sfree can tell how long the object lived,
+// counted in allocations made since and in time, by stack and by size.
+
+// Sampled lifetimes of a stack or of a size class, bucket i counts lifetimes from 2^(i-1)
+// up to 2^i.
+typedef struct Lifetimes {
+    size_t sampled;
+    size_t freed; // of the sampled, the ones with a lifetime in the buckets
+    size_t allocs[LIFETIME_BUCKETS];
+    size_t ns[LIFETIME_BUCKETS];
+} Lifetimes;
+
+typedef struct ProfileStack {
+    size_t hash; // 0 for an empty slot
+    size_t depth;
+    void* frames[PROFILE_DEPTH];
+    size_t live_count; // sampled blocks of the stack not freed yet
+    size_t live_bytes;
+    size_t alloc_count; // every block sampled with the stack
+    size_t alloc_bytes;
+    Lifetimes lifetimes;
+} *Stack;
+
+typedef struct ProfileSample {
+    MetaData block; // NULL for an empty slot
+    Stack stack;
+    size_t size;
+    size_t birth; // num_of_allocations when it was sampled
+    uint64_t birth_ns;
+} *Sample;
+
+class HeapProfiler {
+private:
+    Sample samples;
+    size_t sample_slots; // a power of two
+    Stack stacks;
+    size_t num_of_stacks;
+    unsigned long long random_state;
+    bool in_sample; // a stack is being taken, allocations in the meantime are not sampled
+
+    size_t nextDistance();
+    Stack internStack(void** frames, size_t depth);
+    size_t findSample(MetaData block);
+    bool growSamples();
+    Stack topSite(Stack after, bool by_bytes);
+    void died(Sample record);
+
+public:
+    size_t rate; // 0 when sampling is off
+    size_t profile_rate; // rate the samples were taken at, for the profile header
+    size_t until_sample; // bytes left before the next sample, never runs out when off
+    size_t num_of_samples; // live sampled blocks
+    size_t num_of_dropped; // samples the tables had no room for
+    size_t num_of_allocations; // every allocation, the clock sampled lifetimes are counted in
+    Lifetimes* by_size; // sampled lifetimes by log2 size class, LIFETIME_SIZES of them
+    const char* exit_path; // SMALLOC_PROFILE, where the profile goes at exit
+    const char* lifetime_path; // SMALLOC_LIFETIME, where the lifetime profile goes at exit
+    constexpr HeapProfiler() : samples(NULL),sample_slots(0),stacks(NULL),num_of_stacks(0),random_state(0),in_sample(false),
+                     rate(0),profile_rate(0),until_sample((size_t) -1),num_of_samples(0),num_of_dropped(0),
+                     num_of_allocations(0),by_size(NULL),exit_path(NULL),lifetime_path(NULL) {};
+    bool setRate(size_t new_rate);
+    void sample(MetaData block, size_t size);
+    void drop(MetaData block);
+    size_t siteOf(MetaData block);
+    int dump(int fd);
+    int retained(int fd, size_t top);
+    int lifetimes(int fd);
+};
+
+// size class i holds the sizes from 2^(i-1) + 1 up to 2^i
+static size_t lifetimeSizeClass(size_t size) {
+    size_t size_class = size > 1 ? 64 - __builtin_clzll(size - 1) : 0;
+    return size_class < LIFETIME_SIZES ? size_class : LIFETIME_SIZES - 1;
+}
+
+static size_t sampleSlot(MetaData block, size_t slots) {
+    return (size_t) (((uintptr_t) block >> 4) * 11400714819323198485ull >> 32) & (slots - 1);
+}
+
+struct StackWalk {
+    void** frames;
+    size_t depth;
+    size_t skip; // frames of the profiler itself
+};
+
+static _Unwind_Reason_Code collectFrame(struct _Unwind_Context* context, void* arg) {
+    StackWalk* walk = (StackWalk*) arg;
+    if (walk->skip > 0) {
+        walk->skip--;
+        return _URC_NO_REASON;
+    }
+    void* ip = (void*) _Unwind_GetIP(context);
+    if (ip == NULL) { // past the outermost frame
+        return _URC_END_OF_STACK;
+    }
+    walk->frames[walk->depth++] = ip;
+    return walk->depth == PROFILE_DEPTH ? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+static uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+// The mappings of the process after a profile, for pprof and addr2line to symbolize with.
+static int writeMaps(int fd) {
+    const char maps_header[] = "\nMAPPED_LIBRARIES:\n";
+    if (!writeAll(fd, maps_header, sizeof(maps_header) - 1)) {
+        return -1;
+    }
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps < 0) {
+        return 0; // the counts are there, only symbolizing needs the mappings
+    }
+    char buffer[4096];
+    ssize_t got;
+    while ((got = read(maps, buffer, sizeof(buffer))) > 0 || (got < 0 && errno == EINTR)) {
+        if (got > 0 && !writeAll(fd, buffer, got)) {
+            close(maps);
+            return -1;
+        }
+    }
+    close(maps);
+    return 0;
+}
+
+// xorshift64*, -log of a uniform draw in (0, 1] scaled to the mean rate. Every byte at rate 1.
+size_t HeapProfiler::nextDistance() {
+    if (rate == 1) {
+        return 1;
+    }
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    double uniform = ((random_state * 2685821657736338717ull >> 11) + 1) / 9007199254740992.0;
+    double distance = -log(uniform) * rate;
+    return distance < 1 ? 1 : (size_t) distance;
+}
+
+// The tables are mapped the first time sampling is turned on, and kept.
+// libgcc sets the unwinder up on its first walk, and may allocate then. One walk when
+// sampling is turned on, outside of any allocation, so sample never allocates and never
+// calls back into the preload library while it holds engine_lock.
+static void warmUnwinder() {
+    static bool warm = false;
+    if (warm) {
+        return;
+    }
+    void* frames[PROFILE_DEPTH];
+    StackWalk walk = {frames, 0, 0};
+    _Unwind_Backtrace(collectFrame, &walk);
+    warm = true;
+}
+
+bool HeapProfiler::setRate(size_t new_rate) {
+    if (new_rate != 0) {
+        warmUnwinder();
+    }
+    if (new_rate != 0 && samples == NULL) {
+        size_t length = PROFILE_SAMPLES * sizeof(ProfileSample) + PROFILE_STACKS * sizeof(ProfileStack) +
+                        LIFETIME_SIZES * sizeof(Lifetimes);
+        void* mapping = sysMmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        // whole pages of samples first, growSamples unmaps them on their own
+        samples = (Sample) mapping;
+        sample_slots = PROFILE_SAMPLES;
+        stacks = (Stack) (samples + PROFILE_SAMPLES);
+        by_size = (Lifetimes*) (stacks + PROFILE_STACKS);
+        random_state = ((unsigned long long) (uintptr_t) mapping ^ (unsigned long long) time(NULL)) | 1;
+    }
+    rate = new_rate;
+    if (rate != 0) {
+        profile_rate = rate;
+    }
+    until_sample = rate != 0 ? nextDistance() : (size_t) -1;
+    return true;
+}
+
+Stack HeapProfiler::internStack(void** frames, size_t depth) {
+    size_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t) frames[i]) * 1099511628211ull;
+    }
+    hash |= 1;
+    size_t slot = hash & (PROFILE_STACKS - 1);
+    while (stacks[slot].hash != 0) {
+        if (stacks[slot].hash == hash && stacks[slot].depth == depth &&
+            memcmp(stacks[slot].frames, frames, depth * sizeof(void*)) == 0) {
+            return &stacks[slot];
+        }
+        slot = (slot + 1) & (PROFILE_STACKS - 1);
+    }
+    if (num_of_stacks >= PROFILE_STACKS / 4 * 3) {
+        return NULL;
+    }
+    num_of_stacks++;
+    stacks[slot].hash = hash;
+    stacks[slot].depth = depth;
+    memcpy(stacks[slot].frames, frames, depth * sizeof(void*));
+    return &stacks[slot];
+}
+
+// Record a block just handed out for size bytes and draw the distance to the next sample.
+// Not inlined, so the caller's stack frame stays small and the first frame skipped is ours.
+__attribute__((noinline)) void HeapProfiler::sample(MetaData block, size_t size) {
+    until_sample = nextDistance();
+    if (in_sample) {
+        return;
+    }
+    in_sample = true;
+    void* frames[PROFILE_DEPTH];
+    StackWalk walk = {frames, 0, 1};
+    _Unwind_Backtrace(collectFrame, &walk);
+    Stack stack = num_of_samples < sample_slots / 4 * 3 || growSamples() ? internStack(frames, walk.depth) : NULL;
+    in_sample = false;
+    if (stack == NULL) {
+        num_of_dropped++;
+        return;
+    }
+    size_t slot = sampleSlot(block, sample_slots);
+    while (samples[slot].block != NULL) {
+        slot = (slot + 1) & (sample_slots - 1);
+    }
+    samples[slot].block = block;
+    samples[slot].stack = stack;
+    samples[slot].size = size;
+    samples[slot].birth = num_of_allocations;
+    samples[slot].birth_ns = monotonicNs();
+    block->sampled = 1;
+    num_of_samples++;
+    stack->live_count++;
+    stack->live_bytes += size;
+    stack->alloc_count++;
+    stack->alloc_bytes += size;
+    stack->lifetimes.sampled++;
+    by_size[lifetimeSizeClass(size)].sampled++;
+}
+
+// Twice the slots for the sample records, which are hashed again into the new table.
+bool HeapProfiler::growSamples() {
+    if (sample_slots >= PROFILE_MAX_SAMPLES) {
+        return false;
+    }
+    size_t slots = sample_slots * 2;
+    void* mapping = sysMmap(NULL, slots * sizeof(ProfileSample), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    Sample grown = (Sample) mapping;
+    for (size_t i = 0; i < sample_slots; i++) {
+        if (samples[i].block == NULL) {
+            continue;
+        }
+        size_t slot = sampleSlot(samples[i].block, slots);
+        while (grown[slot].block != NULL) {
+            slot = (slot + 1) & (slots - 1);
+        }
+        grown[slot] = samples[i];
+    }
+    sysMunmap(samples, sample_slots * sizeof(ProfileSample));
+    samples = grown;
+    sample_slots = slots;
+    return true;
+}
+
+// slot of the block's record, sample_slots when it has none
+size_t HeapProfiler::findSample(MetaData block) {
+    size_t slot = sampleSlot(block, sample_slots);
+    while (samples[slot].block != block) {
+        if (samples[slot].block == NULL) {
+            return sample_slots;
+        }
+        slot = (slot + 1) & (sample_slots - 1);
+    }
+    return slot;
+}
+
+// The hash of the stack a sampled block was allocated from, 0 for any other block.
+size_t HeapProfiler::siteOf(MetaData block) {
+    if (!block->sampled) {
+        return 0;
+    }
+    size_t slot = findSample(block);
+    return slot != sample_slots ? samples[slot].stack->hash : 0;
+}
+
+static size_t lifetimeBucket(uint64_t value) {
+    size_t bucket = value != 0 ? 64 - __builtin_clzll(value) : 0;
+    return bucket < LIFETIME_BUCKETS ? bucket : LIFETIME_BUCKETS - 1;
+}
+
+// The lifetime of a sampled object that is freed or resized, by its stack and by its size.
+void HeapProfiler::died(Sample record) {
+    size_t allocs = lifetimeBucket(num_of_allocations - record->birth);
+    size_t ns = lifetimeBucket(monotonicNs() - record->birth_ns);
+    Lifetimes* by_stack = &record->stack->lifetimes;
+    Lifetimes* by_class = &by_size[lifetimeSizeClass(record->size)];
+    by_stack->freed++;
+    by_stack->allocs[allocs]++;
+    by_stack->ns[ns]++;
+    by_class->freed++;
+    by_class->allocs[allocs]++;
+    by_class->ns[ns]++;
+}
+
+// The block is freed or resized: its record goes, and the records after it in the probe
+// run are shifted back so that no lookup stops early at the hole.
+void HeapProfiler::drop(MetaData block) {
+    block->sampled = 0;
+    size_t slot = findSample(block);
+    if (slot == sample_slots) {
+        return;
+    }
+    samples[slot].stack->live_count--;
+    samples[slot].stack->live_bytes -= samples[slot].size;
+    died(&samples[slot]);
+    num_of_samples--;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & (sample_slots - 1); samples[next].block != NULL;
+         next = (next + 1) & (sample_slots - 1)) {
+        size_t home = sampleSlot(samples[next].block, sample_slots);
+        if (((next - home) & (sample_slots - 1)) >= ((next - hole) & (sample_slots - 1))) {
+            samples[hole] = samples[next];
+            hole = next;
+        }
+    }
+    samples[hole].block = NULL;
+}
+
+// The legacy heap profile text format pprof reads: in use and allocated counts and bytes,
+// in total and per stack, then the mappings of the process so pprof can symbolize.
+int HeapProfiler::dump(int fd) {
+    size_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    for (size_t i = 0; stacks != NULL && i < PROFILE_STACKS; i++) {
+        live_count += stacks[i].live_count;
+        live_bytes += stacks[i].live_bytes;
+        alloc_count += stacks[i].alloc_count;
+        alloc_bytes += stacks[i].alloc_bytes;
+    }
+    char line[128 + PROFILE_DEPTH * 20];
+    int length = snprintf(line, sizeof(line), "heap profile: %6zu: %8zu [%6zu: %8zu] @ heap_v2/%zu\n",
+                          live_count, live_bytes, alloc_count, alloc_bytes, profile_rate);
+    if (!writeAll(fd, line, length)) {
+        return -1;
+    }
+    for (size_t i = 0; stacks != NULL && i < PROFILE_STACKS; i++) {
+        Stack stack = &stacks[i];
+        if (stack->hash == 0) {
+            continue;
+        }
+        length = snprintf(line, sizeof(line), "%6zu: %8zu [%6zu: %8zu] @", stack->live_count, stack->live_bytes,
+                          stack->alloc_count, stack->alloc_bytes);
+        for (size_t frame = 0; frame < stack->depth; frame++) {
+            length += snprintf(line + length, sizeof(line) - length, " %p", stack->frames[frame]);
+        }
+        line[length++] = '\n';
+        if (!writeAll(fd, line, length)) {
+            return -1;
+        }
+    }
+    return writeMaps(fd);
+}
+
+// The next site after the given one in the order of retained bytes, or of retained
+// blocks, ties broken by hash. NULL after the last site with a live block.
+Stack HeapProfiler::topSite(Stack after, bool by_bytes) {
+    Stack best = NULL;
+    for (size_t i = 0; stacks != NULL && i < PROFILE_STACKS; i++) {
+        Stack stack = &stacks[i];
+        if (stack->live_count == 0) {
+            continue;
+        }
+        size_t key = by_bytes ? stack->live_bytes : stack->live_count;
+        if (after != NULL) {
+            size_t after_key = by_bytes ? after->live_bytes : after->live_count;
+            if (key > after_key || (key == after_key && stack->hash >= after->hash)) {
+                continue;
+            }
+        }
+        size_t best_key = best == NULL ? 0 : by_bytes ? best->live_bytes : best->live_count;
+        if (best == NULL || key > best_key || (key == best_key && stack->hash > best->hash)) {
+            best = stack;
+        }
+    }
+    return best;
+}
+
+// What is still allocated, by allocation site: the top sites by retained bytes, then by
+// retained blocks, each with its stack hash, counts and frames, then the mappings to
+// symbolize with. Sampled counts, exact at rate 1.
+int HeapProfiler::retained(int fd, size_t top) {
+    size_t live_count = 0, live_bytes = 0, sites = 0;
+    for (size_t i = 0; stacks != NULL && i < PROFILE_STACKS; i++) {
+        live_count += stacks[i].live_count;
+        live_bytes += stacks[i].live_bytes;
+        sites += stacks[i].live_count != 0;
+    }
+    char line[128 + PROFILE_DEPTH * 20];
+    int length = snprintf(line, sizeof(line), "retained: %zu blocks, %zu bytes from %zu sites, rate %zu, %zu dropped\n",
+                          live_count, live_bytes, sites, profile_rate, num_of_dropped);
+    if (!writeAll(fd, line, length)) {
+        return -1;
+    }
+    for (int by_bytes = 1; by_bytes >= 0; by_bytes--) {
+        length = snprintf(line, sizeof(line), "\ntop sites by retained %s:\n%16s %14s %10s %10s  stack\n",
+                          by_bytes ? "bytes" : "blocks", "site", "bytes", "blocks", "allocated");
+        if (!writeAll(fd, line, length)) {
+            return -1;
+        }
+        Stack stack = NULL;
+        for (size_t rank = 0; rank < top && (stack = topSite(stack, by_bytes)) != NULL; rank++) {
+            length = snprintf(line, sizeof(line), "%016zx %14zu %10zu %10zu ", stack->hash, stack->live_bytes,
+                              stack->live_count, stack->alloc_count);
+            for (size_t frame = 0; frame < stack->depth; frame++) {
+                length += snprintf(line + length, sizeof(line) - length, " %p", stack->frames[frame]);
+            }
+            line[length++] = '\n';
+            if (!writeAll(fd, line, length)) {
+                return -1;
+            }
+        }
+    }
+    return writeMaps(fd);
+}
+
+// upper bound of the bucket the q-th fraction of the freed samples falls in
+static unsigned long long lifetimeQuantile(const size_t* buckets, size_t freed, double q) {
+    size_t rank = (size_t) ceil(q * freed), seen = 0;
+    for (int i = 0; i < LIFETIME_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank && seen > 0) {
+            return 1ull << i;
+        }
+    }
+    return 0;
+}
+
+// short when nine in ten sampled objects died within LIFETIME_SHORT allocations, immortal
+// when nine in ten are still live
+static const char* lifetimeClass(const Lifetimes* lifetimes) {
+    if (lifetimes->sampled < LIFETIME_MIN_SAMPLES) {
+        return "-";
+    }
+    size_t short_lived = 0;
+    for (int i = 0; i < LIFETIME_BUCKETS && (1ull << i) <= LIFETIME_SHORT; i++) {
+        short_lived += lifetimes->allocs[i];
+    }
+    if (short_lived * 10 >= lifetimes->sampled * 9) {
+        return "short";
+    }
+    return (lifetimes->sampled - lifetimes->freed) * 10 >= lifetimes->sampled * 9 ? "immortal" : "-";
+}
+
+// Appends the counts, class, quantiles and non-empty buckets of one site or size class.
+static int formatLifetimes(char* line, size_t size, int length, const Lifetimes* lifetimes) {
+    length += snprintf(line + length, size - length,
+                       " sampled=%zu freed=%zu live=%zu class=%s allocs_p50=%llu allocs_p90=%llu ns_p50=%llu"
+                       " ns_p90=%llu allocs=",
+                       lifetimes->sampled, lifetimes->freed, lifetimes->sampled - lifetimes->freed,
+                       lifetimeClass(lifetimes), lifetimeQuantile(lifetimes->allocs, lifetimes->freed, 0.5),
+                       lifetimeQuantile(lifetimes->allocs, lifetimes->freed, 0.9),
+                       lifetimeQuantile(lifetimes->ns, lifetimes->freed, 0.5),
+                       lifetimeQuantile(lifetimes->ns, lifetimes->freed, 0.9));
+    for (int table = 0; table < 2; table++) {
+        const size_t* buckets = table == 0 ? lifetimes->allocs : lifetimes->ns;
+        const char* separator = table == 0 ? "" : " ns=";
+        length += snprintf(line + length, size - length, "%s", separator);
+        separator = "";
+        for (int i = 0; i < LIFETIME_BUCKETS; i++) {
+            if (buckets[i] != 0) {
+                length += snprintf(line + length, size - length, "%s%llu:%zu", separator, 1ull << i, buckets[i]);
+                separator = ",";
+            }
+        }
+    }
+    return length;
+}
+
+// The lifetime profile, one line of space separated key=value fields per record: a header,
+// then every sampled site by stack hash with its frames, then every sampled size class by
+// its upper bound. Lifetimes are in allocations made in between and in ns, as log2
+// histograms of "upper bound:count" pairs over the freed samples.
+int HeapProfiler::lifetimes(int fd) {
+    char line[1024 + 2 * LIFETIME_BUCKETS * 48 + PROFILE_DEPTH * 20];
+    int length = snprintf(line, sizeof(line),
+                          "lifetimes rate=%zu allocations=%zu samples=%zu dropped=%zu short=%d min_samples=%d\n",
+                          profile_rate, num_of_allocations, num_of_samples, num_of_dropped, LIFETIME_SHORT,
+                          LIFETIME_MIN_SAMPLES);
+    if (!writeAll(fd, line, length)) {
+        return -1;
+    }
+    for (size_t i = 0; stacks != NULL && i < PROFILE_STACKS; i++) {
+        Stack stack = &stacks[i];
+        if (stack->hash == 0 || stack->lifetimes.sampled == 0) {
+            continue;
+        }
+        length = snprintf(line, sizeof(line), "site=%016zx", stack->hash);
+        length = formatLifetimes(line, sizeof(line), length, &stack->lifetimes);
+        for (size_t frame = 0; frame < stack->depth; frame++) {
+            length += snprintf(line + length, sizeof(line) - length, "%s%p", frame == 0 ? " stack=" : ",",
+                               stack->frames[frame]);
+        }
+        line[length++] = '\n';
+        if (!writeAll(fd, line, length)) {
+            return -1;
+        }
+    }
+    for (int size_class = 0; by_size != NULL && size_class < LIFETIME_SIZES; size_class++) {
+        if (by_size[size_class].sampled == 0) {
+            continue;
+        }
+        length = snprintf(line, sizeof(line), "size=%llu", 1ull << size_class);
+        length = formatLifetimes(line, sizeof(line), length, &by_size[size_class]);
+        line[length++] = '\n';
+        if (!writeAll(fd, line, length)) {
+            return -1;
+        }
+    }
+    return writeMaps(fd);
+}
+
+///////////////////////////////////
+// Basic malloc implementations //
+/////////////////////////////////
+
+BlocksLinkedList blocks_list =  BlocksLinkedList(); // init our global list
+HugePageFiller huge_filler = HugePageFiller();
+HeapProfiler profiler = HeapProfiler();
+
+//////////////////////////
+// Latency histograms //
+////////////////////////
+
+// The instrumentation policy of -DSMALLOC_LATENCY, otherwise none of this exists. Each
+// public entry point is timed with the cycle counter and the time goes to a log2
+// histogram of the internal path the call took. The path is told from the engine's own
+// counters, read before and after the call, so its hooks stay empty. Calls made from
+// inside a timed call are part of it.
+
+// slatency operations and paths, keep in sync with my_stdlib.h
+#define SL_SMALLOC (0)
+#define SL_SCALLOC (1)
+#define SL_SALIGNED_ALLOC (2)
+#define SL_SFREE (3) // sfree_sized too
+#define SL_SREALLOC (4)
+#define SL_OPS (5)
+#define SL_PATH_REUSE (0) // a free block as it was
+#define SL_PATH_SPLIT (1) // a free block split
+#define SL_PATH_WILDERNESS (2) // the free block at the break grown
+#define SL_PATH_SBRK (3) // a new block at the break
+#define SL_PATH_MMAP (4) // a block mapped or unmapped on its own
+#define SL_PATH_FILLER (5) // a huge page filler block
+#define SL_PATH_FREE (6) // a block freed without a free neighbour
+#define SL_PATH_MERGE (7) // a block merged with a free neighbour
+#define SL_PATH_TRIM (8) // the wilderness given back with sbrk
+#define SL_PATH_REALLOC_A (9) // srealloc case A, B to H follow
+#define SL_PATHS (SL_PATH_REALLOC_A + REALLOC_CASES)
+#define SL_BUCKETS (64)
+
+// slatency result, keep in sync with my_stdlib.h
+struct slatency {
+    size_t count;
+    unsigned long long total; // cycles, or ns where there is no cycle counter
+    unsigned long long max;
+    size_t buckets[SL_BUCKETS]; // bucket i counts latencies from 2^(i-1) up to 2^i
+};
+
+#ifdef SMALLOC_LATENCY
+#if defined(__x86_64__) || defined(__i386__)
+#define LATENCY_UNIT "cycles"
+#else
+#define LATENCY_UNIT "ns"
+#endif
+
+static struct slatency latencies[SL_OPS][SL_PATHS];
+static int latency_depth = 0;
+static const char* latency_exit_path = NULL; // SMALLOC_LATENCY, where the table goes at exit
+
+static unsigned long long cycleCount() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+class LatencyScope {
+private:
+    int op;
+    bool outermost;
+    size_t sbrk_calls;
+    size_t munmap_calls;
+    size_t splits;
+    size_t merges;
+    size_t map_blocks;
+    size_t filler_blocks;
+    MetaData last_block;
+    size_t realloc_cases[REALLOC_CASES];
+    unsigned long long start;
+
+    int path();
+
+public:
+    explicit LatencyScope(int op);
+    ~LatencyScope();
+};
+
+LatencyScope::LatencyScope(int op) : op(op), outermost(latency_depth++ == 0) {
+    if (!outermost) {
+        return;
+    }
+    sbrk_calls = syscalls.sbrk;
+    munmap_calls = syscalls.munmap;
+    splits = blocks_list.num_of_splits;
+    merges = blocks_list.num_of_merges;
+    map_blocks = blocks_list.num_of_map;
+    filler_blocks = huge_filler.num_of_blocks;
+    last_block = blocks_list.getLastBlock();
+    if (op == SL_SREALLOC) {
+        memcpy(realloc_cases, blocks_list.realloc_cases, sizeof(realloc_cases));
+    }
+    start = cycleCount();
+}
+
+int LatencyScope::path() {
+    if (op == SL_SREALLOC) {
+        for (int i = 0; i < REALLOC_CASES; i++) {
+            if (blocks_list.realloc_cases[i] != realloc_cases[i]) {
+                return SL_PATH_REALLOC_A + i;
+            }
+        }
+        // srealloc of NULL, an allocation
+    }
+    if (huge_filler.num_of_blocks != filler_blocks) {
+        return SL_PATH_FILLER;
+    }
+    if (op == SL_SFREE) {
+        if (syscalls.munmap != munmap_calls) {
+            return SL_PATH_MMAP;
+        }
+        if (syscalls.sbrk != sbrk_calls) {
+            return SL_PATH_TRIM;
+        }
+        return blocks_list.num_of_merges != merges ? SL_PATH_MERGE : SL_PATH_FREE;
+    }
+    if (blocks_list.num_of_map != map_blocks) {
+        return SL_PATH_MMAP;
+    }
+    if (syscalls.sbrk != sbrk_calls) {
+        return blocks_list.getLastBlock() != last_block ? SL_PATH_SBRK : SL_PATH_WILDERNESS;
+    }
+    return blocks_list.num_of_splits != splits ? SL_PATH_SPLIT : SL_PATH_REUSE;
+}
+
+LatencyScope::~LatencyScope() {
+    latency_depth--;
+    if (!outermost) {
+        return;
+    }
+    unsigned long long cycles = cycleCount() - start;
+    struct slatency* latency = &latencies[op][path()];
+    latency->count++;
+    latency->total += cycles;
+    if (cycles > latency->max) {
+        latency->max = cycles;
+    }
+    latency->buckets[cycles != 0 ? 64 - __builtin_clzll(cycles) : 0]++;
+}
+
+// Upper bound of the bucket the q-th fraction of the calls falls in.
+static unsigned long long latencyQuantile(const struct slatency* latency, double q) {
+    size_t rank = (size_t) ceil(q * latency->count);
+    size_t seen = 0;
+    for (int i = 0; i < SL_BUCKETS; i++) {
+        seen += latency->buckets[i];
+        if (seen >= rank && seen > 0) {
+            unsigned long long bound = 1ull << i;
+            return bound < latency->max ? bound : latency->max;
+        }
+    }
+    return latency->max;
+}
+#endif
+
+// Allocation trace recorder
+//
+// Between srecord_start and srecord_stop every smalloc, scalloc, saligned_alloc, srealloc,
+// sexpand, sreserve, scommit, sfree and sfree_sized is logged with its arguments, result,
+// thread and time. A thread
+// appends its events to a ring of its own, read only by a writer thread started with the
+// recording: one producer and one consumer, no lock. The writer delta-encodes the events
+// and writes them out, so a call pays for a cycle counter read and a few stores. Nor does
+// it fence: srecord_stop has the kernel fence every thread (membarrier) before it looks
+// which producers are still between their look at active and their event. The last ring is
+// shared, under a lock, by the threads past TRACE_THREADS - 1. Nothing here allocates, a
+// thread's ring is mapped on its first event and kept for the next recording.
+
+// srecord ops, keep in sync with my_stdlib.h
+#define SR_MALLOC (0)
+#define SR_CALLOC (1)
+#define SR_ALIGNED_ALLOC (2)
+#define SR_REALLOC (3)
+#define SR_FREE (4)
+#define SR_EXPAND (5) // the size is the preferred one, the new id the usable size after
+#define SR_RESERVE (6)
+#define SR_COMMIT (7)
+#define SMALLOC_TRACE_MAGIC "smtrace1"
+
+static unsigned int num_of_threads = 0;
+static thread_local int thread_index = -1;
+
+// threads are numbered in the order they first ask
+static unsigned int threadIndex() {
+    if (thread_index < 0) {
+        thread_index = __atomic_fetch_add(&num_of_threads, 1, __ATOMIC_RELAXED);
+    }
+    return thread_index;
+}
+
+static void spinLock(int* lock) {
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void spinUnlock(int* lock) {
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+// event time stamps, cycles where there is a cycle counter
+static uint64_t traceTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return monotonicNs();
+#endif
+}
+
+struct TraceEvent {
+    uint64_t time_op; // ticks since the recording started << 8 | op
+    uint64_t size;
+    uint64_t old_id; // the alignment for SR_ALIGNED_ALLOC
+    uint64_t new_id;
+};
+
+struct TraceRing {
+    alignas(CACHE_LINE_SIZE) uint64_t head; // written by the producing thread
+    int busy; // the producer is between its look at recorder.active and its store of head
+    int lock; // taken by the threads sharing the last ring
+    size_t stalls; // events that waited for the writer to make room
+    alignas(CACHE_LINE_SIZE) uint64_t tail; // written by the writer
+    uint64_t last_time; // what the writer encodes deltas from
+    uint64_t last_id;
+    TraceEvent events[TRACE_RING_EVENTS];
+};
+
+class TraceRecorder {
+private:
+    TraceRing* rings[TRACE_THREADS];
+    int fd;
+    pthread_t writer;
+    bool stopping;
+    bool failed;
+    bool expedited; // registered for private expedited membarriers
+    uint64_t start_ticks;
+    double ns_per_tick;
+    size_t used;
+    char buffer[TRACE_BUFFER_SIZE];
+
+    TraceRing* ring(unsigned int thread);
+    void put(uint64_t value);
+    void putId(uint64_t id, TraceRing* ring);
+    void flush();
+    bool drain();
+    void fenceProducers();
+    static void* run(void* arg);
+    static void forgetInChild();
+
+public:
+    bool active;
+    uint64_t start_ns;
+    size_t num_of_events; // written by the last recording
+    size_t num_of_stalls;
+
+    int start(int fd);
+    int stop();
+    void record(int op, size_t size, const void* oldp, const void* newp);
+};
+
+TraceRecorder recorder;
+
+// the ring of a trace thread, mapped the first time, NULL if that fails
+TraceRing* TraceRecorder::ring(unsigned int thread) {
+    TraceRing* ring = __atomic_load_n(&rings[thread], __ATOMIC_ACQUIRE);
+    if (ring != NULL) {
+        return ring;
+    }
+    void* mapping = mmap(NULL, sizeof(TraceRing), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    ring = (TraceRing*) mapping;
+    TraceRing* expected = NULL;
+    if (!__atomic_compare_exchange_n(&rings[thread], &expected, ring, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(mapping, sizeof(TraceRing)); // another thread sharing the last ring was first
+        return expected;
+    }
+    return ring;
+}
+
+void TraceRecorder::record(int op, size_t size, const void* oldp, const void* newp) {
+    unsigned int thread = threadIndex();
+    bool shared = thread >= TRACE_THREADS - 1;
+    TraceRing* ring = this->ring(shared ? TRACE_THREADS - 1 : thread);
+    if (ring == NULL) {
+        return;
+    }
+    if (shared) {
+        spinLock(&ring->lock);
+    }
+    // stop clears active, fences this thread and then waits for busy to clear
+    __atomic_store_n(&ring->busy, 1, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&active, __ATOMIC_RELAXED)) {
+        uint64_t head = ring->head;
+        while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_EVENTS) {
+            ring->stalls++;
+            sched_yield();
+        }
+        TraceEvent* event = &ring->events[head & (TRACE_RING_EVENTS - 1)];
+        event->time_op = (traceTicks() - start_ticks) << 8 | op;
+        event->size = size;
+        event->old_id = (uintptr_t) oldp;
+        event->new_id = (uintptr_t) newp;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+    if (shared) {
+        spinUnlock(&ring->lock);
+    }
+}
+
+void TraceRecorder::flush() {
+    failed = failed || !writeAll(fd, buffer, used);
+    used = 0;
+}
+
+// LEB128
+void TraceRecorder::put(uint64_t value) {
+    while (value >= 0x80) {
+        buffer[used++] = (char) (value | 0x80);
+        value >>= 7;
+    }
+    buffer[used++] = (char) value;
+}
+
+// zigzag delta from the ring's last id
+void TraceRecorder::putId(uint64_t id, TraceRing* ring) {
+    int64_t delta = (int64_t) (id - ring->last_id);
+    put(((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));
+    ring->last_id = id;
+}
+
+// Writes out what the rings hold, a chunk per ring. Returns whether there was anything.
+bool TraceRecorder::drain() {
+    bool any = false;
+    for (unsigned int thread = 0; thread < TRACE_THREADS; thread++) {
+        TraceRing* ring = __atomic_load_n(&rings[thread], __ATOMIC_ACQUIRE);
+        if (ring == NULL) {
+            continue;
+        }
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            continue;
+        }
+        any = true;
+        while (tail != head) {
+            // a chunk header and its events must fit, the longest event takes 41 bytes
+            uint64_t count = (sizeof(buffer) - 20 - used) / 41;
+            if (count < 16) {
+                flush();
+                continue;
+            }
+            count = count < head - tail ? count : head - tail;
+            put(thread);
+            put(count);
+            for (uint64_t i = 0; i < count; i++, tail++) {
+                TraceEvent* event = &ring->events[tail & (TRACE_RING_EVENTS - 1)];
+                int op = event->time_op & 0xff;
+                uint64_t time = (uint64_t) ((event->time_op >> 8) * ns_per_tick);
+                buffer[used++] = (char) op;
+                put(time - ring->last_time);
+                ring->last_time = time;
+                if (op != SR_FREE) {
+                    put(event->size);
+                }
+                if (op == SR_ALIGNED_ALLOC) {
+                    put(event->old_id);
+                } else if (op == SR_REALLOC || op == SR_FREE || op == SR_EXPAND || op == SR_COMMIT) {
+                    putId(event->old_id, ring);
+                }
+                if (op == SR_EXPAND) {
+                    put(event->new_id);
+                } else if (op != SR_FREE) {
+                    putId(event->new_id, ring);
+                }
+            }
+            num_of_events += count;
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE); // the room is free once encoded
+        }
+    }
+    flush();
+    return any;
+}
+
+void* TraceRecorder::run(void* arg) {
+    TraceRecorder* recorder = (TraceRecorder*) arg;
+    while (!__atomic_load_n(&recorder->stopping, __ATOMIC_ACQUIRE)) {
+        if (!recorder->drain()) {
+            struct timespec idle = {0, TRACE_IDLE_NS};
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+// A full fence on every thread of the process, so that a producer either saw active
+// cleared or its busy flag is visible. Without membarrier, a grace period has to do.
+void TraceRecorder::fenceProducers() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (expedited && syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0) == 0) {
+        return;
+    }
+    if (syscall(SYS_membarrier, MEMBARRIER_CMD_GLOBAL, 0, 0) == 0) {
+        return;
+    }
+    struct timespec grace = {0, 10 * TRACE_IDLE_NS};
+    nanosleep(&grace, NULL);
+}
+
+// a forked child has no writer thread, the rings would fill up and stall it
+void TraceRecorder::forgetInChild() {
+    recorder.active = false;
+}
+
+// Starts recording to fd, which the recorder then owns. -1 if it already records, the
+// header cannot be written or the writer thread cannot be started.
+int TraceRecorder::start(int fd) {
+    static bool registered = false;
+    if (active) {
+        return -1;
+    }
+    if (!registered) {
+        pthread_atfork(NULL, NULL, forgetInChild);
+        expedited = syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+        registered = true;
+    }
+    this->fd = fd;
+    failed = false;
+    used = 0;
+    stopping = false;
+    num_of_events = 0;
+    start_ns = monotonicNs();
+    start_ticks = traceTicks();
+    ns_per_tick = 1;
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec calibration = {0, TRACE_IDLE_NS};
+    nanosleep(&calibration, NULL);
+    ns_per_tick = (double) (monotonicNs() - start_ns) / (traceTicks() - start_ticks);
+#endif
+    for (unsigned int thread = 0; thread < TRACE_THREADS; thread++) {
+        if (rings[thread] != NULL) {
+            rings[thread]->tail = rings[thread]->head;
+            rings[thread]->stalls = 0;
+            rings[thread]->last_time = 0;
+            rings[thread]->last_id = 0;
+        }
+    }
+    failed = !writeAll(fd, SMALLOC_TRACE_MAGIC, 8) || !writeAll(fd, (const char*) &start_ns, sizeof(start_ns));
+    if (failed || pthread_create(&writer, NULL, run, this) != 0) {
+        return -1;
+    }
+    __atomic_store_n(&active, true, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+// Stops recording, writes out the rest and closes the file. 0, or -1 if it did not record
+// or a write failed.
+int TraceRecorder::stop() {
+    if (!active) {
+        return -1;
+    }
+    __atomic_store_n(&active, false, __ATOMIC_RELAXED);
+    fenceProducers();
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    num_of_stalls = 0;
+    for (unsigned int thread = 0; thread < TRACE_THREADS; thread++) {
+        if (rings[thread] != NULL) {
+            while (__atomic_load_n(&rings[thread]->busy, __ATOMIC_ACQUIRE)) {
+                drain(); // a stalled producer waits for room
+            }
+            num_of_stalls += rings[thread]->stalls;
+        }
+    }
+    drain();
+    close(fd);
+    return failed ? -1 : 0;
+}
+
+// The public entry points log here, after they did their work. Off it is one compare.
+static inline void traced(int op, size_t size, const void* oldp, const void* newp) {
+    if (__builtin_expect(__atomic_load_n(&recorder.active, __ATOMIC_RELAXED), 0)) {
+        recorder.record(op, size, oldp, newp);
+    }
+}
+
+// Live stats page
+//
+// sstats_publish maps /dev/shm/smalloc.<pid>, and from then on the engine copies its
+// counters there, at most every STATS_INTERVAL_MS and looking at the clock only every
+// PURGE_TICK_OPS calls, for tools/smalloc_top to read from outside the process. The
+// update is a seqlock: seq is odd while the page is written, a reader that saw it change
+// copies again. Calls are counted all the time, so rates are right from the first update.
+
+struct sstats_page;
+
+class StatsPublisher {
+private:
+    struct sstats_page* page;
+    long last_ms;
+
+    void publish();
+    static void forgetInChild();
+
+public:
+    size_t calls; // on the engine's own heap
+
+    int start();
+    int stop();
+    bool publishing() { return page != NULL; };
+    void tick();
+};
+
+StatsPublisher stats_publisher;
+
+void StatsPublisher::tick() {
+    if (++calls % PURGE_TICK_OPS == 0 && page != NULL) {
+        publish();
+    }
+}
+
+// set by the SMALLOC_RETAIN_SIGNAL handler, the report is written by the next call
+static volatile sig_atomic_t retain_requested = 0;
+static void writeRetained();
+
+// once per call on the engine's own heap: the purge clock, the stats page and a
+// retention report asked for
+static void engineTick() {
+    blocks_list.tick();
+    stats_publisher.tick();
+    if (retain_requested) {
+        writeRetained();
+    }
+}
+
+// Every block smalloc, scalloc, saligned_alloc and srealloc hand out passes here. With
+// sampling off until_sample never runs out, so this is a count and one compare.
+static void* profiled(void* p, size_t size) {
+    profiler.num_of_allocations++;
+    if (size < profiler.until_sample) {
+        profiler.until_sample -= size;
+    } else if (p != NULL) {
+        profiler.sample(blocks_list.get_metadata(p), size);
+    }
+    return p;
+}
+
+static void* allocatePayload(size_t size, size_t* dirty_bytes, size_t alignment) {
+    if (size == 0 || size > max_alloc_size) {
+        return NULL;
+    }
+    engineTick();
+    size_t left = ((size_t)sbrk(0)) % SMALLOC_ALIGNMENT;
+    if (left != 0)
+    {
+        blocks_list.moreCore(SMALLOC_ALIGNMENT - left);
+    }
+    // filler payloads sit a header past a page boundary
+    if (huge_filler.enabled && size >= FILLER_MIN_SIZE && size < map_size && size < FILLER_MAX_SIZE &&
+        sizeof(MallocMetaData) % alignment == 0) {
+        void* block = huge_filler.allocateBlock(blocks_list.alignSize(size));
+        if (block != NULL) {
+            if (dirty_bytes) {
+                *dirty_bytes = size; // pages of a region are reused without being cleared
+            }
+            return (char*) block + sizeof(MallocMetaData);
+        }
+    }
+    if (size >= map_size || alignment >= map_size) {
+        MetaData block = blocks_list.mapBlock(size, alignment);
+        if (block == NULL) {
+            return NULL;
+        }
+        if (dirty_bytes) {
+            *dirty_bytes = 0; // fresh anonymous mappings are zero-filled
+        }
+        return (char*)block+sizeof(MallocMetaData);
+    }
+
+    if (alignment > SMALLOC_ALIGNMENT) {
+        MetaData block = blocks_list.allocateAligned(size, alignment);
+        if (block == NULL) {
+            return NULL;
+        }
+        if (dirty_bytes) {
+            *dirty_bytes = size;
+        }
+        return (char*) block + sizeof(MallocMetaData);
+    }
+    void* prog_break = blocks_list.allocateBlock(size, dirty_bytes);
+    if (prog_break == NULL) {
+        return NULL;
+    }
+    return (char*) prog_break + sizeof(MallocMetaData); // return the address of prog_break with an offset of the meta-data struct size
+}
+
+static void* allocate(size_t size, size_t* dirty_bytes, size_t alignment = SMALLOC_ALIGNMENT) {
+    return profiled(allocatePayload(size, dirty_bytes, alignment), size);
+}
+
+void* smalloc(size_t size) {
+    Instrumentation::Call call(SL_SMALLOC);
+    void* p = allocate(size, NULL);
+    traced(SR_MALLOC, size, NULL, p);
+    return p;
+}
+
+void* scalloc(size_t num, size_t size) {
+    Instrumentation::Call call(SL_SCALLOC);
+    size_t dirty_bytes = num * size;
+    void* ptr = allocate(num * size, &dirty_bytes);
+    traced(SR_CALLOC, num * size, NULL, ptr);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    // only clear what may hold old data, fresh mappings and heap pages are already zero
+    memset(ptr, 0, dirty_bytes < num * size ? dirty_bytes : num * size);
+    return ptr;
+}
+
+// sfree without the trace, for the engine's own frees
+static void deallocate(void* p) {
+    engineTick();
+    MetaData data = blocks_list.get_metadata(p);
+    if (data->sampled) {
+        profiler.drop(data);
+    }
+
+    if(data->kind == BLOCK_FILLER)
+    {
+        huge_filler.freeBlock(data);
+    }
+    else if(data->kind == BLOCK_RESERVE)
+    {
+        blocks_list.releaseBlock(data);
+    }
+    else if(data->kind == BLOCK_MMAP)
+    {
+        blocks_list.unmapBlock(data, data->size);
+    }
+    else
+    {
+        blocks_list.freeBlock(p);
+    }
+}
+
+void sfree(void* p) {
+    if (p == NULL) {
+        return;
+    }
+    Instrumentation::Call call(SL_SFREE);
+    traced(SR_FREE, 0, p, NULL);
+    deallocate(p);
+}
+
+// srealloc fallback: move the data to a new block
+static void* reallocateByCopy(void* oldp, MetaData oldb, size_t size) {
+    size_t calls = syscalls.sbrk + syscalls.mmap;
+    void* newp = allocate(size, NULL);
+    if (newp == NULL) {
+        return NULL;
+    }
+    size_t moved = oldb->size < size ? oldb->size : size;
+    memmove(newp, oldp, moved);
+    deallocate(oldp);
+    blocks_list.moved_bytes += moved;
+    blocks_list.reallocCase(calls == syscalls.sbrk + syscalls.mmap ? REALLOC_G : REALLOC_H, size);
+    return newp;
+}
+
+static void* reallocate(void* oldp, size_t size) {
+    if (size == 0 || size > max_alloc_size) {
+        return NULL;
+    }
+    if (oldp == NULL) {
+        return allocate(size, NULL);
+    }
+    engineTick();
+    MetaData oldb = blocks_list.get_metadata(oldp);
+    if (oldb->sampled) {
+        profiler.drop(oldb); // to the profiler the resized block is a new allocation
+    }
+    if (oldb->kind == BLOCK_FILLER)
+    {
+        if (size >= FILLER_MIN_SIZE && size < map_size && size < FILLER_MAX_SIZE &&
+            huge_filler.runPages(blocks_list.alignSize(size)) == huge_filler.runPages(oldb->size))
+        {//the block keeps its pages
+            huge_filler.bytes_of_blocks += blocks_list.alignSize(size) - oldb->size;
+            oldb->size = blocks_list.alignSize(size);
+            blocks_list.reallocCase(REALLOC_A, size);
+            return profiled(oldp, size);
+        }
+        return reallocateByCopy(oldp, oldb, size);
+    }
+    if (oldb->kind == BLOCK_RESERVE)
+    {
+        if (blocks_list.commitBlock(oldb, size))
+        {//grows inside its reservation
+            blocks_list.reallocCase(REALLOC_A, size);
+            return profiled(oldp, size);
+        }
+        return reallocateByCopy(oldp, oldb, size);
+    }
+    if (oldb->kind == BLOCK_MMAP)
+    {
+        if (oldb->size == size)
+        {
+            blocks_list.reallocCase(REALLOC_A, size);
+            return profiled(oldp, size);
+        }
+        return reallocateByCopy(oldp, oldb, size);
+    }
+    MetaData block = blocks_list.resizeInPlace(oldb, size);
+    if (block != NULL) {
+        return profiled((char*) block + sizeof(MallocMetaData), size);
+    }
+    return reallocateByCopy(oldp, oldb, size);
+}
+
+void* srealloc(void* oldp, size_t size) {
+    Instrumentation::Call call(SL_SREALLOC);
+    void* newp = reallocate(oldp, size);
+    traced(SR_REALLOC, size, oldp, newp);
+    return newp;
+}
+
+// sexpand without the instrumentation, the block's usable size after or 0
+static size_t expand(MetaData block, size_t min_size, size_t preferred_size) {
+    if (block->kind == BLOCK_FILLER)
+    {//the block can use the rest of its pages, but keeps all of them when it shrinks
+        size_t capacity = huge_filler.runPages(block->size) * FILLER_PAGE_SIZE - sizeof(MallocMetaData);
+        if (capacity < min_size) {
+            return 0;
+        }
+        if (preferred_size <= block->size) {
+            return block->size;
+        }
+        size_t size = blocks_list.alignSize(preferred_size < capacity ? preferred_size : capacity);
+        huge_filler.bytes_of_blocks += size - block->size;
+        block->size = size;
+        return size;
+    }
+    if (block->kind == BLOCK_RESERVE)
+    {
+        if (blocks_list.commitBlock(block, preferred_size) || blocks_list.commitBlock(block, min_size)) {
+            return block->size;
+        }
+        return 0;
+    }
+    if (block->kind == BLOCK_MMAP)
+    {
+        size_t size = blocks_list.resizeMapped(block, preferred_size);
+        return size ? size : blocks_list.resizeMapped(block, min_size);
+    }
+    return blocks_list.expandInPlace(block, min_size, preferred_size);
+}
+
+// srealloc that never moves: grows or shrinks p in place to preferred_size, or to at least
+// min_size when that is all there is room for. Returns the usable size p has now, or 0
+// when not even min_size fits, p is left as it was then. Timed and profiled as an srealloc
+// that did not move.
+size_t sexpand(void* p, size_t min_size, size_t preferred_size) {
+    Instrumentation::Call call(SL_SREALLOC);
+    if (preferred_size < min_size) {
+        preferred_size = min_size;
+    }
+    size_t size = 0;
+    if (p != NULL && min_size != 0 && preferred_size <= max_alloc_size) {
+        engineTick();
+        MetaData block = blocks_list.get_metadata(p);
+        size_t old_size = block->size;
+        size = expand(block, min_size, preferred_size);
+        if (size != 0 && size != old_size) {
+            if (block->sampled) {
+                profiler.drop(block); // to the profiler the resized block is a new allocation
+            }
+            profiled(p, size);
+        }
+    }
+    traced(SR_EXPAND, preferred_size, p, (void*) size);
+    return size;
+}
+
+void* saligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    Instrumentation::Call call(SL_SALIGNED_ALLOC);
+    void* p = allocate(size, NULL, alignment < SMALLOC_ALIGNMENT ? SMALLOC_ALIGNMENT : alignment);
+    traced(SR_ALIGNED_ALLOC, size, (void*) alignment, p);
+    return p;
+}
+
+// Free with the size the block was allocated (or last reallocated) with, which sfree has to
+// read from the header. Sizes from map_size on are mapped blocks but for reserved ones (and
+// ones allocated before map_size was changed), those are unmapped with the given size. Heap
+// blocks are recognized by address and go straight to freeBlock, without the kind dispatch of
+// sfree. Builds with SMALLOC_CHECK_SIZES abort on a size that does not fit the block.
+void sfree_sized(void* p, size_t size) {
+    if (p == NULL) {
+        return;
+    }
+    Instrumentation::Call call(SL_SFREE);
+    traced(SR_FREE, 0, p, NULL);
+    MetaData block = blocks_list.get_metadata(p);
+#ifdef SMALLOC_CHECK_SIZES
+    // mapped, filler and reserved blocks keep the exact size, heap blocks may have slack from
+    // a split that was not worth it
+    bool exact = block->kind != BLOCK_HEAP;
+    if (size > block->size || (exact && blocks_list.alignSize(size) != block->size)) {
+        std::cerr << "sfree_sized(): size " << size << " does not match block of " << block->size << std::endl;
+        abort();
+    }
+#endif
+    if (size >= map_size && block->kind == BLOCK_MMAP) {
+        engineTick();
+        if (block->sampled) {
+            profiler.drop(block);
+        }
+        blocks_list.unmapBlock(block, blocks_list.alignSize(size));
+        return;
+    }
+    if (blocks_list.inHeap(block)) {
+        engineTick();
+        if (block->sampled) {
+            profiler.drop(block);
+        }
+        blocks_list.freeBlock(p);
+        return;
+    }
+    deallocate(p);
+}
+
+size_t smalloc_usable_size(void* p) {
+    if (p == NULL) {
+        return 0;
+    }
+    return blocks_list.get_metadata(p)->size;
+}
+
+static void* reserve(size_t max_size) {
+    if (max_size == 0 || max_size > max_alloc_size) {
+        return NULL;
+    }
+    void* block = blocks_list.reserveBlock(max_size);
+    if (block == NULL) {
+        return NULL;
+    }
+    return (char*) block + sizeof(MallocMetaData);
+}
+
+void* sreserve(size_t max_size) {
+    void* p = reserve(max_size);
+    traced(SR_RESERVE, max_size, NULL, p);
+    return p;
+}
+
+static void* commit(void* p, size_t new_size) {
+    if (p == NULL) {
+        return NULL;
+    }
+    MetaData block = blocks_list.get_metadata(p);
+    if (block->kind != BLOCK_RESERVE || !blocks_list.commitBlock(block, new_size)) {
+        return NULL;
+    }
+    return p;
+}
+
+void* scommit(void* p, size_t new_size) {
+    void* result = commit(p, new_size);
+    traced(SR_COMMIT, new_size, p, result);
+    return result;
+}
+
+// A heap handle lives at the start of its first segment. Its list never touches sbrk, it
+// grows into segments of its own, so the whole heap goes away with them.
+struct SmallocHeap {
+    BlocksLinkedList list;
+};
+typedef SmallocHeap* sheap_t;
+
+// sheap_stats result, keep in sync with my_stdlib.h
+struct sheap_info {
+    size_t allocated_blocks;
+    size_t allocated_bytes;
+    size_t free_blocks;
+    size_t free_bytes;
+    size_t meta_data_bytes;
+    size_t segments;
+    size_t segment_bytes;
+};
+
+sheap_t sheap_create() {
+    void* mapping = sysMmap(NULL, HEAP_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    Segment segment = (Segment) mapping;
+    segment->next = NULL;
+    segment->length = HEAP_SEGMENT_SIZE;
+    sheap_t heap = new ((char*) mapping + sizeof(HeapSegment)) SmallocHeap();
+    heap->list.useSegments((char*) (heap + 1), (char*) mapping + HEAP_SEGMENT_SIZE, segment);
+    return heap;
+}
+
+void* sheap_alloc(sheap_t heap, size_t size) {
+    if (heap == NULL || size == 0 || size > max_alloc_size) {
+        return NULL;
+    }
+    heap->list.tick();
+    void* block = heap->list.allocateBlock(size);
+    if (block == NULL) {
+        return NULL;
+    }
+    return (char*) block + sizeof(MallocMetaData);
+}
+
+void* sheap_aligned_alloc(sheap_t heap, size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    if (alignment <= SMALLOC_ALIGNMENT) {
+        return sheap_alloc(heap, size);
+    }
+    if (heap == NULL || size == 0 || size > max_alloc_size) {
+        return NULL;
+    }
+    heap->list.tick();
+    MetaData block = heap->list.allocateAligned(size, alignment);
+    if (block == NULL) {
+        return NULL;
+    }
+    return (char*) block + sizeof(MallocMetaData);
+}
+
+void sheap_free(sheap_t heap, void* p) {
+    if (heap == NULL || p == NULL) {
+        return;
+    }
+    heap->list.tick();
+    heap->list.freeBlock(p);
+}
+
+void* sheap_realloc(sheap_t heap, void* oldp, size_t size) {
+    if (heap == NULL || size == 0 || size > max_alloc_size) {
+        return NULL;
+    }
+    if (oldp == NULL) {
+        return sheap_alloc(heap, size);
+    }
+    heap->list.tick();
+    MetaData oldb = heap->list.get_metadata(oldp);
+    MetaData block = heap->list.resizeInPlace(oldb, size);
+    if (block != NULL) {
+        return (char*) block + sizeof(MallocMetaData);
+    }
+    void* newp = sheap_alloc(heap, size);
+    if (newp == NULL) {
+        return NULL;
+    }
+    memmove(newp, oldp, oldb->size);
+    sheap_free(heap, oldp);
+    return newp;
+}
+
+struct sheap_info sheap_stats(sheap_t heap) {
+    struct sheap_info info = {};
+    if (heap == NULL) {
+        return info;
+    }
+    info.allocated_blocks = heap->list.getNumOfTotalBlocks();
+    info.allocated_bytes = heap->list.getNumOfTotalBytes();
+    info.free_blocks = heap->list.getNumOfFreeBlocks();
+    info.free_bytes = heap->list.getNumOfFreeBytes();
+    info.meta_data_bytes = info.allocated_blocks * sizeof(MallocMetaData);
+    info.segments = heap->list.num_of_segments;
+    info.segment_bytes = heap->list.bytes_of_segments;
+    return info;
+}
+
+// Unmaps the segments, live blocks are not visited.
+void sheap_destroy(sheap_t heap) {
+    if (heap == NULL) {
+        return;
+    }
+    heap->list.releaseSegments();
+}
+
+// sheap_dump stream, keep in sync with my_stdlib.h
+#define SHEAP_DUMP_MAGIC "smheap02"
+
+struct sheap_dump_header {
+    char magic[8];
+    uint64_t heap_start; // header of the first heap block
+    uint64_t heap_end; // end of the last heap block
+    uint32_t record_size;
+    uint32_t header_size; // of a block, in front of its payload
+    uint32_t page_size;
+    uint32_t reserved;
+};
+
+struct sheap_dump_record {
+    uint64_t address; // of the block's header
+    uint64_t size;
+    uint64_t site; // the profiler's stack hash, as in its reports
+    uint8_t kind; // BlockKind
+    uint8_t is_free;
+    uint8_t reserved[6];
+};
+
+// Records are gathered in a buffer on the stack and written in batches, nothing is
+// allocated. After a failed write the rest is dropped.
+class DumpWriter {
+private:
+    int fd;
+    size_t used;
+    bool failed;
+    struct sheap_dump_record records[128];
+
+public:
+    explicit DumpWriter(int fd) : fd(fd), used(0), failed(false) {};
+    void add(MetaData block);
+    void write(const void* data, size_t length);
+    bool flush();
+};
+
+void DumpWriter::add(MetaData block) {
+    struct sheap_dump_record* record = &records[used++];
+    record->address = (uintptr_t) block;
+    record->size = block->size;
+    record->site = profiler.siteOf(block);
+    record->kind = block->kind;
+    record->is_free = block->is_free;
+    memset(record->reserved, 0, sizeof(record->reserved));
+    if (used == sizeof(records) / sizeof(records[0])) {
+        flush();
+    }
+}
+
+void DumpWriter::write(const void* data, size_t length) {
+    failed = failed || !writeAll(fd, (const char*) data, length);
+}
+
+bool DumpWriter::flush() {
+    write(records, used * sizeof(records[0]));
+    used = 0;
+    return !failed;
+}
+
+// Write the blocks of a heap handle, or of the engine's own heap for NULL, to fd: a
+// sheap_dump_header, then a record per heap block in address order and, for the engine's
+// heap, one per block mapped on its own (mmap, sreserve and huge page filler blocks).
+// Nothing is allocated, so it may be called from anywhere the engine may. Returns 0, or -1
+// when a write failed.
+int sheap_dump(sheap_t heap, int fd) {
+    BlocksLinkedList* list = heap != NULL ? &heap->list : &blocks_list;
+    MetaData last = list->getLastBlock();
+    struct sheap_dump_header header;
+    memcpy(header.magic, SHEAP_DUMP_MAGIC, sizeof(header.magic));
+    header.heap_start = (uintptr_t) list->getFirstBlock();
+    header.heap_end = last != NULL ? (uintptr_t) last + sizeof(MallocMetaData) + last->size : 0;
+    header.record_size = sizeof(struct sheap_dump_record);
+    header.header_size = sizeof(MallocMetaData);
+    header.page_size = list->pageSize();
+    header.reserved = 0;
+    DumpWriter writer(fd);
+    writer.write(&header, sizeof(header));
+    for (MetaData block = list->getFirstBlock(); block != NULL; block = block->next) {
+        writer.add(block);
+    }
+    if (heap == NULL) {
+        for (MetaData block = blocks_list.mapped; block != NULL; block = block->next) {
+            writer.add(block);
+        }
+        for (MetaData block = huge_filler.blocks; block != NULL; block = block->next) {
+            writer.add(block);
+        }
+    }
+    return writer.flush() ? 0 : -1;
+}
+
+// A pool of fixed-size objects. Objects have no header: a free object holds the next one of
+// the free list in its first word. Slabs come from a heap handle of the pool's own, so
+// destroying the pool is destroying that heap. Slabs are kept until then, a freed object
+// only goes back to the free list.
+// Without a cache a pool is single threaded, like the engine. spool_cache gives each thread
+// a front cache, and the free list and slabs behind them are then guarded by the pool lock.
+struct alignas(CACHE_LINE_SIZE) PoolCache {
+    void* head;
+    size_t count;
+    size_t allocs; // only written by the thread holding the slot
+    size_t frees;
+};
+
+struct SmallocPool {
+    SmallocPool* next_pool; // all pools, for the _num_pool_* stats
+    SmallocPool* prev_pool;
+    sheap_t heap;
+    size_t obj_size;
+    size_t stride;
+    void* free_list;
+    char* bump; // the part of the last slab no object was carved from yet
+    char* bump_end;
+    size_t num_of_slabs;
+    size_t bytes_of_slabs;
+    size_t num_of_objects; // carved so far
+    size_t used_objects; // handed out outside of the caches
+    size_t cache_objects; // most objects a front cache holds, 0 without caches
+    PoolCache* caches;
+    int lock;
+};
+typedef SmallocPool* spool_t;
+
+// spool_stats result, keep in sync with my_stdlib.h
+struct spool_info {
+    size_t obj_size;
+    size_t stride;
+    size_t slabs;
+    size_t slab_bytes;
+    size_t used_objects;
+    size_t free_objects; // carved and not in use, the front caches included
+};
+
+static SmallocPool* pools = NULL;
+static int pools_lock = 0;
+
+// Front cache slots: a thread takes the lowest free slot on its first cached call and uses
+// the cache of that slot in every pool. When it exits, its caches go back to their pools
+// and the slot to the next thread. A thread that found no slot, or is past its exit, has
+// no cache and takes the pool lock.
+static int pool_slots[POOL_CACHE_THREADS];
+static thread_local int pool_slot = -1;
+static pthread_key_t pool_slot_key;
+static bool pool_slot_keyed = false;
+static pthread_once_t pool_slot_once = PTHREAD_ONCE_INIT;
+
+static void releasePoolSlot(void* value);
+
+static void createPoolSlotKey() {
+    pool_slot_keyed = pthread_key_create(&pool_slot_key, releasePoolSlot) == 0;
+}
+
+static unsigned int poolSlot() {
+    if (pool_slot >= 0) {
+        return pool_slot;
+    }
+    pool_slot = POOL_CACHE_THREADS;
+    pthread_once(&pool_slot_once, createPoolSlotKey);
+    if (!pool_slot_keyed) {
+        return pool_slot; // the slot could not be given back
+    }
+    for (int slot = 0; slot < POOL_CACHE_THREADS; slot++) {
+        if (__atomic_load_n(&pool_slots[slot], __ATOMIC_RELAXED) == 0 &&
+            __atomic_exchange_n(&pool_slots[slot], 1, __ATOMIC_ACQUIRE) == 0) {
+            if (pthread_setspecific(pool_slot_key, (void*) (uintptr_t) (slot + 1)) != 0) {
+                __atomic_store_n(&pool_slots[slot], 0, __ATOMIC_RELEASE);
+                break;
+            }
+            pool_slot = slot;
+            break;
+        }
+    }
+    return pool_slot;
+}
+
+// the front cache of this thread, NULL if the pool has none or the thread has no slot
+static PoolCache* poolCache(spool_t pool) {
+    if (pool->caches == NULL) {
+        return NULL;
+    }
+    unsigned int slot = poolSlot();
+    return slot < POOL_CACHE_THREADS ? &pool->caches[slot] : NULL;
+}
+
+// An object off the free list, or a new one carved from the last slab. Called with the
+// pool locked when it has caches.
+static void* poolTake(spool_t pool) {
+    void* object = pool->free_list;
+    if (object != NULL) {
+        pool->free_list = *(void**) object;
+        return object;
+    }
+    if (pool->bump + pool->stride > pool->bump_end) {
+        size_t slab_size = POOL_SLAB_SIZE < 16 * pool->stride ? 16 * pool->stride : POOL_SLAB_SIZE;
+        size_t alignment = pool->stride & -pool->stride; // the largest power of two dividing it
+        char* slab = (char*) sheap_aligned_alloc(pool->heap, alignment < 8 ? 8 : alignment, slab_size);
+        if (slab == NULL) {
+            return NULL;
+        }
+        pool->bump = slab;
+        pool->bump_end = slab + slab_size;
+        pool->num_of_slabs++;
+        pool->bytes_of_slabs += slab_size;
+    }
+    object = pool->bump;
+    pool->bump += pool->stride;
+    pool->num_of_objects++;
+    return object;
+}
+
+static void poolPut(spool_t pool, void* object) {
+    *(void**) object = pool->free_list;
+    pool->free_list = object;
+}
+
+// Move objects from a front cache to the free list until keep are left. Takes the pool lock.
+static void poolDrain(spool_t pool, PoolCache* cache, size_t keep) {
+    spinLock(&pool->lock);
+    while (cache->count > keep) {
+        void* object = cache->head;
+        cache->head = *(void**) object;
+        cache->count--;
+        poolPut(pool, object);
+    }
+    spinUnlock(&pool->lock);
+}
+
+// pool_slot_key destructor, at the exit of a thread with a slot
+static void releasePoolSlot(void* value) {
+    int slot = (int) (uintptr_t) value - 1;
+    spinLock(&pools_lock);
+    for (spool_t pool = pools; pool != NULL; pool = pool->next_pool) {
+        if (pool->caches != NULL) {
+            poolDrain(pool, &pool->caches[slot], 0);
+        }
+    }
+    spinUnlock(&pools_lock);
+    pool_slot = POOL_CACHE_THREADS;
+    __atomic_store_n(&pool_slots[slot], 0, __ATOMIC_RELEASE);
+}
+
+spool_t spool_create(size_t obj_size, size_t align) {
+    if (align == 0) {
+        align = 8;
+    }
+    if ((align & (align - 1)) != 0 || obj_size == 0 || obj_size > max_alloc_size || align > MAP_SIZE) {
+        return NULL;
+    }
+    sheap_t heap = sheap_create();
+    if (heap == NULL) {
+        return NULL;
+    }
+    spool_t pool = (spool_t) sheap_alloc(heap, sizeof(SmallocPool));
+    if (pool == NULL) {
+        sheap_destroy(heap);
+        return NULL;
+    }
+    size_t stride = obj_size < sizeof(void*) ? sizeof(void*) : obj_size;
+    pool->heap = heap;
+    pool->obj_size = obj_size;
+    pool->stride = (stride + align - 1) & ~(align - 1);
+    pool->free_list = NULL;
+    pool->bump = NULL;
+    pool->bump_end = NULL;
+    pool->num_of_slabs = 0;
+    pool->bytes_of_slabs = 0;
+    pool->num_of_objects = 0;
+    pool->used_objects = 0;
+    pool->cache_objects = 0;
+    pool->caches = NULL;
+    pool->lock = 0;
+    spinLock(&pools_lock);
+    pool->prev_pool = NULL;
+    pool->next_pool = pools;
+    if (pools != NULL) {
+        pools->prev_pool = pool;
+    }
+    pools = pool;
+    spinUnlock(&pools_lock);
+    return pool;
+}
+
+// Give every thread a front cache of up to objects objects. Only before the first
+// spool_alloc, and not undone.
+int spool_cache(spool_t pool, size_t objects) {
+    if (pool == NULL || objects < 2 || pool->caches != NULL || pool->num_of_objects != 0) {
+        return -1;
+    }
+    PoolCache* caches = (PoolCache*) sheap_aligned_alloc(pool->heap, CACHE_LINE_SIZE,
+                                                         POOL_CACHE_THREADS * sizeof(PoolCache));
+    if (caches == NULL) {
+        return -1;
+    }
+    memset(caches, 0, POOL_CACHE_THREADS * sizeof(PoolCache));
+    pool->cache_objects = objects;
+    pool->caches = caches;
+    return 0;
+}
+
+void* spool_alloc(spool_t pool) {
+    PoolCache* cache = poolCache(pool);
+    if (cache == NULL) {
+        if (pool->caches == NULL) {
+            void* object = poolTake(pool);
+            pool->used_objects += object != NULL;
+            return object;
+        }
+        spinLock(&pool->lock);
+        void* object = poolTake(pool);
+        pool->used_objects += object != NULL;
+        spinUnlock(&pool->lock);
+        return object;
+    }
+    if (cache->head == NULL) {
+        // refill half of the cache at once, so the lock is taken once every few calls
+        spinLock(&pool->lock);
+        for (size_t i = 0; i < pool->cache_objects / 2; i++) {
+            void* object = poolTake(pool);
+            if (object == NULL) {
+                break;
+            }
+            *(void**) object = cache->head;
+            cache->head = object;
+            cache->count++;
+        }
+        spinUnlock(&pool->lock);
+        if (cache->head == NULL) {
+            return NULL;
+        }
+    }
+    void* object = cache->head;
+    cache->head = *(void**) object;
+    cache->count--;
+    __atomic_store_n(&cache->allocs, cache->allocs + 1, __ATOMIC_RELAXED); // spool_stats reads it
+    return object;
+}
+
+void spool_free(spool_t pool, void* p) {
+    if (p == NULL) {
+        return;
+    }
+    PoolCache* cache = poolCache(pool);
+    if (cache == NULL) {
+        if (pool->caches == NULL) {
+            poolPut(pool, p);
+            pool->used_objects--;
+            return;
+        }
+        spinLock(&pool->lock);
+        poolPut(pool, p);
+        pool->used_objects--;
+        spinUnlock(&pool->lock);
+        return;
+    }
+    *(void**) p = cache->head;
+    cache->head = p;
+    cache->count++;
+    __atomic_store_n(&cache->frees, cache->frees + 1, __ATOMIC_RELAXED);
+    if (cache->count >= pool->cache_objects) {
+        // a full cache gives half of it back, objects freed by another thread than the
+        // one that allocated them would pile up otherwise
+        poolDrain(pool, cache, pool->cache_objects / 2);
+    }
+}
+
+// Objects still in use are dropped with their slabs.
+void spool_destroy(spool_t pool) {
+    if (pool == NULL) {
+        return;
+    }
+    spinLock(&pools_lock);
+    if (pool->prev_pool != NULL) {
+        pool->prev_pool->next_pool = pool->next_pool;
+    } else {
+        pools = pool->next_pool;
+    }
+    if (pool->next_pool != NULL) {
+        pool->next_pool->prev_pool = pool->prev_pool;
+    }
+    spinUnlock(&pools_lock);
+    sheap_destroy(pool->heap);
+}
+
+// Exact when no other thread uses the pool, a snapshot otherwise.
+struct spool_info spool_stats(spool_t pool) {
+    struct spool_info info = {};
+    if (pool == NULL) {
+        return info;
+    }
+    spinLock(&pool->lock);
+    info.obj_size = pool->obj_size;
+    info.stride = pool->stride;
+    info.slabs = pool->num_of_slabs;
+    info.slab_bytes = pool->bytes_of_slabs;
+    info.used_objects = pool->used_objects;
+    if (pool->caches != NULL) {
+        for (int i = 0; i < POOL_CACHE_THREADS; i++) {
+            info.used_objects += __atomic_load_n(&pool->caches[i].allocs, __ATOMIC_RELAXED) -
+                                 __atomic_load_n(&pool->caches[i].frees, __ATOMIC_RELAXED);
+        }
+    }
+    info.free_objects = pool->num_of_objects - info.used_objects;
+    spinUnlock(&pool->lock);
+    return info;
+}
+
+// Sample about one allocation per sample_rate bytes, 0 stops sampling. Blocks sampled
+// before stay in the profile until they are freed. Returns 0, or -1 when the profiler's
+// tables could not be mapped.
+int sprofile(size_t sample_rate) {
+    if (sample_rate > MAX_PROFILE_RATE || !profiler.setRate(sample_rate)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Write the profile to fd in the format pprof reads. Nothing is allocated, so it may be
+// called from anywhere the engine may. Returns 0, or -1 when a write failed.
+int sprofile_dump(int fd) {
+    return profiler.dump(fd);
+}
+
+// The allocation sites holding the most sampled bytes and blocks, up to sites of each. With
+// sprofile(1) every block is sampled and this is who holds the heap. Nothing is allocated.
+// Returns 0, or -1 when a write failed.
+int sprofile_retained(int fd, size_t sites) {
+    return profiler.retained(fd, sites);
+}
+
+// How long the sampled objects lived, by allocation site and by size, see
+// HeapProfiler::lifetimes for the format. Nothing is allocated. Returns 0, or -1 when a
+// write failed.
+int sprofile_lifetimes(int fd) {
+    return profiler.lifetimes(fd);
+}
+
+// Records every allocator call to path until srecord_stop. 0, or -1 if a recording is
+// already running or path or the writer thread cannot be set up.
+int srecord_start(const char* path) {
+    if (recorder.active) {
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (recorder.start(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+int srecord_stop() {
+    return recorder.stop();
+}
+
+// The histogram of one operation and path. Returns 0, or -1 for an unknown one or when the
+// engine was built without SMALLOC_LATENCY.
+int slatency(int op, int path, struct slatency* latency) {
+#ifdef SMALLOC_LATENCY
+    if (op < 0 || op >= SL_OPS || path < 0 || path >= SL_PATHS || latency == NULL) {
+        return -1;
+    }
+    *latency = latencies[op][path];
+    return 0;
+#else
+    (void) op;
+    (void) path;
+    (void) latency;
+    return -1;
+#endif
+}
+
+void slatency_reset() {
+#ifdef SMALLOC_LATENCY
+    memset(latencies, 0, sizeof(latencies));
+#endif
+}
+
+// One line per operation and path that was taken: count, mean, quantiles and max, then
+// the non-empty buckets as "upper bound:count". Nothing is allocated. Returns 0, or -1 when
+// a write failed or the engine was built without SMALLOC_LATENCY.
+int slatency_dump(int fd) {
+#ifdef SMALLOC_LATENCY
+    static const char* op_names[SL_OPS] = {"smalloc", "scalloc", "saligned_alloc", "sfree", "srealloc"};
+    static const char* path_names[SL_PATHS] = {"reuse", "split", "wilderness", "sbrk", "mmap", "filler", "free",
+                                               "merge", "trim", "realloc_a", "realloc_b", "realloc_c", "realloc_d",
+                                               "realloc_e", "realloc_f", "realloc_g", "realloc_h"};
+    char line[256 + SL_BUCKETS * 32];
+    int length = snprintf(line, sizeof(line), "%-15s %-11s %10s %10s %10s %10s %10s %10s  (" LATENCY_UNIT ")\n",
+                          "op", "path", "count", "mean", "p50", "p99", "p99.9", "max");
+    if (!writeAll(fd, line, length)) {
+        return -1;
+    }
+    for (int op = 0; op < SL_OPS; op++) {
+        for (int path = 0; path < SL_PATHS; path++) {
+            const struct slatency* latency = &latencies[op][path];
+            if (latency->count == 0) {
+                continue;
+            }
+            length = snprintf(line, sizeof(line), "%-15s %-11s %10zu %10llu %10llu %10llu %10llu %10llu ",
+                              op_names[op], path_names[path], latency->count, latency->total / latency->count,
+                              latencyQuantile(latency, 0.5), latencyQuantile(latency, 0.99),
+                              latencyQuantile(latency, 0.999), latency->max);
+            for (int i = 0; i < SL_BUCKETS; i++) {
+                if (latency->buckets[i] != 0) {
+                    length += snprintf(line + length, sizeof(line) - length, " %llu:%zu", 1ull << i,
+                                       latency->buckets[i]);
+                }
+            }
+            line[length++] = '\n';
+            if (!writeAll(fd, line, length)) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+#else
+    (void) fd;
+    return -1;
+#endif
+}
+
+// The count and bytes of one event. Returns 0, or -1 for an unknown one or when the engine
+// was built without SMALLOC_COUNTING.
+int sinstrument(int event, struct sinstrument* result) {
+#ifdef SMALLOC_COUNTING
+    if (event < 0 || event >= SI_EVENTS || result == NULL) {
+        return -1;
+    }
+    *result = instrument_counts[event];
+    return 0;
+#else
+    (void) event;
+    (void) result;
+    return -1;
+#endif
+}
+
+// Copies up to count of the latest events, oldest first, and returns how many it copied.
+// Always 0 when the engine was built without SMALLOC_TRACING.
+size_t sinstrument_trace(struct sinstrument_event* events, size_t count) {
+#ifdef SMALLOC_TRACING
+    uint64_t kept = instrument_seq < INSTRUMENT_TRACE_EVENTS ? instrument_seq : INSTRUMENT_TRACE_EVENTS;
+    if (events == NULL || count > kept) {
+        count = events == NULL ? 0 : kept;
+    }
+    for (size_t i = 0; i < count; i++) {
+        events[i] = instrument_trace[(instrument_seq - count + i) % INSTRUMENT_TRACE_EVENTS];
+    }
+    return count;
+#else
+    (void) events;
+    (void) count;
+    return 0;
+#endif
+}
+
+void sinstrument_reset() {
+#if defined(SMALLOC_COUNTING)
+    memset(instrument_counts, 0, sizeof(instrument_counts));
+#elif defined(SMALLOC_TRACING)
+    instrument_seq = 0;
+#endif
+}
+
+// What the counting or tracing policy has: a line per event with its count and bytes, or a
+// line per kept event. Nothing is allocated. Returns 0, or -1 when a write failed or the
+// engine was built with neither.
+int sinstrument_dump(int fd) {
+#if defined(SMALLOC_COUNTING) || defined(SMALLOC_TRACING)
+    static const char* event_names[SI_EVENTS] = {"split", "merge", "grow", "mmap", "munmap", "realloc_a",
+                                                 "realloc_b", "realloc_c", "realloc_d", "realloc_e",
+                                                 "realloc_f", "realloc_g", "realloc_h"};
+    char line[256];
+    int length;
+#endif
+#if defined(SMALLOC_COUNTING)
+    length = snprintf(line, sizeof(line), "%-11s %12s %16s\n", "event", "count", "bytes");
+    if (!writeAll(fd, line, length)) {
+        return -1;
+    }
+    for (int event = 0; event < SI_EVENTS; event++) {
+        length = snprintf(line, sizeof(line), "%-11s %12zu %16zu\n", event_names[event],
+                          instrument_counts[event].count, instrument_counts[event].bytes);
+        if (!writeAll(fd, line, length)) {
+            return -1;
+        }
+    }
+    return 0;
+#elif defined(SMALLOC_TRACING)
+    static const char* op_names[SL_OPS] = {"smalloc", "scalloc", "saligned_alloc", "sfree", "srealloc"};
+    length = snprintf(line, sizeof(line), "%12s %-15s %-11s %18s %12s\n", "seq", "op", "event", "block", "bytes");
+    if (!writeAll(fd, line, length)) {
+        return -1;
+    }
+    uint64_t kept = instrument_seq < INSTRUMENT_TRACE_EVENTS ? instrument_seq : INSTRUMENT_TRACE_EVENTS;
+    for (uint64_t seq = instrument_seq - kept; seq < instrument_seq; seq++) {
+        const struct sinstrument_event* entry = &instrument_trace[seq % INSTRUMENT_TRACE_EVENTS];
+        length = snprintf(line, sizeof(line), "%12llu %-15s %-11s %#18llx %12llu\n",
+                          (unsigned long long) entry->seq, entry->op >= 0 ? op_names[entry->op] : "-",
+                          event_names[entry->event], (unsigned long long) entry->address,
+                          (unsigned long long) entry->bytes);
+        if (!writeAll(fd, line, length)) {
+            return -1;
+        }
+    }
+    return 0;
+#else
+    (void) fd;
+    return -1;
+#endif
+}
+
+int smallopt(int param, long value) {
+    switch (param) {
+        case SM_DECAY_MS:
+            blocks_list.decay_ms = value; // negative disables decay purging
+            return 1;
+        case SM_PURGE_ADVICE:
+            if (value != MADV_DONTNEED && value != MADV_FREE) {
+                return 0;
+            }
+            blocks_list.purge_advice = value;
+            return 1;
+        case SM_TRIM_THRESHOLD:
+            blocks_list.trim_threshold = value < 0 ? (size_t) -1 : (size_t) value; // negative disables trimming
+            return 1;
+        case SM_TOP_PAD:
+            if (value < 0) {
+                return 0;
+            }
+            blocks_list.top_pad = value;
+            return 1;
+        case SM_HUGEPAGE_FILLER:
+            huge_filler.enabled = value != 0;
+            return 1;
+        case SM_MAP_SIZE:
+            if (value < FILLER_PAGE_SIZE || value > MAX_TUNABLE_SIZE) {
+                return 0;
+            }
+            map_size = value; // blocks keep their kind, the ones mapped before are still unmapped
+            return 1;
+        case SM_MIN_SPLIT_SIZE:
+            if (value < 8 || value > MAX_TUNABLE_SIZE) {
+                return 0;
+            }
+            min_split_size = blocks_list.alignSize(value);
+            blocks_list.countStranded();
+            return 1;
+        case SM_MAX_SIZE:
+            if (value < 1 || value > MAX_TUNABLE_SIZE) {
+                return 0;
+            }
+            max_alloc_size = value;
+            return 1;
+        case SM_PROFILE_RATE:
+            if (value < 0) {
+                return 0;
+            }
+            return sprofile(value) == 0;
+        default:
+            return 0;
+    }
+}
+
+// The current value of a smallopt parameter, false for an unknown one.
+static bool optionValue(int param, long* value) {
+    switch (param) {
+        case SM_DECAY_MS:
+            *value = blocks_list.decay_ms;
+            return true;
+        case SM_PURGE_ADVICE:
+            *value = blocks_list.purge_advice;
+            return true;
+        case SM_TRIM_THRESHOLD:
+            *value = blocks_list.trim_threshold == (size_t) -1 ? -1 : (long) blocks_list.trim_threshold;
+            return true;
+        case SM_TOP_PAD:
+            *value = blocks_list.top_pad;
+            return true;
+        case SM_HUGEPAGE_FILLER:
+            *value = huge_filler.enabled;
+            return true;
+        case SM_MAP_SIZE:
+            *value = map_size;
+            return true;
+        case SM_MIN_SPLIT_SIZE:
+            *value = min_split_size;
+            return true;
+        case SM_MAX_SIZE:
+            *value = max_alloc_size;
+            return true;
+        case SM_PROFILE_RATE:
+            *value = profiler.rate;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// smallctl and SMALLOC_CONF names of the smallopt parameters
+static const struct {
+    const char* name;
+    int param;
+} options[] = {
+    {"decay_ms", SM_DECAY_MS},
+    {"purge_advice", SM_PURGE_ADVICE},
+    {"trim_threshold", SM_TRIM_THRESHOLD},
+    {"top_pad", SM_TOP_PAD},
+    {"hugepage_filler", SM_HUGEPAGE_FILLER},
+    {"map_size", SM_MAP_SIZE},
+    {"min_split_size", SM_MIN_SPLIT_SIZE},
+    {"max_size", SM_MAX_SIZE},
+    {"profile_rate", SM_PROFILE_RATE},
+};
+
+static int optionParam(const char* name, size_t length) {
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        if (strncmp(options[i].name, name, length) == 0 && options[i].name[length] == '\0') {
+            return options[i].param;
+        }
+    }
+    return 0;
+}
+
+// Read a parameter into old_value and set it to new_value, either may be NULL.
+// Returns 0, ENOENT for an unknown name or EINVAL for a value smallopt rejects.
+int smallctl(const char* name, long* old_value, const long* new_value) {
+    int param = name != NULL ? optionParam(name, strlen(name)) : 0;
+    long value;
+    if (param == 0 || !optionValue(param, &value)) {
+        return ENOENT;
+    }
+    if (new_value != NULL && !smallopt(param, *new_value)) {
+        return EINVAL;
+    }
+    if (old_value != NULL) {
+        *old_value = value;
+    }
+    return 0;
+}
+
+static void confWarning(const char* entry, size_t length) {
+    const char prefix[] = "smalloc: bad SMALLOC_CONF entry: ";
+    ssize_t ignored = write(STDERR_FILENO, prefix, sizeof(prefix) - 1);
+    ignored += write(STDERR_FILENO, entry, length);
+    ignored += write(STDERR_FILENO, "\n", 1);
+    (void) ignored;
+}
+
+int sstats_publish(int on); // with the stats page, at the end
+
+static void fileWarning(const char* variable) {
+    const char prefix[] = "smalloc: could not write the file named by ";
+    ssize_t ignored = write(STDERR_FILENO, prefix, sizeof(prefix) - 1);
+    ignored += write(STDERR_FILENO, variable, strlen(variable));
+    ignored += write(STDERR_FILENO, "\n", 1);
+    (void) ignored;
+}
+
+static void dumpToPath(const char* path, int (*dump)(int), const char* variable) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || dump(fd) != 0) {
+        fileWarning(variable);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static const char* retain_path = NULL; // SMALLOC_RETAIN, where the retention report goes
+
+static int retainedReport(int fd) {
+    return sprofile_retained(fd, RETAIN_TOP_SITES);
+}
+
+static void writeRetained() {
+    retain_requested = 0;
+    dumpToPath(retain_path, retainedReport, "SMALLOC_RETAIN");
+}
+
+// The engine may be in the middle of a call, the report waits for the next one.
+static void requestRetained(int) {
+    retain_requested = 1;
+}
+
+// SMALLOC_CONF="name:value,name:value", the smallctl names, read once before main. It runs
+// before the engine is first used by the program, but a preloaded engine may have served
+// the C runtime already, with the defaults. Nothing here allocates.
+// SMALLOC_PROFILE=path turns the heap profiler on at the default rate, profile_rate in
+// SMALLOC_CONF still picks another one, and the profile is written to path at exit.
+// SMALLOC_LATENCY=path writes the latency histograms to path at exit, when they are built in.
+// SMALLOC_INSTRUMENT=path does the same with sinstrument_dump, for the counting and
+// tracing policies.
+// SMALLOC_TRACE=path records every call from here on to path, up to exit.
+// SMALLOC_STATS=1 publishes the stats page from startup.
+// SMALLOC_LIFETIME=path samples from startup like SMALLOC_PROFILE and writes the lifetime
+// profile to path at exit.
+// SMALLOC_RETAIN=path samples every allocation from startup and writes the sites holding the
+// most memory to path at exit, and also on signal SMALLOC_RETAIN_SIGNAL when that is set.
+__attribute__((constructor)) static void readConf() {
+#ifdef SMALLOC_LATENCY
+    latency_exit_path = getenv("SMALLOC_LATENCY");
+#endif
+#if defined(SMALLOC_COUNTING) || defined(SMALLOC_TRACING)
+    instrument_exit_path = getenv("SMALLOC_INSTRUMENT");
+#endif
+    profiler.exit_path = getenv("SMALLOC_PROFILE");
+    if (profiler.exit_path != NULL) {
+        sprofile(PROFILE_DEFAULT_RATE);
+    }
+    profiler.lifetime_path = getenv("SMALLOC_LIFETIME");
+    if (profiler.lifetime_path != NULL && profiler.rate == 0) {
+        sprofile(PROFILE_DEFAULT_RATE);
+    }
+    retain_path = getenv("SMALLOC_RETAIN");
+    const char* retain_signal = getenv("SMALLOC_RETAIN_SIGNAL");
+    if (retain_path != NULL) {
+        sprofile(1);
+    }
+    if (retain_path != NULL && retain_signal != NULL) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = requestRetained;
+        action.sa_flags = SA_RESTART;
+        if (sigaction(atoi(retain_signal), &action, NULL) != 0) {
+            const char warning[] = "smalloc: could not catch SMALLOC_RETAIN_SIGNAL\n";
+            ssize_t ignored = write(STDERR_FILENO, warning, sizeof(warning) - 1);
+            (void) ignored;
+        }
+    }
+    const char* stats = getenv("SMALLOC_STATS");
+    if (stats != NULL && atoi(stats) != 0 && sstats_publish(1) != 0) {
+        const char warning[] = "smalloc: could not publish the SMALLOC_STATS page\n";
+        ssize_t ignored = write(STDERR_FILENO, warning, sizeof(warning) - 1);
+        (void) ignored;
+    }
+    const char* trace = getenv("SMALLOC_TRACE");
+    if (trace != NULL && srecord_start(trace) != 0) {
+        fileWarning("SMALLOC_TRACE");
+    }
+    const char* conf = getenv("SMALLOC_CONF");
+    if (conf == NULL) {
+        return;
+    }
+    while (*conf != '\0') {
+        size_t length = strcspn(conf, ",");
+        const char* colon = (const char*) memchr(conf, ':', length);
+        int param = colon != NULL ? optionParam(conf, colon - conf) : 0;
+        char* end = NULL;
+        long value = colon != NULL ? strtol(colon + 1, &end, 0) : 0;
+        if (param == 0 || end == colon + 1 || end != conf + length || !smallopt(param, value)) {
+            confWarning(conf, length);
+        }
+        conf += length;
+        if (*conf == ',') {
+            conf++;
+        }
+    }
+}
+
+__attribute__((destructor)) static void dumpAtExit() {
+    if (recorder.active && srecord_stop() != 0) {
+        fileWarning("SMALLOC_TRACE");
+    }
+    sstats_publish(0);
+    if (profiler.exit_path != NULL) {
+        dumpToPath(profiler.exit_path, sprofile_dump, "SMALLOC_PROFILE");
+    }
+    if (profiler.lifetime_path != NULL) {
+        dumpToPath(profiler.lifetime_path, sprofile_lifetimes, "SMALLOC_LIFETIME");
+    }
+    if (retain_path != NULL) {
+        writeRetained();
+    }
+#ifdef SMALLOC_LATENCY
+    if (latency_exit_path != NULL) {
+        dumpToPath(latency_exit_path, slatency_dump, "SMALLOC_LATENCY");
+    }
+#endif
+#if defined(SMALLOC_COUNTING) || defined(SMALLOC_TRACING)
+    if (instrument_exit_path != NULL) {
+        dumpToPath(instrument_exit_path, sinstrument_dump, "SMALLOC_INSTRUMENT");
+    }
+#endif
+}
+
+size_t spurge() {
+    return blocks_list.purgeFreeBlocks(true);
+}
+
+int strim(size_t pad) {
+    size_t released = blocks_list.trimTop(blocks_list.getLastBlock(), pad);
+    released += blocks_list.purgeFreeBlocks(true);
+    return released > 0;
+}
+
+size_t _num_filler_regions() {
+    return huge_filler.num_of_regions;
+}
+
+size_t _num_filler_hugetlb_regions() {
+    return huge_filler.num_of_hugetlb_regions;
+}
+
+size_t _num_filler_used_pages() {
+    return huge_filler.used_pages;
+}
+
+size_t _num_filler_total_pages() {
+    return huge_filler.num_of_regions * (FILLER_PAGES - 1);
+}
+
+size_t _num_reserved_bytes() {
+    return blocks_list.bytes_of_reserved_space;
+}
 
 size_t _num_free_blocks() {
     return blocks_list.getNumOfFreeBlocks();
@@ -577,15 +4138,246 @@ size_t _num_free_bytes() {
 }
 
 size_t _num_allocated_blocks() {
-    return blocks_list.getNumOfTotalBlocks();
+    return blocks_list.getNumOfTotalBlocks() + huge_filler.num_of_blocks;
 }
 
 size_t _num_allocated_bytes() {
-    return blocks_list.getNumOfTotalBytes(); // maybe should be (Total - Free) ?
+    return blocks_list.getNumOfTotalBytes() + huge_filler.bytes_of_blocks; // maybe should be (Total - Free) ?
 }
 
 size_t _num_meta_data_bytes() {
-    return sizeof(MallocMetaData) * blocks_list.getNumOfTotalBlocks();
+    return sizeof(MallocMetaData) * _num_allocated_blocks();
+}
+
+size_t _num_purged_bytes() {
+    return blocks_list.purged_bytes;
+}
+
+size_t _num_dirty_bytes() {
+    return blocks_list.getNumOfDirtyBytes();
+}
+
+// smalloc_info result, keep in sync with my_stdlib.h
+struct smallinfo {
+    size_t heap_bytes;
+    size_t mmap_blocks;
+    size_t mmap_bytes;
+    size_t free_blocks;
+    size_t largest_free_block;
+    size_t sbrk_calls;
+    size_t mmap_calls;
+    size_t munmap_calls;
+    size_t madvise_calls;
+    size_t realloc_moved_bytes;
+    size_t splits;
+    size_t merges;
+    size_t realloc_cases[REALLOC_CASES];
+};
+
+// Everything here is a counter the engine keeps as it goes, nothing is walked.
+int smalloc_info(struct smallinfo* info) {
+    if (info == NULL) {
+        return -1;
+    }
+    info->heap_bytes = blocks_list.core_bytes;
+    info->mmap_blocks = blocks_list.num_of_map;
+    info->mmap_bytes = blocks_list.bytes_of_map;
+    info->free_blocks = blocks_list.num_of_free;
+    info->largest_free_block = blocks_list.largest_free ? blocks_list.largest_free->size : 0;
+    info->sbrk_calls = syscalls.sbrk;
+    info->mmap_calls = syscalls.mmap;
+    info->munmap_calls = syscalls.munmap;
+    info->madvise_calls = syscalls.madvise;
+    info->realloc_moved_bytes = blocks_list.moved_bytes;
+    info->splits = blocks_list.num_of_splits;
+    info->merges = blocks_list.num_of_merges;
+    for (int i = 0; i < REALLOC_CASES; i++) {
+        info->realloc_cases[i] = blocks_list.realloc_cases[i];
+    }
+    return 0;
+}
+
+// smalloc_frag result, keep in sync with my_stdlib.h
+struct smallfrag {
+    size_t free_blocks;
+    size_t free_bytes;
+    size_t largest_free_block;
+    double external_fragmentation;
+    size_t heap_bytes;
+    size_t live_bytes;
+    double heap_to_live;
+    size_t stranded_blocks;
+    size_t stranded_bytes;
+    size_t histogram_blocks[FRAG_BUCKETS];
+    size_t histogram_bytes[FRAG_BUCKETS];
+};
+
+// Fragmentation of the sbrk heap, from the counters the free list keeps: O(1) like
+// smalloc_info, cheap enough to poll.
+int smalloc_frag(struct smallfrag* frag) {
+    if (frag == NULL) {
+        return -1;
+    }
+    size_t largest = blocks_list.largest_free ? blocks_list.largest_free->size : 0;
+    size_t overhead = blocks_list.free_bytes + blocks_list.num_of_blocks * sizeof(MallocMetaData);
+    frag->free_blocks = blocks_list.num_of_free;
+    frag->free_bytes = blocks_list.free_bytes;
+    frag->largest_free_block = largest;
+    frag->external_fragmentation = frag->free_bytes ? 1.0 - (double) largest / frag->free_bytes : 0.0;
+    frag->heap_bytes = blocks_list.core_bytes;
+    frag->live_bytes = frag->heap_bytes > overhead ? frag->heap_bytes - overhead : 0;
+    frag->heap_to_live = frag->live_bytes ? (double) frag->heap_bytes / frag->live_bytes : 0.0;
+    frag->stranded_blocks = blocks_list.stranded_blocks;
+    frag->stranded_bytes = blocks_list.stranded_bytes;
+    for (int i = 0; i < FRAG_BUCKETS; i++) {
+        frag->histogram_blocks[i] = blocks_list.free_histogram[i];
+        frag->histogram_bytes[i] = blocks_list.free_histogram_bytes[i];
+    }
+    return 0;
+}
+
+// the stats page, keep in sync with my_stdlib.h
+#define SSTATS_MAGIC "smstats1"
+
+struct sstats_page {
+    char magic[8];
+    uint64_t seq;
+    uint64_t size;
+    int64_t pid;
+    uint64_t time_ns;
+    uint64_t calls;
+    size_t heap_blocks;
+    size_t filler_blocks;
+    size_t filler_bytes;
+    size_t filler_regions;
+    size_t reserved_blocks;
+    size_t reserved_bytes;
+    size_t purged_bytes;
+    struct smallinfo info;
+    struct smallfrag frag;
+    int64_t latency_built_in;
+    struct slatency latencies[SL_OPS][SL_PATHS];
+};
+
+void StatsPublisher::publish() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    long now_ms = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    if (now_ms - last_ms < STATS_INTERVAL_MS) {
+        return;
+    }
+    last_ms = now_ms;
+    uint64_t seq = page->seq;
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    page->time_ns = monotonicNs();
+    page->calls = calls;
+    page->heap_blocks = blocks_list.num_of_blocks;
+    page->filler_blocks = huge_filler.num_of_blocks;
+    page->filler_bytes = huge_filler.bytes_of_blocks;
+    page->filler_regions = huge_filler.num_of_regions;
+    page->reserved_blocks = blocks_list.num_of_reserved;
+    page->reserved_bytes = blocks_list.bytes_of_reserved;
+    page->purged_bytes = blocks_list.purged_bytes;
+    smalloc_info(&page->info);
+    smalloc_frag(&page->frag);
+#ifdef SMALLOC_LATENCY
+    page->latency_built_in = 1;
+    memcpy(page->latencies, latencies, sizeof(latencies));
+#endif
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// the child of a fork would write over its parent's page
+void StatsPublisher::forgetInChild() {
+    if (stats_publisher.page != NULL) {
+        munmap(stats_publisher.page, sizeof(struct sstats_page));
+        stats_publisher.page = NULL;
+    }
+}
+
+static void statsName(char* name, size_t length) {
+    snprintf(name, length, "/smalloc.%ld", (long) getpid());
+}
+
+// 0, or -1 when it already publishes or the page cannot be set up
+int StatsPublisher::start() {
+    static bool registered = false;
+    if (page != NULL) {
+        return -1;
+    }
+    char name[32];
+    statsName(name, sizeof(name));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, sizeof(struct sstats_page)) == 0) {
+        mapping = mmap(NULL, sizeof(struct sstats_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(name);
+        return -1;
+    }
+    if (!registered) {
+        pthread_atfork(NULL, NULL, forgetInChild);
+        registered = true;
+    }
+    page = (struct sstats_page*) mapping;
+    page->size = sizeof(struct sstats_page);
+    page->pid = getpid();
+    last_ms = LONG_MIN / 2;
+    publish();
+    memcpy(page->magic, SSTATS_MAGIC, sizeof(page->magic)); // last, readers check it first
+    return 0;
+}
+
+int StatsPublisher::stop() {
+    if (page == NULL) {
+        return -1;
+    }
+    char name[32];
+    statsName(name, sizeof(name));
+    shm_unlink(name);
+    munmap(page, sizeof(struct sstats_page));
+    page = NULL;
+    return 0;
+}
+
+int sstats_publish(int on) {
+    return on ? stats_publisher.start() : stats_publisher.stop();
+}
+
+size_t _num_pools() {
+    size_t count = 0;
+    spinLock(&pools_lock);
+    for (spool_t pool = pools; pool != NULL; pool = pool->next_pool) {
+        count++;
+    }
+    spinUnlock(&pools_lock);
+    return count;
+}
+
+size_t _num_pool_objects() {
+    size_t count = 0;
+    spinLock(&pools_lock);
+    for (spool_t pool = pools; pool != NULL; pool = pool->next_pool) {
+        count += spool_stats(pool).used_objects;
+    }
+    spinUnlock(&pools_lock);
+    return count;
+}
+
+size_t _num_pool_bytes() {
+    size_t bytes = 0;
+    spinLock(&pools_lock);
+    for (spool_t pool = pools; pool != NULL; pool = pool->next_pool) {
+        bytes += spool_stats(pool).slab_bytes;
+    }
+    spinUnlock(&pools_lock);
+    return bytes;
 }
 
 size_t _size_meta_data() {
@@ -0,0 +1,134 @@
+#include <new>
+#include "my_stdlib.h"
+#include "engine_lock.h"
+
+// All forms of the global operator new and delete on top of a malloc_N engine. Link it into
+// a program (the malloc_N_new targets) and every new expression allocates from the engine.
+// Like the preload library, every engine call takes engine_lock.
+
+static void* allocateLocked(size_t size, size_t alignment) {
+    EngineLock lock;
+    return alignment ? saligned_alloc(alignment, size) : smalloc(size);
+}
+
+static void* allocate(size_t size, size_t alignment) {
+    if (size == 0) {
+        size = 1; // new must return a unique pointer for zero bytes too
+    }
+    while (true) {
+        void* p = allocateLocked(size, alignment);
+        if (p != NULL) {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == NULL) {
+            throw std::bad_alloc();
+        }
+        handler(); // not under the lock, the handler may well delete something
+    }
+}
+
+static void* allocateNothrow(size_t size, size_t alignment) noexcept {
+    try {
+        return allocate(size, alignment);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+static void deallocate(void* p) noexcept {
+    if (p == NULL) {
+        return;
+    }
+    EngineLock lock;
+    sfree(p);
+}
+
+static void deallocateSized(void* p, size_t size) noexcept {
+    if (p == NULL) {
+        return;
+    }
+    EngineLock lock;
+    sfree_sized(p, size ? size : 1); // the size new got, not what the engine made of it
+}
+
+void* operator new(size_t size) {
+    return allocate(size, 0);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size, 0);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return allocateNothrow(size, 0);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return allocateNothrow(size, 0);
+}
+
+// the header sits right before the payload, so aligned blocks need no padding by hand
+void* operator new(size_t size, std::align_val_t alignment) {
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateNothrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateNothrow(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* p) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void* p) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void* p, size_t size) noexcept {
+    deallocateSized(p, size);
+}
+
+void operator delete[](void* p, size_t size) noexcept {
+    deallocateSized(p, size);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void* p, size_t size, std::align_val_t) noexcept {
+    deallocateSized(p, size);
+}
+
+void operator delete[](void* p, size_t size, std::align_val_t) noexcept {
+    deallocateSized(p, size);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    deallocate(p);
+}
@@ -0,0 +1,145 @@
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "my_stdlib.h"
+#include "engine_lock.h"
+
+// The standard allocation functions on top of a malloc_N engine, so the engine can be
+// LD_PRELOADed into unmodified binaries. The engines are single threaded, every call
+// takes engine_lock. The lock is statically initialized and the engine's globals are
+// constant-initialized, so calls coming in before any constructor ran are fine.
+
+// malloc must be suitably aligned for any type, CMake builds the engine with 16-byte blocks
+#if !defined(SMALLOC_ALIGNMENT) || SMALLOC_ALIGNMENT < 16
+#error "the preload library needs an engine built with SMALLOC_ALIGNMENT=16"
+#endif
+
+static bool multiplyOverflows(size_t num, size_t size) {
+    return size != 0 && num > SIZE_MAX / size;
+}
+
+static void* alignedAllocate(size_t alignment, size_t size) {
+    EngineLock lock;
+    void* p = saligned_alloc(alignment, size ? size : 1);
+    if (p == NULL) {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+extern "C" {
+
+void* malloc(size_t size) noexcept {
+    EngineLock lock;
+    void* p = smalloc(size ? size : 1); // malloc(0) must return a unique pointer
+    if (p == NULL) {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+void free(void* p) noexcept {
+    if (p == NULL) {
+        return;
+    }
+    EngineLock lock;
+    sfree(p);
+}
+
+// C23 sized deallocation
+void free_sized(void* p, size_t size) noexcept {
+    if (p == NULL) {
+        return;
+    }
+    EngineLock lock;
+    sfree_sized(p, size ? size : 1);
+}
+
+void free_aligned_sized(void* p, size_t alignment, size_t size) noexcept {
+    (void) alignment; // the header sits right before the payload whatever the alignment
+    free_sized(p, size);
+}
+
+void* calloc(size_t num, size_t size) noexcept {
+    if (multiplyOverflows(num, size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (num == 0 || size == 0) {
+        num = size = 1;
+    }
+    EngineLock lock;
+    void* p = scalloc(num, size);
+    if (p == NULL) {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+void* realloc(void* oldp, size_t size) noexcept {
+    if (oldp == NULL) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(oldp);
+        return NULL;
+    }
+    EngineLock lock;
+    void* p = srealloc(oldp, size);
+    if (p == NULL) {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+void* reallocarray(void* oldp, size_t num, size_t size) noexcept {
+    if (multiplyOverflows(num, size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(oldp, num * size);
+}
+
+size_t malloc_usable_size(void* p) noexcept {
+    EngineLock lock;
+    return smalloc_usable_size(p);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) noexcept {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    int saved_errno = errno;
+    void* p = alignedAllocate(alignment, size);
+    errno = saved_errno; // posix_memalign reports through its return value only
+    if (p == NULL) {
+        return ENOMEM;
+    }
+    *memptr = p;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return alignedAllocate(alignment, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+    // like glibc, round odd alignments up to the next power of two
+    size_t power = 1;
+    while (power < alignment) {
+        power <<= 1;
+    }
+    return alignedAllocate(power, size);
+}
+
+void* valloc(size_t size) noexcept {
+    return alignedAllocate(sysconf(_SC_PAGESIZE), size);
+}
+
+}
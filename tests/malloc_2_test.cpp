@@ -1,6 +1,7 @@
 #include "my_stdlib.h"
 #include <catch2/catch_test_macros.hpp>
 
+#include <sys/resource.h>
 #include <unistd.h>
 
 #define MAX_ALLOCATION_SIZE (1e8)
@@ -616,6 +617,41 @@ TEST_CASE("scalloc Max size both", "[malloc2]")
     verify_size(base);
 }
 
+TEST_CASE("scalloc fresh heap no clear", "[malloc2]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    const size_t size = 1024 * 1024;
+    const long pages = size / sysconf(_SC_PAGESIZE);
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    char *a = (char *)scalloc(size, 1);
+    getrusage(RUSAGE_SELF, &after);
+    REQUIRE(a != nullptr);
+    REQUIRE(after.ru_minflt - before.ru_minflt < pages / 4);
+    for (size_t i = 0; i < size; i++)
+    {
+        REQUIRE(a[i] == 0);
+    }
+    verify_blocks(1, size, 0, 0);
+    verify_size(base);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        a[i] = 1;
+    }
+    sfree(a);
+    char *b = (char *)scalloc(size, 1);
+    REQUIRE(b == a);
+    for (size_t i = 0; i < size; i++)
+    {
+        REQUIRE(b[i] == 0);
+    }
+    verify_blocks(1, size, 0, 0);
+    verify_size(base);
+}
+
 TEST_CASE("realloc", "[malloc2]")
 {
     verify_blocks(0, 0, 0, 0);
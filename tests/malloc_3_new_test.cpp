@@ -0,0 +1,256 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+// Linked with malloc_3_new, so every operator new and delete below (and the ones Catch2
+// uses) go through the engine. Each overload is also called by name, a new expression may
+// pick the sized or unsized delete as the compiler likes.
+
+#define TOO_LARGE ((size_t)1 << 60) // any size goes, but no mapping is that large
+
+static size_t used_blocks()
+{
+    return _num_allocated_blocks() - _num_free_blocks();
+}
+
+static bool is_aligned(void *p, size_t alignment)
+{
+    return ((uintptr_t)p % alignment) == 0;
+}
+
+struct Counted
+{
+    static int alive;
+    char data[40];
+    Counted() { alive++; }
+    ~Counted() { alive--; }
+};
+
+int Counted::alive = 0;
+
+struct alignas(64) Wide
+{
+    char data[100];
+};
+
+TEST_CASE("new delete", "[new]")
+{
+    size_t used = used_blocks();
+    int *p = new int(5);
+    size_t used_after_new = used_blocks();
+    delete p;
+    size_t used_after_delete = used_blocks();
+    REQUIRE(used_after_new == used + 1);
+    REQUIRE(used_after_delete == used);
+
+    void *q = operator new(100);
+    REQUIRE(smalloc_usable_size(q) >= 100);
+    operator delete(q);
+    REQUIRE(used_blocks() == used);
+
+    // new must not return the same pointer for zero bytes
+    void *a = operator new(0);
+    void *b = operator new(0);
+    REQUIRE(a != b);
+    operator delete(a, (size_t)0);
+    operator delete(b);
+    REQUIRE(used_blocks() == used);
+}
+
+TEST_CASE("new array delete array", "[new]")
+{
+    size_t used = used_blocks();
+    Counted *p = new Counted[10];
+    size_t used_after_new = used_blocks();
+    REQUIRE(Counted::alive == 10);
+    delete[] p;
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(used_after_new == used + 1);
+    REQUIRE(used_blocks() == used);
+
+    void *q = operator new[](1000);
+    memset(q, 'q', 1000);
+    operator delete[](q);
+    void *r = operator new[](1000);
+    operator delete[](r, 1000);
+    REQUIRE(used_blocks() == used);
+}
+
+TEST_CASE("new nothrow", "[new]")
+{
+    size_t used = used_blocks();
+    char *p = new (std::nothrow) char[100];
+    REQUIRE(p != nullptr);
+    delete[] p;
+    REQUIRE(new (std::nothrow) char[TOO_LARGE] == nullptr);
+
+    void *q = operator new(100, std::nothrow);
+    REQUIRE(q != nullptr);
+    operator delete(q, std::nothrow);
+    void *r = operator new[](100, std::nothrow);
+    REQUIRE(r != nullptr);
+    operator delete[](r, std::nothrow);
+    REQUIRE(operator new(TOO_LARGE, std::nothrow) == nullptr);
+    REQUIRE(used_blocks() == used);
+}
+
+TEST_CASE("new large", "[new]")
+{
+    // past the 1e8 the engine caps its own callers at
+    size_t size = 150 << 20;
+    char *p = new char[size];
+    p[0] = 'p';
+    p[size - 1] = 'p';
+    delete[] p;
+    void *q = operator new(size, std::align_val_t(4096));
+    REQUIRE(is_aligned(q, 4096));
+    operator delete(q, size, std::align_val_t(4096));
+}
+
+TEST_CASE("new throws bad_alloc", "[new]")
+{
+    REQUIRE_THROWS_AS(operator new(TOO_LARGE), std::bad_alloc);
+    REQUIRE_THROWS_AS(operator new[](TOO_LARGE), std::bad_alloc);
+    REQUIRE_THROWS_AS(operator new(TOO_LARGE, std::align_val_t(64)), std::bad_alloc);
+}
+
+static int handler_calls = 0;
+
+static void give_up_handler()
+{
+    handler_calls++;
+    std::set_new_handler(nullptr);
+}
+
+TEST_CASE("new handler", "[new]")
+{
+    std::set_new_handler(give_up_handler);
+    REQUIRE_THROWS_AS(operator new(TOO_LARGE), std::bad_alloc);
+    REQUIRE(handler_calls == 1);
+
+    std::set_new_handler(give_up_handler);
+    REQUIRE(operator new(TOO_LARGE, std::nothrow) == nullptr);
+    REQUIRE(handler_calls == 2);
+}
+
+TEST_CASE("new aligned", "[new]")
+{
+    size_t used = used_blocks();
+    Wide *w = new Wide;
+    REQUIRE(is_aligned(w, 64));
+    delete w;
+    Wide *ws = new Wide[5];
+    REQUIRE(is_aligned(ws, 64));
+    delete[] ws;
+    REQUIRE(used_blocks() == used);
+
+    const size_t alignments[] = {16, 64, 4096, 2 * 1024 * 1024};
+    for (size_t alignment : alignments)
+    {
+        void *a = operator new(300, std::align_val_t(alignment));
+        void *b = operator new[](300, std::align_val_t(alignment));
+        void *c = operator new(300, std::align_val_t(alignment), std::nothrow);
+        void *d = operator new[](300, std::align_val_t(alignment), std::nothrow);
+        REQUIRE(is_aligned(a, alignment));
+        REQUIRE(is_aligned(b, alignment));
+        REQUIRE(is_aligned(c, alignment));
+        REQUIRE(is_aligned(d, alignment));
+        operator delete(a, std::align_val_t(alignment));
+        operator delete[](b, 300, std::align_val_t(alignment));
+        operator delete(c, std::align_val_t(alignment), std::nothrow);
+        operator delete[](d, std::align_val_t(alignment), std::nothrow);
+
+        void *e = operator new[](300, std::align_val_t(alignment));
+        void *f = operator new(300, std::align_val_t(alignment));
+        operator delete[](e, std::align_val_t(alignment));
+        operator delete(f, 300, std::align_val_t(alignment));
+    }
+    REQUIRE(operator new(TOO_LARGE, std::align_val_t(64), std::nothrow) == nullptr);
+    REQUIRE(operator new[](TOO_LARGE, std::align_val_t(64), std::nothrow) == nullptr);
+    REQUIRE(used_blocks() == used);
+}
+
+TEST_CASE("new containers", "[new]")
+{
+    size_t used = used_blocks();
+    {
+        std::vector<std::string> strings;
+        for (int i = 0; i < 1000; i++)
+        {
+            strings.push_back(std::string(i % 100 + 20, (char)('a' + i % 26)));
+        }
+        for (int i = 0; i < 1000; i++)
+        {
+            REQUIRE(strings[i].size() == (size_t)(i % 100 + 20));
+        }
+    }
+    REQUIRE(used_blocks() == used);
+}
+
+static void *churn(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    std::vector<std::string> live;
+    for (int i = 0; i < 20000; i++)
+    {
+        live.push_back(std::string(rand_r(&seed) % 500 + 20, (char)('a' + i % 26)));
+        if (live.size() > 64)
+        {
+            size_t k = rand_r(&seed) % live.size();
+            if (live[k].front() != live[k].back())
+            {
+                return (void *)1;
+            }
+            live[k] = std::move(live.back());
+            live.pop_back();
+        }
+    }
+    return nullptr;
+}
+
+TEST_CASE("new threads", "[new]")
+{
+    size_t used = used_blocks();
+    pthread_t threads[8];
+    for (int i = 0; i < 8; i++)
+    {
+        REQUIRE(pthread_create(&threads[i], nullptr, churn, (void *)(uintptr_t)(i + 1)) == 0);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        void *result;
+        REQUIRE(pthread_join(threads[i], &result) == 0);
+        REQUIRE(result == nullptr);
+    }
+    REQUIRE(used_blocks() == used);
+}
+
+#ifdef SMALLOC_CHECK_SIZES
+TEST_CASE("sized delete checks the size", "[new]")
+{
+    // the sized forms go through sfree_sized, which aborts on a size that does not fit
+    void *p = operator new(200000);
+    pid_t child = fork();
+    REQUIRE(child != -1);
+    if (child == 0)
+    {
+        operator delete(p, 100);
+        _exit(0);
+    }
+    int status;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFSIGNALED(status));
+    REQUIRE(WTERMSIG(status) == SIGABRT);
+    operator delete(p, 200000);
+}
+#endif
@@ -0,0 +1,309 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Linked against libmalloc_3_preload, so the standard functions below (and everything the
+// C and C++ runtime allocate) go through the engine.
+
+// C23, not declared by every libc yet
+extern "C" void free_sized(void *p, size_t size);
+extern "C" void free_aligned_sized(void *p, size_t alignment, size_t size);
+
+static bool is_aligned(void *p, size_t alignment)
+{
+    return ((uintptr_t)p % alignment) == 0;
+}
+
+TEST_CASE("preload malloc free", "[preload]")
+{
+    size_t used = _num_allocated_blocks() - _num_free_blocks();
+    char *a = (char *)malloc(100);
+    size_t used_after_malloc = _num_allocated_blocks() - _num_free_blocks();
+    REQUIRE(a != nullptr);
+    REQUIRE(used_after_malloc == used + 1);
+    REQUIRE(malloc_usable_size(a) >= 100);
+    memset(a, 'a', 100);
+    free(a);
+    size_t used_after_free = _num_allocated_blocks() - _num_free_blocks();
+    REQUIRE(used_after_free == used);
+    free(nullptr);
+}
+
+TEST_CASE("preload malloc alignment", "[preload]")
+{
+    std::vector<void *> blocks;
+    for (size_t size = 1; size < 3000; size += 7)
+    {
+        void *m = malloc(size);
+        void *c = calloc(1, size);
+        void *r = realloc(malloc(8), size);
+        REQUIRE(is_aligned(m, 16));
+        REQUIRE(is_aligned(c, 16));
+        REQUIRE(is_aligned(r, 16));
+        blocks.push_back(m);
+        blocks.push_back(c);
+        blocks.push_back(r);
+    }
+    for (size_t i = 0; i < blocks.size(); i += 2)
+    {
+        free(blocks[i]);
+    }
+    for (size_t size = 1; size < 3000; size += 7)
+    {
+        void *r = realloc(blocks[1], size);
+        REQUIRE(is_aligned(r, 16));
+        blocks[1] = r;
+    }
+    for (size_t i = 1; i < blocks.size(); i += 2)
+    {
+        free(blocks[i]);
+    }
+}
+
+TEST_CASE("preload free_sized", "[preload]")
+{
+    size_t used = _num_allocated_blocks() - _num_free_blocks();
+    void *a = malloc(100);
+    void *b = aligned_alloc(64, 1000);
+    void *c = malloc(200000);
+    free_sized(a, 100);
+    free_aligned_sized(b, 64, 1000);
+    free_sized(c, 200000);
+    free_sized(nullptr, 10);
+    size_t used_after_free = _num_allocated_blocks() - _num_free_blocks();
+    REQUIRE(used_after_free == used);
+}
+
+TEST_CASE("preload malloc zero", "[preload]")
+{
+    void *a = malloc(0);
+    void *b = malloc(0);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(a != b);
+    free(a);
+    free(b);
+}
+
+TEST_CASE("preload malloc large", "[preload]")
+{
+    // past the 1e8 the engine caps its own callers at
+    size_t size = 150 << 20;
+    char *a = (char *)malloc(size);
+    REQUIRE(a != nullptr);
+    REQUIRE(is_aligned(a, 16));
+    memset(a, 'a', size);
+    a = (char *)realloc(a, size + (50 << 20));
+    REQUIRE(a != nullptr);
+    REQUIRE(a[size - 1] == 'a');
+    free(a);
+
+    char *c = (char *)calloc(size, 1);
+    REQUIRE(c != nullptr);
+    REQUIRE(c[0] == 0);
+    REQUIRE(c[size - 1] == 0);
+    free(c);
+
+    char *r = (char *)reallocarray(nullptr, 150, 1 << 20);
+    REQUIRE(r != nullptr);
+    r[size - 1] = 'r';
+    free(r);
+}
+
+TEST_CASE("preload malloc too large", "[preload]")
+{
+    volatile size_t huge = (size_t)PTRDIFF_MAX + 1;
+    errno = 0;
+    REQUIRE(malloc(huge) == nullptr);
+    REQUIRE(errno == ENOMEM);
+    huge = (size_t)1 << 60; // under the cap, but no mapping is that large
+    errno = 0;
+    REQUIRE(malloc(huge) == nullptr);
+    REQUIRE(errno == ENOMEM);
+}
+
+TEST_CASE("preload calloc", "[preload]")
+{
+    char *a = (char *)calloc(10, 100);
+    REQUIRE(a != nullptr);
+    for (int i = 0; i < 1000; i++)
+    {
+        REQUIRE(a[i] == 0);
+    }
+    free(a);
+
+    volatile size_t huge = SIZE_MAX / 2; // volatile, so the compiler does not flag the overflow
+    errno = 0;
+    REQUIRE(calloc(huge, 3) == nullptr);
+    REQUIRE(errno == ENOMEM);
+
+    void *b = calloc(0, 10);
+    REQUIRE(b != nullptr);
+    free(b);
+}
+
+TEST_CASE("preload realloc", "[preload]")
+{
+    char *a = (char *)realloc(nullptr, 100);
+    REQUIRE(a != nullptr);
+    memset(a, 'a', 100);
+    char *b = (char *)realloc(a, 200000);
+    REQUIRE(b != nullptr);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(b[i] == 'a');
+    }
+    char *c = (char *)realloc(b, 50);
+    REQUIRE(c != nullptr);
+    for (int i = 0; i < 50; i++)
+    {
+        REQUIRE(c[i] == 'a');
+    }
+    REQUIRE(realloc(c, 0) == nullptr);
+}
+
+TEST_CASE("preload reallocarray", "[preload]")
+{
+    int *a = (int *)reallocarray(nullptr, 10, sizeof(int));
+    REQUIRE(a != nullptr);
+    for (int i = 0; i < 10; i++)
+    {
+        a[i] = i;
+    }
+    volatile size_t huge = SIZE_MAX / 2;
+    errno = 0;
+    REQUIRE(reallocarray(a, huge, sizeof(int)) == nullptr);
+    REQUIRE(errno == ENOMEM);
+    int *b = (int *)reallocarray(a, 1000, sizeof(int));
+    REQUIRE(b != nullptr);
+    for (int i = 0; i < 10; i++)
+    {
+        REQUIRE(b[i] == i);
+    }
+    free(b);
+}
+
+TEST_CASE("preload posix_memalign", "[preload]")
+{
+    size_t alignments[] = {sizeof(void *), 16, 64, 4096, 2 * 1024 * 1024};
+    for (size_t alignment : alignments)
+    {
+        void *p = nullptr;
+        REQUIRE(posix_memalign(&p, alignment, 1000) == 0);
+        REQUIRE(p != nullptr);
+        REQUIRE(is_aligned(p, alignment));
+        memset(p, 'p', 1000);
+        free(p);
+    }
+
+    void *q = nullptr;
+    errno = 0;
+    REQUIRE(posix_memalign(&q, 24, 100) == EINVAL);
+    REQUIRE(posix_memalign(&q, 4, 100) == EINVAL);
+    volatile size_t huge = (size_t)PTRDIFF_MAX + 1;
+    REQUIRE(posix_memalign(&q, 64, huge) == ENOMEM);
+    REQUIRE(q == nullptr);
+    REQUIRE(errno == 0);
+}
+
+TEST_CASE("preload aligned_alloc memalign valloc", "[preload]")
+{
+    void *a = aligned_alloc(256, 512);
+    REQUIRE(a != nullptr);
+    REQUIRE(is_aligned(a, 256));
+    free(a);
+
+    errno = 0;
+    REQUIRE(aligned_alloc(48, 96) == nullptr);
+    REQUIRE(errno == EINVAL);
+
+    void *m = memalign(100, 10); // rounded up to 128
+    REQUIRE(m != nullptr);
+    REQUIRE(is_aligned(m, 128));
+    free(m);
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    void *v = valloc(10);
+    REQUIRE(v != nullptr);
+    REQUIRE(is_aligned(v, page));
+    REQUIRE(malloc_usable_size(v) >= 10);
+    free(v);
+}
+
+TEST_CASE("preload containers", "[preload]")
+{
+    std::map<int, std::string> m;
+    std::vector<std::string> v;
+    for (int i = 0; i < 10000; i++)
+    {
+        m[i] = std::string(i % 300, (char)('a' + i % 26));
+        v.push_back(m[i]);
+    }
+    for (int i = 0; i < 10000; i++)
+    {
+        REQUIRE(m[i] == v[i]);
+    }
+    m.clear();
+    v.clear();
+    v.shrink_to_fit();
+}
+
+static void *churn(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    std::vector<std::pair<char *, size_t>> live;
+    for (int i = 0; i < 5000; i++)
+    {
+        size_t size = rand_r(&seed) % 2000 + 1;
+        char *p = (char *)malloc(size);
+        if (p == nullptr)
+        {
+            return (void *)1;
+        }
+        memset(p, (char)size, size);
+        live.push_back({p, size});
+        if (live.size() > 64)
+        {
+            size_t k = rand_r(&seed) % live.size();
+            if (live[k].first[0] != (char)live[k].second || live[k].first[live[k].second - 1] != (char)live[k].second)
+            {
+                return (void *)2;
+            }
+            free(live[k].first);
+            live[k] = live.back();
+            live.pop_back();
+        }
+    }
+    for (auto &block : live)
+    {
+        free(block.first);
+    }
+    return nullptr;
+}
+
+TEST_CASE("preload threads", "[preload]")
+{
+    pthread_t threads[8];
+    for (int i = 0; i < 8; i++)
+    {
+        REQUIRE(pthread_create(&threads[i], nullptr, churn, (void *)(uintptr_t)(i + 1)) == 0);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        void *result;
+        REQUIRE(pthread_join(threads[i], &result) == 0);
+        REQUIRE(result == nullptr);
+    }
+}
@@ -0,0 +1,165 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define MIN_SPLIT_SIZE (128)
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+#define verify_size(base)                                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(_num_allocated_bytes() + aligned_size(_size_meta_data() * _num_allocated_blocks()) ==                  \
+                (size_t)after - (size_t)base);                                                                         \
+    } while (0)
+
+#define verify_size_with_large_blocks(base, diff)                                                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(diff == (size_t)after - (size_t)base);                                                                 \
+    } while (0)
+
+// Start the heap at a known alignment so block placement is predictable.
+static void *align_break(size_t alignment)
+{
+    size_t left = (size_t)sbrk(0) % alignment;
+    if (left != 0)
+    {
+        sbrk(alignment - left);
+    }
+    return sbrk(0);
+}
+
+static bool is_aligned(void *p, size_t alignment)
+{
+    return ((size_t)p % alignment) == 0;
+}
+
+TEST_CASE("saligned_alloc pad block", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    char *base = (char *)align_break(256);
+
+    // the payload would be 16 bytes short of 64, too little for a block, so the pad grows to one
+    char *p = (char *)saligned_alloc(64, 100);
+    REQUIRE(p == base + 256);
+    REQUIRE(is_aligned(p, 64));
+    verify_blocks(2, 160 + 160, 1, 160);
+    verify_size(base);
+
+    // the pad is a real free block
+    char *q = (char *)smalloc(100);
+    REQUIRE(q == base + _size_meta_data());
+    verify_blocks(2, 160 + 160, 0, 0);
+
+    sfree(p);
+    sfree(q);
+    verify_blocks(1, 160 + 160 + _size_meta_data(), 1, 160 + 160 + _size_meta_data());
+    verify_size(base);
+}
+
+TEST_CASE("saligned_alloc small pad", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    char *base = (char *)align_break(256);
+
+    char *a = (char *)smalloc(8);
+    REQUIRE(a == base + _size_meta_data());
+    // 8 bytes short of 16 is too little for a block, the payload moves on until the pad is
+    // one, and the used block before it keeps its size
+    char *b = (char *)saligned_alloc(16, 32);
+    REQUIRE(b == base + 288);
+    REQUIRE(smalloc_usable_size(a) == 8);
+    verify_blocks(3, 8 + 136 + 136, 1, 136);
+    verify_size(base);
+
+    memset(b, 'b', 32);
+    sfree(b);
+    verify_blocks(2, 8 + 320, 1, 320);
+    sfree(a);
+    verify_size(base);
+}
+
+TEST_CASE("saligned_alloc reuses free block", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    align_break(256);
+
+    char *a = (char *)smalloc(1000);
+    char *guard = (char *)smalloc(16);
+    sfree(a);
+    void *base = sbrk(0);
+
+    char *p = (char *)saligned_alloc(32, 200);
+    REQUIRE(p == a + 176);
+    REQUIRE(is_aligned(p, 32));
+    verify_blocks(4, 128 + 200 + 576 + 16, 2, 128 + 576);
+    verify_size_with_large_blocks(base, 0);
+
+    sfree(p);
+    verify_blocks(2, 1000 + 16, 1, 1000);
+    sfree(guard);
+}
+
+TEST_CASE("saligned_alloc large", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+
+    char *a = (char *)saligned_alloc(4096, 200000);
+    REQUIRE(a != nullptr);
+    REQUIRE(is_aligned(a, 4096));
+    memset(a, 'a', 200000);
+    verify_blocks(1, 200000, 0, 0);
+    verify_size_with_large_blocks(base, 0);
+    sfree(a);
+    verify_blocks(0, 0, 0, 0);
+
+    // a huge alignment is served from a mapping even for a small block
+    const size_t huge_alignment = 2 * 1024 * 1024;
+    char *b = (char *)saligned_alloc(huge_alignment, 100);
+    REQUIRE(b != nullptr);
+    REQUIRE(is_aligned(b, huge_alignment));
+    verify_blocks(1, 100, 0, 0);
+    verify_size_with_large_blocks(base, 0);
+    sfree(b);
+    verify_blocks(0, 0, 0, 0);
+}
+
+TEST_CASE("saligned_alloc invalid", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    REQUIRE(saligned_alloc(0, 10) == nullptr);
+    REQUIRE(saligned_alloc(24, 10) == nullptr);
+    REQUIRE(saligned_alloc(16, 0) == nullptr);
+    REQUIRE(saligned_alloc(16, MAX_ALLOCATION_SIZE + 1) == nullptr);
+    verify_blocks(0, 0, 0, 0);
+
+    // small alignments are what smalloc gives anyway
+    char *a = (char *)saligned_alloc(4, 10);
+    REQUIRE(a != nullptr);
+    REQUIRE(is_aligned(a, 8));
+    verify_blocks(1, 10, 0, 0);
+    sfree(a);
+}
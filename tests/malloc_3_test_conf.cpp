@@ -0,0 +1,149 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define MIN_SPLIT_SIZE (128)
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+static long ctl(const char *name)
+{
+    long value = -12345;
+    REQUIRE(smallctl(name, &value, nullptr) == 0);
+    return value;
+}
+
+TEST_CASE("smallctl defaults", "[malloc3]")
+{
+    REQUIRE(ctl("map_size") == MMAP_THRESHOLD);
+    REQUIRE(ctl("min_split_size") == MIN_SPLIT_SIZE);
+    REQUIRE(ctl("max_size") == MAX_ALLOCATION_SIZE);
+    REQUIRE(ctl("trim_threshold") == -1);
+    REQUIRE(ctl("hugepage_filler") == 0);
+    REQUIRE(ctl("top_pad") == 0);
+
+    long value = 0;
+    REQUIRE(smallctl("no_such_thing", &value, nullptr) == ENOENT);
+    REQUIRE(smallctl("map_size_", &value, nullptr) == ENOENT);
+    REQUIRE(smallctl(nullptr, &value, nullptr) == ENOENT);
+    REQUIRE(smallctl("map_size", nullptr, nullptr) == 0);
+}
+
+TEST_CASE("smallctl map_size", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    long size = 64 * 1024;
+    long old = 0;
+    REQUIRE(smallctl("map_size", &old, &size) == 0);
+    REQUIRE(old == MMAP_THRESHOLD);
+    REQUIRE(ctl("map_size") == size);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(100 * 1024); // mapped now
+    REQUIRE(sbrk(0) == base);
+    verify_blocks(1, 100 * 1024, 0, 0);
+
+    // blocks mapped before a change are still unmapped by sfree
+    size = 1024 * 1024;
+    REQUIRE(smallctl("map_size", nullptr, &size) == 0);
+    char *b = (char *)smalloc(200 * 1024); // from the heap now
+    REQUIRE(sbrk(0) != base);
+    sfree(a);
+    sfree(b);
+    verify_blocks(1, 200 * 1024, 1, 200 * 1024);
+
+    long bad = 100;
+    REQUIRE(smallctl("map_size", &old, &bad) == EINVAL);
+    REQUIRE(ctl("map_size") == size);
+    REQUIRE(smallopt(SM_MAP_SIZE, MMAP_THRESHOLD) == 1);
+}
+
+TEST_CASE("smallctl min_split_size", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    long split = 32;
+    REQUIRE(smallctl("min_split_size", nullptr, &split) == 0);
+    char *a = (char *)smalloc(200);
+    sfree(a);
+    // 200 - 100 - header leaves 48 bytes, enough for a block now
+    char *b = (char *)smalloc(100);
+    REQUIRE(b == a);
+    verify_blocks(2, 104 + 200 - 104 - _size_meta_data(), 1, 200 - 104 - _size_meta_data());
+    sfree(b);
+
+    split = 30; // rounded up to 32
+    REQUIRE(smallctl("min_split_size", nullptr, &split) == 0);
+    REQUIRE(ctl("min_split_size") == 32);
+    split = 0;
+    REQUIRE(smallctl("min_split_size", nullptr, &split) == EINVAL);
+}
+
+TEST_CASE("smallctl max_size", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    long max = 1000;
+    REQUIRE(smallctl("max_size", nullptr, &max) == 0);
+    REQUIRE(smalloc(1001) == nullptr);
+    REQUIRE(scalloc(1001, 1) == nullptr);
+    char *a = (char *)smalloc(1000);
+    REQUIRE(a != nullptr);
+    REQUIRE(srealloc(a, 1001) == nullptr);
+    sfree(a);
+
+    max = 0;
+    REQUIRE(smallctl("max_size", nullptr, &max) == EINVAL);
+    REQUIRE(ctl("max_size") == 1000);
+}
+
+TEST_CASE("smallctl sizes above 1GiB", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    long max = 4L << 30;
+    REQUIRE(smallctl("max_size", nullptr, &max) == 0);
+    REQUIRE(ctl("max_size") == 4L << 30);
+    REQUIRE(smallopt(SM_MAP_SIZE, 2L << 30) == 1);
+    REQUIRE(ctl("map_size") == 2L << 30);
+    REQUIRE(smallopt(SM_MAP_SIZE, MMAP_THRESHOLD) == 1);
+
+    // past 2GiB, the block size no longer fits an int
+    size_t size = (5UL << 29) + 1;
+    char *a = (char *)smalloc(size);
+    REQUIRE(a != nullptr);
+    verify_blocks(1, size, 0, 0);
+    a[0] = 1;
+    a[size - 1] = 1;
+    sfree(a);
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(smalloc((4UL << 30) + 1) == nullptr);
+}
+
+// Run with the environment set, see tests/CMakeLists.txt, hidden otherwise.
+TEST_CASE("SMALLOC_CONF", "[.][smalloc_conf]")
+{
+    REQUIRE(getenv("SMALLOC_CONF") != nullptr);
+    REQUIRE(ctl("map_size") == 65536);
+    REQUIRE(ctl("min_split_size") == 64);
+    REQUIRE(ctl("max_size") == 0x100000);
+    REQUIRE(ctl("decay_ms") == -1);
+    REQUIRE(ctl("hugepage_filler") == 0); // its entry is malformed
+    REQUIRE(smalloc(0x100001) == nullptr);
+}
@@ -0,0 +1,172 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#define MMAP_THRESHOLD (128 * 1024)
+
+struct heap_dump
+{
+    sheap_dump_header header;
+    std::vector<sheap_dump_record> records;
+};
+
+static heap_dump dump(sheap_t heap)
+{
+    char path[] = "/tmp/sheap_dump_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    unlink(path);
+
+    // the dump itself must not allocate
+    size_t blocks = _num_allocated_blocks();
+    void *brk = sbrk(0);
+    REQUIRE(sheap_dump(heap, fd) == 0);
+    REQUIRE(_num_allocated_blocks() == blocks);
+    REQUIRE(sbrk(0) == brk);
+
+    heap_dump result;
+    REQUIRE(lseek(fd, 0, SEEK_SET) == 0);
+    REQUIRE(read(fd, &result.header, sizeof(result.header)) == sizeof(result.header));
+    REQUIRE(memcmp(result.header.magic, SHEAP_DUMP_MAGIC, 8) == 0);
+    REQUIRE(result.header.record_size == sizeof(sheap_dump_record));
+    REQUIRE(result.header.header_size == _size_meta_data());
+    REQUIRE(result.header.page_size == (uint32_t)sysconf(_SC_PAGESIZE));
+    sheap_dump_record record;
+    while (read(fd, &record, sizeof(record)) == sizeof(record))
+    {
+        result.records.push_back(record);
+    }
+    close(fd);
+    return result;
+}
+
+static uint64_t header_of(void *p)
+{
+    return (uint64_t)p - _size_meta_data();
+}
+
+TEST_CASE("sheap_dump", "[malloc3]")
+{
+    heap_dump empty = dump(nullptr);
+    REQUIRE(empty.header.heap_start == 0);
+    REQUIRE(empty.header.heap_end == 0);
+    REQUIRE(empty.records.empty());
+    REQUIRE(sheap_dump(nullptr, -1) == -1);
+
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(1000);
+    char *c = (char *)smalloc(100);
+    char *d = (char *)smalloc(MMAP_THRESHOLD);
+    char *r = (char *)sreserve(1 << 20);
+    REQUIRE(r != nullptr);
+    sfree(b);
+
+    heap_dump now = dump(nullptr);
+    REQUIRE(now.header.heap_start == header_of(a));
+    REQUIRE(now.header.heap_end == (uint64_t)c + 104);
+    REQUIRE(now.records.size() == 5);
+    REQUIRE(now.records[0].address == header_of(a));
+    REQUIRE(now.records[0].size == 104);
+    REQUIRE(now.records[0].kind == SHEAP_DUMP_HEAP);
+    REQUIRE(now.records[0].is_free == 0);
+    REQUIRE(now.records[1].address == header_of(b));
+    REQUIRE(now.records[1].size == 1000);
+    REQUIRE(now.records[1].is_free == 1);
+    REQUIRE(now.records[2].address == header_of(c));
+    REQUIRE(now.records[2].is_free == 0);
+    // then the blocks mapped on their own, newest first
+    REQUIRE(now.records[3].address == header_of(r));
+    REQUIRE(now.records[3].kind == SHEAP_DUMP_RESERVE);
+    REQUIRE(now.records[4].address == header_of(d));
+    REQUIRE(now.records[4].kind == SHEAP_DUMP_MMAP);
+    REQUIRE(now.records[4].size == MMAP_THRESHOLD);
+    for (const sheap_dump_record &block : now.records)
+    {
+        REQUIRE(block.site == 0);
+    }
+
+    sfree(d);
+    sfree(r);
+    now = dump(nullptr);
+    REQUIRE(now.records.size() == 3);
+    sfree(a);
+    sfree(c);
+}
+
+TEST_CASE("sheap_dump filler and sites", "[malloc3]")
+{
+    REQUIRE(smallopt(SM_HUGEPAGE_FILLER, 1) == 1);
+    REQUIRE(sprofile(1) == 0);
+    char *a = (char *)smalloc(8000);
+    char *b = (char *)smalloc(100);
+    REQUIRE(sprofile(0) == 0);
+    char *c = (char *)smalloc(100);
+
+    heap_dump now = dump(nullptr);
+    REQUIRE(now.records.size() == 3);
+    REQUIRE(now.records[0].address == header_of(b));
+    REQUIRE(now.records[0].site != 0);
+    REQUIRE(now.records[1].address == header_of(c));
+    REQUIRE(now.records[1].site == 0);
+    REQUIRE(now.records[2].address == header_of(a));
+    REQUIRE(now.records[2].kind == SHEAP_DUMP_FILLER);
+    REQUIRE(now.records[2].site != 0);
+    REQUIRE(now.records[2].site != now.records[0].site);
+    sfree(a);
+    sfree(b);
+    sfree(c);
+}
+
+TEST_CASE("sheap_dump heap handle", "[malloc3]")
+{
+    char *outside = (char *)smalloc(100);
+    sheap_t heap = sheap_create();
+    REQUIRE(heap != nullptr);
+    char *a = (char *)sheap_alloc(heap, 100);
+    char *b = (char *)sheap_alloc(heap, 200);
+    char *d = (char *)sheap_alloc(heap, MMAP_THRESHOLD);
+    REQUIRE(d != nullptr);
+    sheap_free(heap, a);
+
+    heap_dump now = dump(heap);
+    REQUIRE(now.header.heap_start == header_of(a));
+    REQUIRE(now.header.heap_end == (uint64_t)d + MMAP_THRESHOLD);
+    REQUIRE(now.records.size() == 3);
+    REQUIRE(now.records[0].is_free == 1);
+    REQUIRE(now.records[1].address == header_of(b));
+    REQUIRE(now.records[2].address == header_of(d));
+    for (const sheap_dump_record &block : now.records)
+    {
+        REQUIRE(block.address != header_of(outside));
+        REQUIRE(block.kind == SHEAP_DUMP_HEAP);
+    }
+    sheap_destroy(heap);
+    sfree(outside);
+}
+
+// leaves a dump for the heap_dump_view test, see CMakeLists.txt
+TEST_CASE("sheap_dump to file", "[.][sheap_dump_file]")
+{
+    const char *path = getenv("SHEAP_DUMP");
+    REQUIRE(path != nullptr);
+    std::vector<void *> blocks;
+    for (int i = 0; i < 200; i++)
+    {
+        blocks.push_back(smalloc(16 + (i * 37) % 3000));
+    }
+    for (int i = 0; i < 200; i += 3)
+    {
+        sfree(blocks[i]);
+    }
+    blocks.push_back(smalloc(MMAP_THRESHOLD));
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    REQUIRE(fd >= 0);
+    REQUIRE(sheap_dump(nullptr, fd) == 0);
+    close(fd);
+}
@@ -0,0 +1,180 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define MIN_SPLIT_SIZE (128)
+#define FILLER_PAGE_SIZE (4096)
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+#define verify_size(base)                                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(_num_allocated_bytes() + aligned_size(_size_meta_data() * _num_allocated_blocks()) ==                  \
+                (size_t)after - (size_t)base);                                                                         \
+    } while (0)
+
+TEST_CASE("sexpand into next block", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(1000);
+    char *c = (char *)smalloc(100);
+    memset(a, 'a', 100);
+    sfree(b);
+    verify_blocks(3, 104 + 1000 + 104, 1, 1000);
+
+    // preferred fits, the rest of b is split off
+    REQUIRE(sexpand(a, 200, 600) == 600);
+    verify_blocks(3, 600 + 104 + 1000 - 600 + 104, 1, 104 + 1000 - 600);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(a[i] == 'a');
+    }
+    REQUIRE(smalloc_usable_size(a) == 600);
+
+    // preferred does not fit, a takes all there is
+    REQUIRE(sexpand(a, 1000, 5000) == 104 + 1000 + _size_meta_data());
+    verify_blocks(2, 104 + 1000 + _size_meta_data() + 104, 0, 0);
+
+    // not even min fits, nothing changes
+    REQUIRE(sexpand(a, 5000, 5000) == 0);
+    verify_blocks(2, 104 + 1000 + _size_meta_data() + 104, 0, 0);
+    verify_size(base);
+    sfree(a);
+    sfree(c);
+}
+
+TEST_CASE("sexpand never uses the block before", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    char *a = (char *)smalloc(1000);
+    char *b = (char *)smalloc(100);
+    char *c = (char *)smalloc(100);
+    sfree(a);
+    memset(b, 'b', 100);
+
+    // srealloc would move b down into a, sexpand must not
+    REQUIRE(sexpand(b, 500, 500) == 0);
+    verify_blocks(3, 1000 + 104 + 104, 1, 1000);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(b[i] == 'b');
+    }
+    sfree(b);
+    sfree(c);
+}
+
+TEST_CASE("sexpand wilderness", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(100);
+    memset(b, 'b', 100);
+    REQUIRE(sexpand(b, 1000, 10000) == 10000);
+    verify_blocks(2, 104 + 10000, 0, 0);
+    verify_size(base);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(b[i] == 'b');
+    }
+
+    // a free last block grows with the break too
+    char *c = (char *)smalloc(500);
+    sfree(c);
+    REQUIRE(sexpand(b, 20000, 20000) == 20000);
+    verify_blocks(2, 104 + 20000, 0, 0);
+    verify_size(base);
+    sfree(a);
+    sfree(b);
+}
+
+TEST_CASE("sexpand shrink", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    char *a = (char *)smalloc(1000);
+    char *b = (char *)smalloc(100);
+    REQUIRE(sexpand(a, 10, 10) == 16);
+    verify_blocks(3, 16 + 1000 - 16 - _size_meta_data() + 104, 1, 1000 - 16 - _size_meta_data());
+
+    // too little left to split off, the block keeps its size
+    REQUIRE(sexpand(b, 50, 50) == 104);
+    verify_blocks(3, 16 + 1000 - 16 - _size_meta_data() + 104, 1, 1000 - 16 - _size_meta_data());
+    sfree(a);
+    sfree(b);
+}
+
+TEST_CASE("sexpand mapped and reserved", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    char *a = (char *)smalloc(MMAP_THRESHOLD + 100);
+    memset(a, 'a', MMAP_THRESHOLD + 100);
+    // shrinking unmaps the pages past the end, a stays where it is
+    REQUIRE(sexpand(a, MMAP_THRESHOLD, MMAP_THRESHOLD) == MMAP_THRESHOLD);
+    verify_blocks(1, MMAP_THRESHOLD, 0, 0);
+    // growing past the last page only works if the pages after the mapping are free, min
+    // is still in it
+    size_t size = sexpand(a, MMAP_THRESHOLD + 1, 4 * MMAP_THRESHOLD);
+    REQUIRE((size == 4 * MMAP_THRESHOLD || size == aligned_size(MMAP_THRESHOLD + 1)));
+    REQUIRE(a[MMAP_THRESHOLD - 1] == 'a');
+    memset(a, 'b', size);
+    verify_blocks(1, size, 0, 0);
+    sfree(a);
+
+    char *r = (char *)sreserve(1024 * 1024);
+    REQUIRE(sexpand(r, 1000, 500000) == 500000);
+    memset(r, 'r', 500000);
+    REQUIRE(sexpand(r, 600000, 2 * 1024 * 1024) == 600000); // min still fits the reservation
+    REQUIRE(sexpand(r, 2 * 1024 * 1024, 2 * 1024 * 1024) == 0);
+    REQUIRE(smalloc_usable_size(r) == 600000);
+    sfree(r);
+    verify_blocks(0, 0, 0, 0);
+}
+
+TEST_CASE("sexpand filler", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(smallopt(SM_HUGEPAGE_FILLER, 1) == 1);
+    char *a = (char *)smalloc(5000);
+    REQUIRE(_num_filler_used_pages() == 2);
+    size_t capacity = 2 * FILLER_PAGE_SIZE - _size_meta_data();
+    // the block can grow into the rest of its pages, but not past them
+    REQUIRE(sexpand(a, 6000, 8000) == 8000);
+    REQUIRE(sexpand(a, 6000, 9000) == capacity);
+    REQUIRE(sexpand(a, 9000, 9000) == 0);
+    REQUIRE(sexpand(a, 1000, 1000) == capacity);
+    REQUIRE(_num_filler_used_pages() == 2);
+    memset(a, 'a', capacity);
+    sfree(a);
+    REQUIRE(_num_filler_used_pages() == 0);
+}
+
+TEST_CASE("sexpand invalid", "[malloc3]")
+{
+    char *a = (char *)smalloc(100);
+    REQUIRE(sexpand(nullptr, 10, 10) == 0);
+    REQUIRE(sexpand(a, 0, 10) == 0);
+    REQUIRE(sexpand(a, 10, MAX_ALLOCATION_SIZE + 1) == 0);
+    REQUIRE(sexpand(a, 200, 100) == 200); // preferred below min counts as min
+    sfree(a);
+}
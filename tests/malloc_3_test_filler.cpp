@@ -0,0 +1,195 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define MIN_SPLIT_SIZE (128)
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+#define verify_size(base)                                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(_num_allocated_bytes() + aligned_size(_size_meta_data() * _num_allocated_blocks()) ==                  \
+                (size_t)after - (size_t)base);                                                                         \
+    } while (0)
+
+
+#define verify_size_with_large_blocks(base, diff)                                                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(diff == (size_t)after - (size_t)base);                                                                 \
+    } while (0)
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define FILLER_PAGE_SIZE (4096)
+
+static inline size_t region_of(void *p)
+{
+    return (size_t)p & ~((size_t)HUGE_PAGE_SIZE - 1);
+}
+
+static inline size_t filler_pages(size_t size)
+{
+    return (aligned_size(size) + _size_meta_data() + FILLER_PAGE_SIZE - 1) / FILLER_PAGE_SIZE;
+}
+
+TEST_CASE("filler disabled", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(8000);
+    REQUIRE(a != nullptr);
+    REQUIRE(_num_filler_regions() == 0);
+    verify_blocks(1, 8000, 0, 0);
+    verify_size(base);
+    sfree(a);
+}
+
+TEST_CASE("filler packs medium blocks", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(smallopt(SM_HUGEPAGE_FILLER, 1) == 1);
+    void *base = sbrk(0);
+
+    char *a = (char *)smalloc(8000);
+    char *b = (char *)smalloc(20000);
+    char *c = (char *)smalloc(4000);
+    char *d = (char *)smalloc(MMAP_THRESHOLD);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(c != nullptr);
+    REQUIRE(d != nullptr);
+    REQUIRE(region_of(a) == region_of(b));
+    REQUIRE(region_of(c) != region_of(a));
+    REQUIRE(_num_filler_regions() == 1);
+    REQUIRE(_num_filler_used_pages() == filler_pages(8000) + filler_pages(20000));
+    REQUIRE(_num_filler_total_pages() == HUGE_PAGE_SIZE / FILLER_PAGE_SIZE - 1);
+    REQUIRE(_num_filler_hugetlb_regions() <= _num_filler_regions());
+    verify_blocks(4, 8000 + 20000 + 4000 + MMAP_THRESHOLD, 0, 0);
+    verify_size_with_large_blocks(base, aligned_size(4000) + _size_meta_data());
+
+    memset(a, 'a', 8000);
+    memset(b, 'b', 20000);
+    sfree(a);
+    REQUIRE(_num_filler_used_pages() == filler_pages(20000));
+    sfree(b);
+    REQUIRE(_num_filler_regions() == 0);
+    REQUIRE(_num_filler_used_pages() == 0);
+    sfree(c);
+    sfree(d);
+    verify_blocks(1, 4000, 1, 4000);
+}
+
+TEST_CASE("filler prefers fullest region", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(smallopt(SM_HUGEPAGE_FILLER, 1) == 1);
+    const size_t size = 100000;
+    const size_t per_region = (HUGE_PAGE_SIZE / FILLER_PAGE_SIZE - 1) / filler_pages(size);
+
+    char *blocks[64];
+    for (size_t i = 0; i <= per_region; i++)
+    {
+        blocks[i] = (char *)smalloc(size);
+        REQUIRE(blocks[i] != nullptr);
+    }
+    REQUIRE(_num_filler_regions() == 2);
+    size_t full = region_of(blocks[0]);
+    size_t sparse = region_of(blocks[per_region]);
+    REQUIRE(full != sparse);
+
+    // the freed hole in the fuller region is used before the emptier region
+    sfree(blocks[1]);
+    char *a = (char *)smalloc(8000);
+    REQUIRE(region_of(a) == full);
+    char *b = (char *)smalloc(size - 8000 - _size_meta_data());
+    REQUIRE(region_of(b) == full);
+    verify_blocks((per_region + 2), size * per_region + 8000 + size - 8000 - _size_meta_data(), 0, 0);
+
+    // the emptied region is given back
+    sfree(blocks[per_region]);
+    REQUIRE(_num_filler_regions() == 1);
+
+    sfree(a);
+    sfree(b);
+    sfree(blocks[0]);
+    for (size_t i = 2; i < per_region; i++)
+    {
+        sfree(blocks[i]);
+    }
+    REQUIRE(_num_filler_regions() == 0);
+    verify_blocks(0, 0, 0, 0);
+}
+
+TEST_CASE("filler srealloc", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(smallopt(SM_HUGEPAGE_FILLER, 1) == 1);
+
+    char *a = (char *)smalloc(5000);
+    REQUIRE(a != nullptr);
+    memset(a, 'a', 5000);
+    char *b = (char *)srealloc(a, 8000);
+    REQUIRE(b == a);
+    verify_blocks(1, 8000, 0, 0);
+
+    char *c = (char *)srealloc(b, 50000);
+    REQUIRE(c != nullptr);
+    REQUIRE(c != b);
+    for (size_t i = 0; i < 5000; i++)
+    {
+        REQUIRE(c[i] == 'a');
+    }
+    verify_blocks(1, 50000, 0, 0);
+
+    char *d = (char *)srealloc(c, MMAP_THRESHOLD + 8);
+    REQUIRE(d != nullptr);
+    for (size_t i = 0; i < 5000; i++)
+    {
+        REQUIRE(d[i] == 'a');
+    }
+    REQUIRE(_num_filler_regions() == 0);
+    verify_blocks(1, MMAP_THRESHOLD + 8, 0, 0);
+    sfree(d);
+}
+
+TEST_CASE("filler scalloc", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(smallopt(SM_HUGEPAGE_FILLER, 1) == 1);
+
+    char *keep = (char *)smalloc(4096);
+    char *a = (char *)smalloc(10000);
+    REQUIRE(a != nullptr);
+    memset(a, 'a', 10000);
+    sfree(a);
+    char *b = (char *)scalloc(10000, 1);
+    REQUIRE(b == a);
+    for (size_t i = 0; i < 10000; i++)
+    {
+        REQUIRE(b[i] == 0);
+    }
+    sfree(b);
+    sfree(keep);
+    verify_blocks(0, 0, 0, 0);
+}
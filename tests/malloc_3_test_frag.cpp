@@ -0,0 +1,146 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MIN_SPLIT_SIZE (128)
+
+static struct smallfrag frag()
+{
+    struct smallfrag result;
+    REQUIRE(smalloc_frag(&result) == 0);
+    return result;
+}
+
+// what the counters must agree with: the walks behind _num_* and each other
+#define verify_frag(f)                                                                                                 \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE((f).free_blocks == _num_free_blocks());                                                                \
+        REQUIRE((f).free_bytes == _num_free_bytes());                                                                  \
+        REQUIRE((f).live_bytes == _num_allocated_bytes() - _num_free_bytes());                                         \
+        size_t histogram_blocks = 0, histogram_bytes = 0, small_blocks = 0;                                            \
+        for (int i = 0; i < SMALLFRAG_BUCKETS; i++)                                                                    \
+        {                                                                                                              \
+            histogram_blocks += (f).histogram_blocks[i];                                                               \
+            histogram_bytes += (f).histogram_bytes[i];                                                                 \
+            small_blocks += (1ul << i) <= MIN_SPLIT_SIZE ? (f).histogram_blocks[i] : 0;                                \
+        }                                                                                                              \
+        REQUIRE(histogram_blocks == (f).free_blocks);                                                                  \
+        REQUIRE(histogram_bytes == (f).free_bytes);                                                                    \
+        REQUIRE((f).stranded_blocks == small_blocks);                                                                  \
+    } while (0)
+
+TEST_CASE("smalloc_frag heap", "[malloc3]")
+{
+    struct smallfrag now = frag();
+    REQUIRE(now.free_blocks == 0);
+    REQUIRE(now.heap_bytes == 0);
+    REQUIRE(now.external_fragmentation == 0.0);
+    REQUIRE(now.heap_to_live == 0.0);
+    REQUIRE(smalloc_frag(nullptr) == -1);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(1000);
+    char *c = (char *)smalloc(100);
+    char *d = (char *)smalloc(3000);
+    char *e = (char *)smalloc(100);
+    now = frag();
+    REQUIRE(now.heap_bytes == (size_t)((char *)sbrk(0) - (char *)base));
+    REQUIRE(now.live_bytes == 104 + 1000 + 104 + 3000 + 104);
+    REQUIRE(now.heap_to_live == (double)now.heap_bytes / now.live_bytes);
+    verify_frag(now);
+
+    // a lone 104 byte block is too small to be split, whatever asks for it
+    sfree(a);
+    now = frag();
+    REQUIRE(now.stranded_blocks == 1);
+    REQUIRE(now.stranded_bytes == 104);
+    REQUIRE(now.histogram_blocks[7] == 1); // 64 to 127
+    verify_frag(now);
+
+    long split = 64;
+    REQUIRE(smallctl("min_split_size", nullptr, &split) == 0);
+    REQUIRE(frag().stranded_blocks == 0);
+    split = MIN_SPLIT_SIZE;
+    REQUIRE(smallctl("min_split_size", nullptr, &split) == 0);
+    REQUIRE(frag().stranded_bytes == 104);
+
+    // a merges into b
+    sfree(b);
+    sfree(d);
+    now = frag();
+    REQUIRE(now.free_blocks == 2);
+    REQUIRE(now.free_bytes == 104 + _size_meta_data() + 1000 + 3000);
+    REQUIRE(now.largest_free_block == 3000);
+    REQUIRE(now.external_fragmentation == 1.0 - 3000.0 / now.free_bytes);
+    REQUIRE(now.live_bytes == 208);
+    REQUIRE(now.histogram_blocks[11] == 1); // 1024 to 2047
+    REQUIRE(now.histogram_blocks[12] == 1); // 2048 to 4095
+    REQUIRE(now.histogram_bytes[12] == 3000);
+    REQUIRE(now.stranded_blocks == 0);
+    verify_frag(now);
+
+    // c between two free blocks merges with both
+    sfree(c);
+    now = frag();
+    REQUIRE(now.free_blocks == 1);
+    REQUIRE(now.largest_free_block == 104 + 1000 + 104 + 3000 + 3 * _size_meta_data());
+    REQUIRE(now.external_fragmentation == 0.0);
+    verify_frag(now);
+
+    sfree(e);
+    now = frag();
+    REQUIRE(now.free_blocks == 1);
+    REQUIRE(now.live_bytes == 0);
+    REQUIRE(now.heap_to_live == 0.0);
+    verify_frag(now);
+}
+
+TEST_CASE("smalloc_frag churn", "[malloc3]")
+{
+    // every path that moves free blocks around: splits, merges, srealloc cases, aligned pads
+    const int slots = 200;
+    void *blocks[slots] = {};
+    unsigned int seed = 7;
+    for (int i = 0; i < 20000; i++)
+    {
+        int k = rand_r(&seed) % slots;
+        size_t size = rand_r(&seed) % 4000 + 1;
+        switch (rand_r(&seed) % 4)
+        {
+        case 0:
+            sfree(blocks[k]);
+            blocks[k] = smalloc(size);
+            break;
+        case 1:
+            if (blocks[k] != nullptr)
+            {
+                blocks[k] = srealloc(blocks[k], size);
+            }
+            break;
+        case 2:
+            sfree(blocks[k]);
+            blocks[k] = saligned_alloc(64 << (rand_r(&seed) % 4), size);
+            break;
+        default:
+            sfree(blocks[k]);
+            blocks[k] = nullptr;
+            break;
+        }
+        if (i % 1000 == 0)
+        {
+            struct smallfrag now = frag();
+            verify_frag(now);
+        }
+    }
+    for (int k = 0; k < slots; k++)
+    {
+        sfree(blocks[k]);
+    }
+    struct smallfrag now = frag();
+    verify_frag(now);
+    REQUIRE(now.live_bytes == 0);
+}
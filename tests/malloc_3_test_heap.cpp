@@ -0,0 +1,242 @@
+#include "my_stdlib.h"
+#include "my_memory_resource.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory_resource>
+#include <vector>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define HEAP_SEGMENT_SIZE (1024 * 1024)
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+#define verify_heap(heap, expected_allocated_blocks, expected_allocated_bytes, expected_free_blocks,                   \
+                    expected_free_bytes)                                                                               \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        struct sheap_info info = sheap_stats(heap);                                                                    \
+        REQUIRE(info.allocated_blocks == expected_allocated_blocks);                                                   \
+        REQUIRE(info.allocated_bytes == aligned_size(expected_allocated_bytes));                                       \
+        REQUIRE(info.free_blocks == expected_free_blocks);                                                             \
+        REQUIRE(info.free_bytes == aligned_size(expected_free_bytes));                                                 \
+        REQUIRE(info.meta_data_bytes == _size_meta_data() * expected_allocated_blocks);                                \
+    } while (0)
+
+TEST_CASE("heap alloc free", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    sheap_t heap = sheap_create();
+    REQUIRE(heap != nullptr);
+    verify_heap(heap, 0, 0, 0, 0);
+    REQUIRE(sheap_stats(heap).segments == 1);
+    REQUIRE(sheap_stats(heap).segment_bytes == HEAP_SEGMENT_SIZE);
+
+    char *a = (char *)sheap_alloc(heap, 100);
+    char *b = (char *)sheap_alloc(heap, 10);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    memset(a, 'a', 100);
+    memset(b, 'b', 10);
+    verify_heap(heap, 2, 100 + 16, 0, 0);
+
+    sheap_free(heap, a);
+    verify_heap(heap, 2, 100 + 16, 1, 104);
+    char *c = (char *)sheap_alloc(heap, 50);
+    REQUIRE(c == a); // the free block is reused
+    sheap_free(heap, c);
+    sheap_free(heap, b);
+    verify_heap(heap, 1, 104 + 16 + _size_meta_data(), 1, 104 + 16 + _size_meta_data());
+
+    // the global heap is not touched
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(sbrk(0) == base);
+
+    REQUIRE(sheap_alloc(heap, 0) == nullptr);
+    REQUIRE(sheap_alloc(heap, MAX_ALLOCATION_SIZE + 1) == nullptr);
+    REQUIRE(sheap_alloc(nullptr, 10) == nullptr);
+    sheap_free(heap, nullptr);
+    sheap_destroy(heap);
+}
+
+TEST_CASE("heap realloc", "[malloc3]")
+{
+    sheap_t heap = sheap_create();
+    char *a = (char *)sheap_realloc(heap, nullptr, 100);
+    REQUIRE(a != nullptr);
+    memset(a, 'a', 100);
+
+    // a is the last block of the segment, it grows in place
+    char *b = (char *)sheap_realloc(heap, a, 1000);
+    REQUIRE(b == a);
+    verify_heap(heap, 1, 1000, 0, 0);
+
+    // blocked by c, so it is copied
+    char *c = (char *)sheap_alloc(heap, 10);
+    memset(b + 100, 'b', 900);
+    char *d = (char *)sheap_realloc(heap, b, 5000);
+    REQUIRE(d != b);
+    for (int i = 0; i < 1000; i++)
+    {
+        REQUIRE(d[i] == (i < 100 ? 'a' : 'b'));
+    }
+    verify_heap(heap, 3, 1000 + 16 + 5000, 1, 1000);
+
+    // shrinking splits in place
+    char *e = (char *)sheap_realloc(heap, d, 100);
+    REQUIRE(e == d);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(e[i] == 'a');
+    }
+    REQUIRE(sheap_realloc(heap, e, 0) == nullptr);
+    sheap_free(heap, c);
+    sheap_free(heap, e);
+    sheap_destroy(heap);
+}
+
+TEST_CASE("heap segments", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    sheap_t heap = sheap_create();
+    std::vector<char *> blocks;
+    // sizes that would be mapped one by one in the global heap stay in the heap's segments
+    for (int i = 0; i < 10; i++)
+    {
+        char *p = (char *)sheap_alloc(heap, 2 * MMAP_THRESHOLD);
+        REQUIRE(p != nullptr);
+        memset(p, 'x', 2 * MMAP_THRESHOLD);
+        blocks.push_back(p);
+    }
+    REQUIRE(sheap_stats(heap).segments > 1);
+    REQUIRE(sheap_stats(heap).segment_bytes >= 10 * 2 * MMAP_THRESHOLD);
+
+    // a block larger than a segment gets a segment of its own
+    size_t segments = sheap_stats(heap).segments;
+    char *big = (char *)sheap_alloc(heap, 3 * HEAP_SEGMENT_SIZE);
+    REQUIRE(big != nullptr);
+    memset(big, 'y', 3 * HEAP_SEGMENT_SIZE);
+    REQUIRE(sheap_stats(heap).segments == segments + 1);
+    for (char *p : blocks)
+    {
+        REQUIRE(p[2 * MMAP_THRESHOLD - 1] == 'x');
+    }
+
+    // blocks from different segments never merge
+    sheap_free(heap, big);
+    for (char *p : blocks)
+    {
+        sheap_free(heap, p);
+    }
+    REQUIRE(sheap_stats(heap).free_blocks >= segments);
+    verify_blocks(0, 0, 0, 0);
+    sheap_destroy(heap);
+}
+
+TEST_CASE("heap aligned", "[malloc3]")
+{
+    sheap_t heap = sheap_create();
+    size_t alignments[] = {8, 16, 64, 4096};
+    for (size_t alignment : alignments)
+    {
+        void *p = sheap_aligned_alloc(heap, alignment, 300);
+        REQUIRE(p != nullptr);
+        REQUIRE((uintptr_t)p % alignment == 0);
+        memset(p, 'p', 300);
+    }
+    REQUIRE(sheap_aligned_alloc(heap, 24, 300) == nullptr);
+    verify_blocks(0, 0, 0, 0);
+    sheap_destroy(heap);
+}
+
+TEST_CASE("heap destroy with live blocks", "[malloc3]")
+{
+    void *base = sbrk(0);
+    for (int round = 0; round < 20; round++)
+    {
+        sheap_t heap = sheap_create();
+        for (int i = 0; i < 1000; i++)
+        {
+            char *p = (char *)sheap_alloc(heap, i % 500 + 1);
+            REQUIRE(p != nullptr);
+            p[0] = 'x';
+        }
+        sheap_destroy(heap); // nothing freed before
+    }
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(sbrk(0) == base);
+}
+
+TEST_CASE("heaps are separate", "[malloc3]")
+{
+    sheap_t first = sheap_create();
+    sheap_t second = sheap_create();
+    void *a = sheap_alloc(first, 1000);
+    sheap_alloc(first, 10);
+    sheap_free(first, a);
+    void *b = sheap_alloc(second, 1000);
+    REQUIRE(b != a); // the free block of first is not seen by second
+    verify_heap(first, 2, 1000 + 16, 1, 1000);
+    verify_heap(second, 1, 1000, 0, 0);
+
+    void *c = smalloc(1000);
+    REQUIRE(c != a);
+    verify_blocks(1, 1000, 0, 0);
+    sfree(c);
+    sheap_destroy(first);
+    sheap_destroy(second);
+}
+
+TEST_CASE("heap resource", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    sheap_t heap = sheap_create();
+    SmallocResource resource(heap);
+    REQUIRE(resource.heap() == heap);
+    REQUIRE(!resource.is_equal(*smalloc_resource()));
+    {
+        std::pmr::map<int, int> m(&resource);
+        for (int i = 0; i < 1000; i++)
+        {
+            m[i] = i;
+        }
+        REQUIRE(sheap_stats(heap).allocated_blocks - sheap_stats(heap).free_blocks == 1000);
+
+        std::vector<int, SmallocAllocator<int>> v{SmallocAllocator<int>(heap)};
+        for (int i = 0; i < 1000; i++)
+        {
+            v.push_back(i);
+        }
+        REQUIRE(v.get_allocator() != SmallocAllocator<int>());
+        REQUIRE(v.get_allocator() == SmallocAllocator<char>(heap));
+    }
+    verify_blocks(0, 0, 0, 0);
+
+    // a map left alive when its heap goes away would be freed into unmapped memory,
+    // so containers on a heap are destroyed first or released all at once, as here
+    auto *leaked = new (sheap_alloc(heap, sizeof(std::pmr::map<int, int>))) std::pmr::map<int, int>(&resource);
+    for (int i = 0; i < 1000; i++)
+    {
+        (*leaked)[i] = i;
+    }
+    sheap_destroy(heap);
+}
@@ -0,0 +1,162 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <string.h>
+#include <unistd.h>
+
+#define MMAP_THRESHOLD (128 * 1024)
+
+enum
+{
+    CASE_A,
+    CASE_B,
+    CASE_C,
+    CASE_D,
+    CASE_E,
+    CASE_F,
+    CASE_G,
+    CASE_H
+};
+
+static struct smallinfo info()
+{
+    struct smallinfo result;
+    REQUIRE(smalloc_info(&result) == 0);
+    return result;
+}
+
+TEST_CASE("smalloc_info heap", "[malloc3]")
+{
+    void *base = sbrk(0);
+    struct smallinfo start = info();
+    REQUIRE(start.heap_bytes == 0);
+    REQUIRE(start.free_blocks == 0);
+    REQUIRE(start.largest_free_block == 0);
+    REQUIRE(smalloc_info(nullptr) == -1);
+
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(1000);
+    char *c = (char *)smalloc(100);
+    char *d = (char *)smalloc(3000);
+    char *e = (char *)smalloc(100);
+    struct smallinfo now = info();
+    REQUIRE(now.heap_bytes == (size_t)((char *)sbrk(0) - (char *)base));
+    REQUIRE(now.sbrk_calls == start.sbrk_calls + 5);
+
+    sfree(b);
+    sfree(d);
+    now = info();
+    REQUIRE(now.free_blocks == 2);
+    REQUIRE(now.largest_free_block == 3000);
+    REQUIRE(now.merges == start.merges);
+
+    // 500 out of the 1000 byte block splits it, freeing the rest merges nothing
+    char *f = (char *)smalloc(500);
+    REQUIRE(f == b);
+    now = info();
+    REQUIRE(now.splits == start.splits + 1);
+    REQUIRE(now.free_blocks == 2);
+
+    // c between two free blocks merges with both
+    sfree(c);
+    now = info();
+    REQUIRE(now.merges == start.merges + 2);
+    REQUIRE(now.free_blocks == 1);
+    REQUIRE(now.largest_free_block == 1000 - 504 - _size_meta_data() + 104 + 3000 + 2 * _size_meta_data());
+
+    sfree(a);
+    sfree(e);
+    sfree(f);
+    now = info();
+    REQUIRE(now.free_blocks == 1);
+    REQUIRE(now.largest_free_block == _num_free_bytes());
+    REQUIRE(now.sbrk_calls == start.sbrk_calls + 5);
+}
+
+TEST_CASE("smalloc_info mmap and madvise", "[malloc3]")
+{
+    struct smallinfo start = info();
+    char *a = (char *)smalloc(MMAP_THRESHOLD + 100);
+    struct smallinfo now = info();
+    REQUIRE(now.mmap_blocks == 1);
+    REQUIRE(now.mmap_bytes == MMAP_THRESHOLD + 104);
+    REQUIRE(now.mmap_calls == start.mmap_calls + 1);
+    REQUIRE(now.sbrk_calls == start.sbrk_calls);
+    sfree(a);
+    now = info();
+    REQUIRE(now.mmap_blocks == 0);
+    REQUIRE(now.mmap_bytes == 0);
+    REQUIRE(now.munmap_calls == start.munmap_calls + 1);
+
+    char *b = (char *)smalloc(100000);
+    char *c = (char *)smalloc(100);
+    sfree(b);
+    REQUIRE(spurge() > 0);
+    now = info();
+    REQUIRE(now.madvise_calls == start.madvise_calls + 1);
+    sfree(c);
+}
+
+TEST_CASE("smalloc_info srealloc cases", "[malloc3]")
+{
+    struct smallinfo start = info();
+    size_t meta = _size_meta_data();
+
+    char *a = (char *)smalloc(32);
+    a = (char *)srealloc(a, 16); // A
+    a = (char *)srealloc(a, 64); // C, a is the last block
+
+    char *b = (char *)smalloc(32);
+    char *c = (char *)smalloc(32);
+    sfree(b);
+    a = (char *)srealloc(a, 64 + 32 + meta); // D
+
+    char *d = (char *)smalloc(32);
+    sfree(a);
+    c = (char *)srealloc(c, 100); // B, moves 32 bytes down
+
+    char *e = (char *)smalloc(32);
+    char *f = (char *)smalloc(32);
+    char *g = (char *)smalloc(32);
+    char *h = (char *)smalloc(32);
+    sfree(e);
+    sfree(g);
+    f = (char *)srealloc(f, 32 * 3 + 2 * meta); // E, moves 32 bytes down
+
+    char *x = (char *)smalloc(32);
+    sfree(x);
+    h = (char *)srealloc(h, 1000); // F, the free last block grows
+
+    char *y = (char *)smalloc(500);
+    char *z = (char *)smalloc(32);
+    sfree(y);
+    d = (char *)srealloc(d, 400); // G, copied into y
+    REQUIRE(d == y);
+
+    char *w = (char *)smalloc(64); // too large for the block d left
+    z = (char *)srealloc(z, 5000); // H, copied to a new block at the break
+
+    struct smallinfo now = info();
+    size_t expected[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+    for (int i = CASE_A; i <= CASE_H; i++)
+    {
+        INFO("case " << (char)('A' + i));
+        REQUIRE(now.realloc_cases[i] == start.realloc_cases[i] + expected[i]);
+    }
+    REQUIRE(now.realloc_moved_bytes == start.realloc_moved_bytes + 4 * 32);
+
+    // a mapped block copied to a new mapping is H too
+    char *m = (char *)smalloc(MMAP_THRESHOLD);
+    m = (char *)srealloc(m, 2 * MMAP_THRESHOLD);
+    now = info();
+    REQUIRE(now.realloc_cases[CASE_H] == start.realloc_cases[CASE_H] + 2);
+    REQUIRE(now.realloc_moved_bytes == start.realloc_moved_bytes + 4 * 32 + MMAP_THRESHOLD);
+
+    sfree(c);
+    sfree(d);
+    sfree(f);
+    sfree(h);
+    sfree(m);
+    sfree(w);
+    sfree(z);
+}
@@ -0,0 +1,179 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+// Part of malloc_3_test, where no instrumentation policy is built in, and of
+// malloc_3_counting_test and malloc_3_tracing_test, built with SMALLOC_COUNTING and
+// SMALLOC_TRACING.
+
+#define MMAP_THRESHOLD (128 * 1024)
+
+#if defined(SMALLOC_COUNTING) || defined(SMALLOC_TRACING)
+
+static std::string dump_text()
+{
+    char path[] = "/tmp/smalloc_instrument_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    unlink(path);
+    REQUIRE(sinstrument_dump(fd) == 0);
+    std::string text;
+    char buffer[4096];
+    ssize_t got;
+    REQUIRE(lseek(fd, 0, SEEK_SET) == 0);
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        text.append(buffer, got);
+    }
+    close(fd);
+    return text;
+}
+
+#endif
+
+#ifdef SMALLOC_COUNTING
+
+static struct sinstrument counted(int event)
+{
+    struct sinstrument result;
+    REQUIRE(sinstrument(event, &result) == 0);
+    return result;
+}
+
+TEST_CASE("sinstrument counting", "[malloc3]")
+{
+    sinstrument_reset();
+    size_t header = _size_meta_data();
+    char *a = (char *)smalloc(1000);
+    char *b = (char *)smalloc(100);
+    REQUIRE(counted(SI_SPLIT).count == 0);
+    REQUIRE(counted(SI_GROW).count == 0); // new blocks at the break, nothing grew
+
+    sfree(a);
+    char *c = (char *)smalloc(100);
+    REQUIRE(c == a);
+    REQUIRE(counted(SI_SPLIT).count == 1);
+    REQUIRE(counted(SI_SPLIT).bytes == 1000 - 104 - header);
+
+    sfree(c); // takes in the free rest after it
+    REQUIRE(counted(SI_MERGE).count == 1);
+    REQUIRE(counted(SI_MERGE).bytes == 1000 - 104);
+    sfree(b); // and the block at the break takes in both
+    REQUIRE(counted(SI_MERGE).count == 2);
+    REQUIRE(counted(SI_MERGE).bytes == 1000 - 104 + 104 + header);
+
+    char *d = (char *)smalloc(5000);
+    REQUIRE(d == a);
+    REQUIRE(counted(SI_GROW).count == 1);
+    REQUIRE(counted(SI_GROW).bytes == 5000 - 1000 - 104 - header);
+
+    char *e = (char *)smalloc(MMAP_THRESHOLD);
+    REQUIRE(counted(SI_MMAP).count == 1);
+    REQUIRE(counted(SI_MMAP).bytes == MMAP_THRESHOLD);
+    sfree(e);
+    REQUIRE(counted(SI_MUNMAP).count == 1);
+
+    REQUIRE(srealloc(d, 4000) == d);
+    REQUIRE(counted(SI_REALLOC_A).count == 1);
+    REQUIRE(counted(SI_REALLOC_A).bytes == 4000);
+    REQUIRE(counted(SI_SPLIT).count == 2);
+
+    std::string text = dump_text();
+    REQUIRE(text.find("\nsplit                  2 ") != std::string::npos);
+    REQUIRE(text.find("\nrealloc_h              0 ") != std::string::npos);
+
+    sinstrument_reset();
+    REQUIRE(counted(SI_SPLIT).count == 0);
+    REQUIRE(counted(SI_MERGE).bytes == 0);
+    struct sinstrument result;
+    REQUIRE(sinstrument(SI_EVENTS, &result) == -1);
+    REQUIRE(sinstrument(SI_SPLIT, nullptr) == -1);
+    REQUIRE(sinstrument_trace(nullptr, 10) == 0);
+    sfree(d);
+}
+
+#elif defined(SMALLOC_TRACING)
+
+static std::vector<sinstrument_event> traced()
+{
+    std::vector<sinstrument_event> events(8192);
+    events.resize(sinstrument_trace(events.data(), events.size()));
+    return events;
+}
+
+static uint64_t header_of(void *p)
+{
+    return (uint64_t)p - _size_meta_data();
+}
+
+TEST_CASE("sinstrument tracing", "[malloc3]")
+{
+    sinstrument_reset();
+    char *a = (char *)smalloc(1000);
+    char *b = (char *)smalloc(100);
+    sfree(a);
+    char *c = (char *)smalloc(100);
+    sfree(c);
+    char *d = (char *)srealloc(b, 2000); // grows the block at the break
+    REQUIRE(d == a);
+
+    std::vector<sinstrument_event> events = traced();
+    REQUIRE(events.size() == 5);
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        REQUIRE(events[i].seq == i);
+    }
+    REQUIRE(events[0].event == SI_SPLIT);
+    REQUIRE(events[0].op == SL_SMALLOC);
+    REQUIRE(events[0].address == header_of(a));
+    REQUIRE(events[1].event == SI_MERGE);
+    REQUIRE(events[1].op == SL_SFREE);
+    // case B: b moves down into the free block before it, which grows with the break
+    REQUIRE(events[2].event == SI_GROW);
+    REQUIRE(events[2].op == SL_SREALLOC);
+    REQUIRE(events[2].address == header_of(b));
+    REQUIRE(events[3].event == SI_MERGE);
+    REQUIRE(events[3].address == header_of(b));
+    REQUIRE(events[4].event == SI_REALLOC_A + 1);
+    REQUIRE(events[4].bytes == 2000);
+    REQUIRE(events[4].address == 0);
+
+    std::string text = dump_text();
+    REQUIRE(text.find(" srealloc        grow ") != std::string::npos);
+
+    // only the latest events are kept, d is the one block left to split
+    sfree(d);
+    sinstrument_reset();
+    for (int i = 0; i < 3000; i++)
+    {
+        sfree(smalloc(100));
+    }
+    events = traced();
+    REQUIRE(events.size() == 4096);
+    REQUIRE(events.back().seq == 6000 - 1);
+    REQUIRE(events.front().seq == 6000 - 4096);
+    REQUIRE(sinstrument_trace(events.data(), 2) == 2);
+    REQUIRE(events[1].seq == 6000 - 1);
+
+    struct sinstrument result;
+    REQUIRE(sinstrument(SI_SPLIT, &result) == -1);
+}
+
+#else
+
+TEST_CASE("sinstrument compiled out", "[malloc3]")
+{
+    struct sinstrument result;
+    sinstrument_event event;
+    REQUIRE(sinstrument(SI_SPLIT, &result) == -1);
+    REQUIRE(sinstrument_trace(&event, 1) == 0);
+    REQUIRE(sinstrument_dump(STDERR_FILENO) == -1);
+    sinstrument_reset();
+}
+
+#endif
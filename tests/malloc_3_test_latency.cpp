@@ -0,0 +1,136 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+// Part of malloc_3_test, where the histograms are compiled out, and of malloc_3_latency_test,
+// built with SMALLOC_LATENCY.
+
+#ifdef SMALLOC_LATENCY
+
+static size_t calls(int op, int path)
+{
+    struct slatency latency;
+    REQUIRE(slatency(op, path, &latency) == 0);
+    size_t in_buckets = 0;
+    for (int i = 0; i < SL_BUCKETS; i++)
+    {
+        in_buckets += latency.buckets[i];
+    }
+    REQUIRE(in_buckets == latency.count);
+    REQUIRE(latency.max <= latency.total);
+    return latency.count;
+}
+
+static size_t calls(int op)
+{
+    size_t count = 0;
+    for (int path = 0; path < SL_PATHS; path++)
+    {
+        count += calls(op, path);
+    }
+    return count;
+}
+
+TEST_CASE("slatency paths", "[malloc3]")
+{
+    REQUIRE(calls(SL_SMALLOC) == 0);
+    void *a = smalloc(100);
+    void *b = smalloc(100);
+    REQUIRE(calls(SL_SMALLOC, SL_PATH_SBRK) == 2);
+
+    sfree(a);
+    REQUIRE(calls(SL_SFREE, SL_PATH_FREE) == 1);
+    void *c = smalloc(100);
+    REQUIRE(c == a);
+    REQUIRE(calls(SL_SMALLOC, SL_PATH_REUSE) == 1);
+    sfree(c);
+
+    void *d = smalloc(200000);
+    REQUIRE(calls(SL_SMALLOC, SL_PATH_MMAP) == 1);
+    sfree(d);
+    REQUIRE(calls(SL_SFREE, SL_PATH_MMAP) == 1);
+
+    sfree_sized(b, 100);
+    REQUIRE(calls(SL_SFREE, SL_PATH_MERGE) == 1);
+    REQUIRE(calls(SL_SFREE) == 4);
+
+    // the one free block is at the break
+    void *e = smalloc(1000);
+    REQUIRE(e == a);
+    REQUIRE(calls(SL_SMALLOC, SL_PATH_WILDERNESS) == 1);
+    sfree(e);
+    void *f = smalloc(100);
+    REQUIRE(calls(SL_SMALLOC, SL_PATH_SPLIT) == 1);
+    REQUIRE(calls(SL_SMALLOC) == 6);
+
+    void *g = scalloc(10, 10);
+    void *h = saligned_alloc(64, 100);
+    REQUIRE(calls(SL_SCALLOC) == 1);
+    REQUIRE(calls(SL_SALIGNED_ALLOC) == 1);
+
+    // the copy srealloc falls back on is part of the srealloc, not a smalloc and an sfree
+    void *i = srealloc(f, 50);
+    REQUIRE(i == f);
+    REQUIRE(calls(SL_SREALLOC, SL_PATH_REALLOC_A) == 1);
+    void *j = srealloc(g, 200000);
+    REQUIRE(calls(SL_SREALLOC, SL_PATH_REALLOC_A + 7) == 1);
+    REQUIRE(calls(SL_SMALLOC) == 6);
+    REQUIRE(calls(SL_SFREE) == 5);
+    void *k = srealloc(nullptr, 100);
+    REQUIRE(calls(SL_SREALLOC) == 3);
+    REQUIRE(calls(SL_SMALLOC) == 6);
+
+    sfree(h);
+    sfree(i);
+    sfree(j);
+    sfree(k);
+}
+
+TEST_CASE("slatency_dump and reset", "[malloc3]")
+{
+    void *a = smalloc(100);
+    sfree(a);
+
+    char path[] = "/tmp/smalloc_latency_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    unlink(path);
+    REQUIRE(slatency_dump(fd) == 0);
+    std::string text;
+    char buffer[4096];
+    ssize_t got;
+    REQUIRE(lseek(fd, 0, SEEK_SET) == 0);
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        text.append(buffer, got);
+    }
+    close(fd);
+    REQUIRE(text.find("p99.9") != std::string::npos);
+    REQUIRE(text.find("\nsmalloc         sbrk                 1 ") != std::string::npos);
+    REQUIRE(text.find("\nsfree           free                 1 ") != std::string::npos);
+
+    slatency_reset();
+    REQUIRE(calls(SL_SMALLOC) == 0);
+    REQUIRE(calls(SL_SFREE) == 0);
+
+    struct slatency latency;
+    REQUIRE(slatency(SL_OPS, 0, &latency) == -1);
+    REQUIRE(slatency(0, SL_PATHS, &latency) == -1);
+    REQUIRE(slatency(0, 0, nullptr) == -1);
+}
+
+#else
+
+TEST_CASE("slatency compiled out", "[malloc3]")
+{
+    struct slatency latency;
+    REQUIRE(slatency(SL_SMALLOC, SL_PATH_REUSE, &latency) == -1);
+    REQUIRE(slatency_dump(STDERR_FILENO) == -1);
+    slatency_reset();
+}
+
+#endif
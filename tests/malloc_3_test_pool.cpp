@@ -0,0 +1,235 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <set>
+#include <vector>
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+TEST_CASE("pool alloc free", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    spool_t pool = spool_create(48, 0);
+    REQUIRE(pool != nullptr);
+    REQUIRE(spool_stats(pool).stride == 48);
+
+    std::vector<char *> objects;
+    for (int i = 0; i < 1000; i++)
+    {
+        char *p = (char *)spool_alloc(pool);
+        REQUIRE(p != nullptr);
+        memset(p, i % 256, 48);
+        objects.push_back(p);
+    }
+    // no header between the objects of a slab
+    REQUIRE(objects[1] - objects[0] == 48);
+    REQUIRE(objects[999] - objects[998] == 48);
+    REQUIRE(std::set<char *>(objects.begin(), objects.end()).size() == 1000);
+    for (int i = 0; i < 1000; i++)
+    {
+        REQUIRE(objects[i][47] == (char)(i % 256));
+    }
+    struct spool_info info = spool_stats(pool);
+    REQUIRE(info.used_objects == 1000);
+    REQUIRE(info.free_objects == 0);
+    REQUIRE(info.slabs == 1);
+    REQUIRE(info.slab_bytes == 64 * 1024);
+
+    spool_free(pool, objects[10]);
+    spool_free(pool, objects[20]);
+    REQUIRE(spool_stats(pool).used_objects == 998);
+    REQUIRE(spool_stats(pool).free_objects == 2);
+    REQUIRE(spool_alloc(pool) == objects[20]); // last freed first
+    REQUIRE(spool_alloc(pool) == objects[10]);
+    for (char *p : objects)
+    {
+        spool_free(pool, p);
+    }
+    spool_free(pool, nullptr);
+    REQUIRE(spool_stats(pool).used_objects == 0);
+    REQUIRE(spool_stats(pool).free_objects == 1000);
+
+    // the global heap is not touched
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(sbrk(0) == base);
+    spool_destroy(pool);
+}
+
+TEST_CASE("pool alignment", "[malloc3]")
+{
+    spool_t wide = spool_create(48, 64);
+    spool_t odd = spool_create(96, 32);
+    spool_t tiny = spool_create(1, 0);
+    REQUIRE(spool_stats(wide).stride == 64);
+    REQUIRE(spool_stats(odd).stride == 96);
+    REQUIRE(spool_stats(tiny).stride == 8); // room for the free list link
+    for (int i = 0; i < 5000; i++)
+    {
+        REQUIRE((uintptr_t)spool_alloc(wide) % 64 == 0);
+        REQUIRE((uintptr_t)spool_alloc(odd) % 32 == 0);
+        REQUIRE((uintptr_t)spool_alloc(tiny) % 8 == 0);
+    }
+    REQUIRE(spool_stats(odd).slabs == 8); // 682 objects a slab
+
+    REQUIRE(spool_create(48, 24) == nullptr);
+    REQUIRE(spool_create(0, 8) == nullptr);
+    spool_destroy(wide);
+    spool_destroy(odd);
+    spool_destroy(tiny);
+}
+
+TEST_CASE("pool stats", "[malloc3]")
+{
+    REQUIRE(_num_pools() == 0);
+    spool_t a = spool_create(64, 0);
+    spool_t b = spool_create(100000, 0); // larger objects get larger slabs
+    REQUIRE(_num_pools() == 2);
+    REQUIRE(_num_pool_objects() == 0);
+    REQUIRE(_num_pool_bytes() == 0);
+    void *p = spool_alloc(a);
+    spool_alloc(a);
+    spool_alloc(b);
+    REQUIRE(_num_pool_objects() == 3);
+    REQUIRE(_num_pool_bytes() == 64 * 1024 + 16 * 100000);
+    spool_free(a, p);
+    REQUIRE(_num_pool_objects() == 2);
+
+    spool_destroy(a); // with an object still in use
+    REQUIRE(_num_pools() == 1);
+    REQUIRE(_num_pool_objects() == 1);
+    spool_destroy(b);
+    REQUIRE(_num_pools() == 0);
+    REQUIRE(_num_pool_bytes() == 0);
+    verify_blocks(0, 0, 0, 0);
+}
+
+struct ChurnArgs
+{
+    spool_t pool;
+    unsigned int seed;
+    std::vector<void *> handoff; // allocated here, freed by the main thread
+    int errors;
+};
+
+static void *churn(void *arg)
+{
+    ChurnArgs *args = (ChurnArgs *)arg;
+    std::vector<unsigned int *> live;
+    for (int i = 0; i < 20000; i++)
+    {
+        unsigned int *p = (unsigned int *)spool_alloc(args->pool);
+        if (p == nullptr)
+        {
+            args->errors++;
+            return nullptr;
+        }
+        p[0] = p[15] = (unsigned int)(uintptr_t)p;
+        live.push_back(p);
+        if (live.size() > 200)
+        {
+            size_t k = rand_r(&args->seed) % live.size();
+            if (live[k][0] != (unsigned int)(uintptr_t)live[k] || live[k][15] != live[k][0])
+            {
+                args->errors++;
+            }
+            spool_free(args->pool, live[k]);
+            live[k] = live.back();
+            live.pop_back();
+        }
+    }
+    args->handoff.assign(live.begin(), live.end());
+    return nullptr;
+}
+
+TEST_CASE("pool thread cache", "[malloc3]")
+{
+    spool_t pool = spool_create(64, 0);
+    REQUIRE(spool_cache(pool, 64) == 0);
+    REQUIRE(spool_cache(pool, 64) == -1);
+
+    pthread_t threads[8];
+    ChurnArgs args[8];
+    for (int i = 0; i < 8; i++)
+    {
+        args[i].pool = pool;
+        args[i].seed = i + 1;
+        args[i].errors = 0;
+        REQUIRE(pthread_create(&threads[i], nullptr, churn, &args[i]) == 0);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        REQUIRE(pthread_join(threads[i], nullptr) == 0);
+        REQUIRE(args[i].errors == 0);
+    }
+    std::set<void *> live;
+    for (int i = 0; i < 8; i++)
+    {
+        live.insert(args[i].handoff.begin(), args[i].handoff.end());
+    }
+    REQUIRE(live.size() == 8 * 200);
+    REQUIRE(spool_stats(pool).used_objects == 8 * 200);
+
+    // freed by another thread than the one that allocated them
+    for (void *p : live)
+    {
+        spool_free(pool, p);
+    }
+    struct spool_info info = spool_stats(pool);
+    REQUIRE(info.used_objects == 0);
+    REQUIRE(info.free_objects >= 8 * 200);
+    REQUIRE(info.free_objects <= info.slab_bytes / 64); // the last slab may not be carved all the way
+    spool_destroy(pool);
+
+    spool_t used = spool_create(64, 0);
+    spool_alloc(used);
+    REQUIRE(spool_cache(used, 64) == -1); // too late
+    spool_destroy(used);
+}
+
+static void *alloc_one(void *arg)
+{
+    spool_t pool = (spool_t)arg;
+    void *p = spool_alloc(pool);
+    spool_free(pool, p);
+    return p;
+}
+
+TEST_CASE("pool thread cache reuse", "[malloc3]")
+{
+    spool_t pool = spool_create(64, 0);
+    REQUIRE(spool_cache(pool, 16) == 0);
+
+    // more threads than there are caches, one after the other: each exit gives the cache
+    // back to the pool and its slot to the next thread, so no more objects are carved
+    for (int i = 0; i < 100; i++)
+    {
+        pthread_t thread;
+        void *result;
+        REQUIRE(pthread_create(&thread, nullptr, alloc_one, pool) == 0);
+        REQUIRE(pthread_join(thread, &result) == 0);
+        REQUIRE(result != nullptr);
+        struct spool_info info = spool_stats(pool);
+        REQUIRE(info.used_objects == 0);
+        REQUIRE(info.free_objects == 8);
+    }
+    spool_destroy(pool);
+}
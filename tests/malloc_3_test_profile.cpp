@@ -0,0 +1,568 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#define PROFILE_DEFAULT_RATE (512 * 1024)
+
+struct profile_header
+{
+    size_t live_count;
+    size_t live_bytes;
+    size_t alloc_count;
+    size_t alloc_bytes;
+    size_t rate;
+};
+
+static std::string read_file(int fd)
+{
+    std::string text;
+    char buffer[4096];
+    ssize_t got;
+    REQUIRE(lseek(fd, 0, SEEK_SET) == 0);
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        text.append(buffer, got);
+    }
+    return text;
+}
+
+static profile_header parse_header(const std::string &text)
+{
+    profile_header header;
+    REQUIRE(sscanf(text.c_str(), "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu", &header.live_count,
+                   &header.live_bytes, &header.alloc_count, &header.alloc_bytes, &header.rate) == 5);
+    REQUIRE(text.find("\nMAPPED_LIBRARIES:\n") != std::string::npos);
+    return header;
+}
+
+static std::string dump_text()
+{
+    char path[] = "/tmp/smalloc_profile_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    unlink(path);
+    REQUIRE(sprofile_dump(fd) == 0);
+    std::string text = read_file(fd);
+    close(fd);
+    return text;
+}
+
+static profile_header dump_header()
+{
+    return parse_header(dump_text());
+}
+
+struct retained_site
+{
+    size_t site;
+    size_t bytes;
+    size_t blocks;
+};
+
+// the first site of each table of a sprofile_retained report
+static void parse_retained(const std::string &text, size_t &blocks, size_t &bytes, retained_site &by_bytes,
+                           retained_site &by_blocks)
+{
+    size_t sites = 0, rate = 0, dropped = 0;
+    REQUIRE(sscanf(text.c_str(), "retained: %zu blocks, %zu bytes from %zu sites, rate %zu, %zu dropped", &blocks,
+                   &bytes, &sites, &rate, &dropped) == 5);
+    REQUIRE(rate == 1);
+    REQUIRE(dropped == 0);
+    size_t at = text.find("top sites by retained bytes:\n");
+    REQUIRE(at != std::string::npos);
+    at = text.find('\n', text.find('\n', at) + 1) + 1;
+    REQUIRE(sscanf(text.c_str() + at, "%zx %zu %zu", &by_bytes.site, &by_bytes.bytes, &by_bytes.blocks) == 3);
+    at = text.find("top sites by retained blocks:\n");
+    REQUIRE(at != std::string::npos);
+    at = text.find('\n', text.find('\n', at) + 1) + 1;
+    REQUIRE(sscanf(text.c_str() + at, "%zx %zu %zu", &by_blocks.site, &by_blocks.bytes, &by_blocks.blocks) == 3);
+    REQUIRE(text.find("\nMAPPED_LIBRARIES:\n") != std::string::npos);
+}
+
+// two allocation sites, one with many small blocks and one with a few large ones
+__attribute__((noinline)) static void *small_site()
+{
+    return smalloc(100);
+}
+
+__attribute__((noinline)) static void *large_site()
+{
+    return smalloc(200000);
+}
+
+__attribute__((noinline)) static void *kept_site()
+{
+    return smalloc(3000);
+}
+
+// the value of key in a line of space separated key=value fields, empty when it has none
+static std::string field(const std::string &line, const std::string &key)
+{
+    size_t at = line.find(" " + key + "=");
+    if (at == std::string::npos)
+    {
+        at = line.compare(0, key.size() + 1, key + "=") == 0 ? 0 : std::string::npos;
+    }
+    else
+    {
+        at++;
+    }
+    if (at == std::string::npos)
+    {
+        return "";
+    }
+    at += key.size() + 1;
+    return line.substr(at, line.find_first_of(" \n", at) - at);
+}
+
+// the lines of a lifetime profile that start with prefix
+static std::vector<std::string> lifetime_lines(const std::string &text, const std::string &prefix)
+{
+    std::vector<std::string> lines;
+    for (size_t at = 0; at < text.size();)
+    {
+        size_t end = text.find('\n', at);
+        std::string line = text.substr(at, end - at);
+        if (line.compare(0, prefix.size(), prefix) == 0)
+        {
+            lines.push_back(line);
+        }
+        at = end == std::string::npos ? text.size() : end + 1;
+    }
+    return lines;
+}
+
+TEST_CASE("sprofile off", "[malloc3]")
+{
+    long rate = -1;
+    REQUIRE(smallctl("profile_rate", &rate, nullptr) == 0);
+    REQUIRE(rate == 0);
+
+    void *a = smalloc(1000);
+    void *b = smalloc(200000);
+    profile_header header = dump_header();
+    REQUIRE(header.live_count == 0);
+    REQUIRE(header.alloc_count == 0);
+    sfree(a);
+    sfree(b);
+}
+
+TEST_CASE("sprofile every allocation", "[malloc3]")
+{
+    // at rate 1 every allocation is sampled
+    REQUIRE(sprofile(1) == 0);
+    void *a = smalloc(100);
+    void *b = scalloc(10, 100);
+    void *c = saligned_alloc(256, 300);
+    void *d = smalloc(200000);
+    void *e = sreserve(1000000);
+    profile_header header = dump_header();
+    REQUIRE(header.live_count == 4);
+    REQUIRE(header.live_bytes == 100 + 1000 + 300 + 200000);
+    REQUIRE(header.alloc_count == 4);
+    REQUIRE(header.rate == 1);
+
+    sfree(a);
+    sfree_sized(b, 1000);
+    sfree(d);
+    header = dump_header();
+    REQUIRE(header.live_count == 1);
+    REQUIRE(header.live_bytes == 300);
+    REQUIRE(header.alloc_count == 4);
+    REQUIRE(header.alloc_bytes == 100 + 1000 + 300 + 200000);
+
+    // stopping keeps the samples that are still live, and the rate they were taken at
+    REQUIRE(sprofile(0) == 0);
+    void *f = smalloc(100);
+    sfree(c);
+    sfree(e);
+    sfree(f);
+    std::string text = dump_text();
+    header = parse_header(text);
+    REQUIRE(header.live_count == 0);
+    REQUIRE(header.alloc_count == 4);
+    REQUIRE(header.rate == 1);
+    REQUIRE(text.find("] @ 0x") != std::string::npos);
+}
+
+TEST_CASE("sprofile srealloc", "[malloc3]")
+{
+    REQUIRE(sprofile(1) == 0);
+    void *p = smalloc(100);
+    void *q = srealloc(p, 200); // grows in place at the top of the heap
+    REQUIRE(q == p);
+    void *r = smalloc(100);
+    void *s = srealloc(q, 5000); // moved
+    REQUIRE(s != q);
+    profile_header header = dump_header();
+    REQUIRE(header.live_count == 2);
+    REQUIRE(header.live_bytes == 5000 + 100);
+    REQUIRE(header.alloc_count == 4);
+    REQUIRE(header.alloc_bytes == 100 + 200 + 100 + 5000);
+    sfree(r);
+    sfree_sized(s, 5000);
+    header = dump_header();
+    REQUIRE(header.live_count == 0);
+    REQUIRE(header.live_bytes == 0);
+}
+
+TEST_CASE("sprofile sexpand", "[malloc3]")
+{
+    REQUIRE(sprofile(1) == 0);
+    void *p = smalloc(100);
+    REQUIRE(sexpand(p, 200, 300) == 304); // the wilderness grows
+    profile_header header = dump_header();
+    REQUIRE(header.live_count == 1);
+    REQUIRE(header.live_bytes == 304);
+    REQUIRE(header.alloc_count == 2);
+    REQUIRE(header.alloc_bytes == 100 + 304);
+    sfree(p);
+    header = dump_header();
+    REQUIRE(header.live_count == 0);
+    REQUIRE(header.live_bytes == 0);
+    REQUIRE(sprofile(0) == 0);
+}
+
+TEST_CASE("sprofile_retained", "[malloc3]")
+{
+    REQUIRE(sprofile(1) == 0);
+    void *small[50], *large[3];
+    for (void *&block : small)
+    {
+        block = small_site();
+    }
+    for (void *&block : large)
+    {
+        block = large_site();
+    }
+    for (int i = 0; i < 10; i++)
+    {
+        sfree(small[i]);
+    }
+
+    char path[] = "/tmp/smalloc_retained_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    unlink(path);
+    REQUIRE(sprofile_retained(fd, 5) == 0);
+    std::string text = read_file(fd);
+    close(fd);
+    INFO(text);
+    size_t blocks = 0, bytes = 0;
+    retained_site by_bytes, by_blocks;
+    parse_retained(text, blocks, bytes, by_bytes, by_blocks);
+    REQUIRE(blocks == 40 + 3);
+    REQUIRE(bytes == 40 * 100 + 3 * 200000);
+    REQUIRE(by_bytes.bytes == 3 * 200000);
+    REQUIRE(by_bytes.blocks == 3);
+    REQUIRE(by_blocks.bytes == 40 * 100);
+    REQUIRE(by_blocks.blocks == 40);
+    REQUIRE(by_bytes.site != by_blocks.site);
+
+    for (int i = 10; i < 50; i++)
+    {
+        sfree(small[i]);
+    }
+    for (void *block : large)
+    {
+        sfree(block);
+    }
+    REQUIRE(sprofile(0) == 0);
+}
+
+TEST_CASE("sprofile_lifetimes", "[malloc3]")
+{
+    REQUIRE(sprofile(1) == 0);
+    void *kept[20];
+    for (void *&block : kept)
+    {
+        block = kept_site();
+    }
+    for (int i = 0; i < 100; i++)
+    {
+        sfree(small_site()); // dies before the next allocation
+    }
+    void *mixed[40];
+    for (void *&block : mixed)
+    {
+        block = large_site();
+    }
+    for (int i = 0; i < 20; i++)
+    {
+        sfree(mixed[i]);
+    }
+
+    char path[] = "/tmp/smalloc_lifetimes_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    unlink(path);
+    REQUIRE(sprofile_lifetimes(fd) == 0);
+    std::string text = read_file(fd);
+    close(fd);
+    INFO(text);
+    REQUIRE(text.compare(0, 17, "lifetimes rate=1 ") == 0);
+    REQUIRE(field(text.substr(0, text.find('\n')), "allocations") == "160");
+    REQUIRE(text.find("\nMAPPED_LIBRARIES:\n") != std::string::npos);
+
+    std::vector<std::string> sites = lifetime_lines(text, "site=");
+    REQUIRE(sites.size() == 3);
+    int seen = 0;
+    for (const std::string &site : sites)
+    {
+        REQUIRE(field(site, "site").size() == 16);
+        REQUIRE(field(site, "stack").compare(0, 2, "0x") == 0);
+        if (field(site, "sampled") == "100")
+        {
+            REQUIRE(field(site, "freed") == "100");
+            REQUIRE(field(site, "class") == "short");
+            REQUIRE(field(site, "allocs") == "1:100");
+            REQUIRE(field(site, "allocs_p90") == "1");
+            seen |= 1;
+        }
+        else if (field(site, "sampled") == "20")
+        {
+            REQUIRE(field(site, "live") == "20");
+            REQUIRE(field(site, "class") == "immortal");
+            REQUIRE(field(site, "allocs") == "");
+            seen |= 2;
+        }
+        else
+        {
+            // the first 20 of 40 lived 39 down to 20 allocations
+            REQUIRE(field(site, "sampled") == "40");
+            REQUIRE(field(site, "freed") == "20");
+            REQUIRE(field(site, "class") == "-");
+            REQUIRE(field(site, "allocs") == "32:12,64:8");
+            REQUIRE(field(site, "ns").find(':') != std::string::npos);
+            seen |= 4;
+        }
+    }
+    REQUIRE(seen == 7);
+
+    std::vector<std::string> sizes = lifetime_lines(text, "size=");
+    REQUIRE(sizes.size() == 3);
+    REQUIRE(field(sizes[0], "size") == "128");
+    REQUIRE(field(sizes[0], "class") == "short");
+    REQUIRE(field(sizes[1], "size") == "4096");
+    REQUIRE(field(sizes[1], "class") == "immortal");
+    REQUIRE(field(sizes[2], "size") == "262144");
+    REQUIRE(field(sizes[2], "stack") == "");
+
+    for (void *block : kept)
+    {
+        sfree(block);
+    }
+    for (int i = 20; i < 40; i++)
+    {
+        sfree(mixed[i]);
+    }
+    REQUIRE(sprofile(0) == 0);
+}
+
+TEST_CASE("sprofile table grows", "[malloc3]")
+{
+    // more live samples than the table first has room for
+    const int count = 100000;
+    static void *blocks[count];
+    REQUIRE(sprofile(1) == 0);
+    for (int i = 0; i < count; i++)
+    {
+        blocks[i] = smalloc(16);
+    }
+    profile_header header = dump_header();
+    REQUIRE(header.live_count == count);
+    for (int i = 0; i < count / 2; i++)
+    {
+        sfree(blocks[i]);
+    }
+    header = dump_header();
+    REQUIRE(header.live_count == count / 2);
+    REQUIRE(header.live_bytes == 16 * count / 2);
+    for (int i = count / 2; i < count; i++)
+    {
+        sfree(blocks[i]);
+    }
+    REQUIRE(dump_header().live_count == 0);
+}
+
+TEST_CASE("sprofile geometric sampling", "[malloc3]")
+{
+    // 6.4MB in 64 byte blocks at one sample per 4KB: 1562 samples on average
+    const int count = 100000;
+    static void *blocks[count];
+    REQUIRE(sprofile(4096) == 0);
+    for (int i = 0; i < count; i++)
+    {
+        blocks[i] = smalloc(64);
+        REQUIRE(blocks[i] != nullptr);
+    }
+    profile_header header = dump_header();
+    REQUIRE(header.live_count == header.alloc_count);
+    REQUIRE(header.live_bytes == 64 * header.live_count);
+    REQUIRE(header.alloc_count > 1350);
+    REQUIRE(header.alloc_count < 1800);
+    for (int i = 0; i < count; i++)
+    {
+        sfree(blocks[i]);
+    }
+    header = dump_header();
+    REQUIRE(header.live_count == 0);
+    REQUIRE(header.alloc_count > 1350);
+}
+
+TEST_CASE("smallctl profile_rate", "[malloc3]")
+{
+    long rate = 65536;
+    long old = -1;
+    REQUIRE(smallctl("profile_rate", &old, &rate) == 0);
+    REQUIRE(old == 0);
+    REQUIRE(smallctl("profile_rate", &old, nullptr) == 0);
+    REQUIRE(old == 65536);
+
+    rate = -1;
+    REQUIRE(smallctl("profile_rate", nullptr, &rate) == EINVAL);
+    REQUIRE(sprofile((size_t)1 << 40) == -1);
+    REQUIRE(smallopt(SM_PROFILE_RATE, 0) == 1);
+    REQUIRE(smallctl("profile_rate", &old, nullptr) == 0);
+    REQUIRE(old == 0);
+}
+
+// run with SMALLOC_PROFILE set, see CMakeLists.txt
+TEST_CASE("sprofile at exit", "[.][smalloc_profile]")
+{
+    const char *path = getenv("SMALLOC_PROFILE");
+    REQUIRE(path != nullptr);
+    long rate = 0;
+    REQUIRE(smallctl("profile_rate", &rate, nullptr) == 0);
+    REQUIRE(rate == PROFILE_DEFAULT_RATE);
+
+    unlink(path);
+    pid_t child = fork();
+    REQUIRE(child != -1);
+    if (child == 0)
+    {
+        sprofile(1);
+        smalloc(1000);
+        smalloc(2000);
+        exit(0); // the profile is written by the engine's destructor
+    }
+    int status;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    FILE *file = fopen(path, "r");
+    REQUIRE(file != nullptr);
+    profile_header header;
+    REQUIRE(fscanf(file, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu", &header.live_count,
+                   &header.live_bytes, &header.alloc_count, &header.alloc_bytes, &header.rate) == 5);
+    fclose(file);
+    REQUIRE(header.live_count == 2);
+    REQUIRE(header.live_bytes == 3000);
+    REQUIRE(header.rate == 1);
+    unlink(path);
+}
+
+// run with SMALLOC_RETAIN and SMALLOC_RETAIN_SIGNAL=SIGUSR1, see CMakeLists.txt
+TEST_CASE("sprofile_retained at exit and on a signal", "[.][smalloc_retain]")
+{
+    const char *path = getenv("SMALLOC_RETAIN");
+    REQUIRE(path != nullptr);
+    long rate = 0;
+    REQUIRE(smallctl("profile_rate", &rate, nullptr) == 0);
+    REQUIRE(rate == 1);
+
+    unlink(path);
+    void *block = small_site();
+    REQUIRE(raise(SIGUSR1) == 0);
+    REQUIRE(access(path, F_OK) != 0); // written by the next call
+    sfree(smalloc(10));
+    FILE *file = fopen(path, "r");
+    REQUIRE(file != nullptr);
+    size_t blocks = 0, bytes = 0;
+    REQUIRE(fscanf(file, "retained: %zu blocks, %zu bytes", &blocks, &bytes) == 2);
+    fclose(file);
+    REQUIRE(blocks >= 1);
+    REQUIRE(bytes >= 100);
+    sfree(block);
+
+    unlink(path);
+    pid_t child = fork();
+    REQUIRE(child != -1);
+    if (child == 0)
+    {
+        for (int i = 0; i < 7; i++)
+        {
+            small_site();
+        }
+        exit(0); // the report is written by the engine's destructor
+    }
+    int status;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    file = fopen(path, "r");
+    REQUIRE(file != nullptr);
+    std::string text;
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        text += line;
+    }
+    fclose(file);
+    INFO(text);
+    retained_site by_bytes, by_blocks;
+    parse_retained(text, blocks, bytes, by_bytes, by_blocks);
+    REQUIRE(by_blocks.blocks >= 7);
+    REQUIRE(by_blocks.bytes >= 700);
+    unlink(path);
+}
+
+// run with SMALLOC_LIFETIME set, see CMakeLists.txt
+TEST_CASE("sprofile_lifetimes at exit", "[.][smalloc_lifetime]")
+{
+    const char *path = getenv("SMALLOC_LIFETIME");
+    REQUIRE(path != nullptr);
+    long rate = 0;
+    REQUIRE(smallctl("profile_rate", &rate, nullptr) == 0);
+    REQUIRE(rate == PROFILE_DEFAULT_RATE);
+
+    unlink(path);
+    pid_t child = fork();
+    REQUIRE(child != -1);
+    if (child == 0)
+    {
+        sprofile(1);
+        for (int i = 0; i < 30; i++)
+        {
+            sfree(small_site());
+        }
+        exit(0); // the profile is written by the engine's destructor
+    }
+    int status;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    FILE *file = fopen(path, "r");
+    REQUIRE(file != nullptr);
+    std::string text;
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        text += line;
+    }
+    fclose(file);
+    INFO(text);
+    REQUIRE(text.compare(0, 17, "lifetimes rate=1 ") == 0);
+    std::vector<std::string> sizes = lifetime_lines(text, "size=128 ");
+    REQUIRE(sizes.size() == 1);
+    REQUIRE(field(sizes[0], "freed") == "30");
+    REQUIRE(field(sizes[0], "class") == "short");
+    unlink(path);
+}
@@ -0,0 +1,186 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define MIN_SPLIT_SIZE (128)
+#define PURGE_TICK_OPS (64)
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+#define verify_size(base)                                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(_num_allocated_bytes() + aligned_size(_size_meta_data() * _num_allocated_blocks()) ==                  \
+                (size_t)after - (size_t)base);                                                                         \
+    } while (0)
+
+// number of resident pages among the whole pages inside [p, p + size)
+static size_t resident_pages(void *p, size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t first = ((size_t)p + page_size - 1) & ~(page_size - 1);
+    size_t last = ((size_t)p + size) & ~(page_size - 1);
+    unsigned char vec[256];
+    REQUIRE((last - first) / page_size <= sizeof(vec));
+    REQUIRE(mincore((void *)first, last - first, vec) == 0);
+    size_t resident = 0;
+    for (size_t i = 0; i < (last - first) / page_size; i++)
+    {
+        resident += vec[i] & 1;
+    }
+    return resident;
+}
+
+TEST_CASE("purge free block", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    const size_t size = 100000;
+
+    char *a = (char *)smalloc(16);
+    char *b = (char *)smalloc(size);
+    char *c = (char *)smalloc(16);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(c != nullptr);
+    memset(b, 'b', size);
+    REQUIRE(resident_pages(b, size) > 0);
+
+    sfree(b);
+    verify_blocks(3, 16 + size + 16, 1, size);
+    REQUIRE(_num_purged_bytes() == 0);
+    REQUIRE(_num_dirty_bytes() == size);
+
+    size_t purged = spurge();
+    REQUIRE(purged >= size - 2 * sysconf(_SC_PAGESIZE));
+    REQUIRE(_num_purged_bytes() == purged);
+    REQUIRE(_num_dirty_bytes() == size - purged);
+    REQUIRE(resident_pages(b, size) == 0);
+    verify_blocks(3, 16 + size + 16, 1, size);
+    verify_size(base);
+
+    // purging again finds nothing new
+    REQUIRE(spurge() == 0);
+
+    char *d = (char *)smalloc(size);
+    REQUIRE(d == b);
+    REQUIRE(_num_purged_bytes() == 0);
+    memset(d, 'd', size);
+    for (size_t i = 0; i < size; i++)
+    {
+        REQUIRE(d[i] == 'd');
+    }
+    verify_blocks(3, 16 + size + 16, 0, 0);
+    verify_size(base);
+
+    sfree(a);
+    sfree(c);
+    sfree(d);
+}
+
+TEST_CASE("purge merge", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    const size_t size = 100000;
+
+    char *a = (char *)smalloc(16);
+    char *b = (char *)smalloc(size);
+    char *c = (char *)smalloc(16);
+    char *d = (char *)smalloc(16);
+    REQUIRE(d != nullptr);
+    sfree(b);
+    size_t purged = spurge();
+    REQUIRE(purged > 0);
+
+    // a merged block keeps the pages that were purged, only the new ones are dirty
+    sfree(c);
+    verify_blocks(3, 16 + size + _size_meta_data() + 16 + 16, 1, size + _size_meta_data() + 16);
+    REQUIRE(_num_purged_bytes() == purged);
+    REQUIRE(_num_dirty_bytes() == aligned_size(size + _size_meta_data() + 16) - purged);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t more = spurge();
+    REQUIRE(more <= page_size); // at most the page c completed
+    REQUIRE(_num_purged_bytes() == purged + more);
+    REQUIRE(spurge() == 0);
+    verify_size(base);
+
+    sfree(a);
+    REQUIRE(_num_purged_bytes() == purged + more);
+    // the rest of a purged block that is split stays purged
+    char *e = (char *)smalloc(16);
+    REQUIRE(e == a);
+    REQUIRE(_num_purged_bytes() >= purged + more - 2 * page_size);
+    sfree(e);
+    sfree(d);
+    verify_size(base);
+}
+
+TEST_CASE("purge decay", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    const size_t size = 100000;
+    REQUIRE(smallopt(SM_DECAY_MS, 0) == 1);
+
+    char *a = (char *)smalloc(16);
+    char *b = (char *)smalloc(size);
+    char *c = (char *)smalloc(16);
+    REQUIRE(c != nullptr);
+    memset(b, 'b', size);
+    sfree(b);
+
+    // purging is amortized over allocator calls, mmap blocks leave the heap alone
+    for (int i = 0; i < PURGE_TICK_OPS; i++)
+    {
+        sfree(smalloc(MMAP_THRESHOLD));
+    }
+    REQUIRE(_num_purged_bytes() > 0);
+    REQUIRE(resident_pages(b, size) == 0);
+
+    sfree(a);
+    sfree(c);
+}
+
+TEST_CASE("purge disabled", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    const size_t size = 100000;
+    REQUIRE(smallopt(SM_DECAY_MS, -1) == 1);
+    REQUIRE(smallopt(SM_PURGE_ADVICE, MADV_FREE) == 1);
+    REQUIRE(smallopt(SM_PURGE_ADVICE, MADV_WILLNEED) == 0);
+    REQUIRE(smallopt(0, 0) == 0);
+
+    char *a = (char *)smalloc(16);
+    char *b = (char *)smalloc(size);
+    char *c = (char *)smalloc(16);
+    REQUIRE(c != nullptr);
+    sfree(b);
+    for (int i = 0; i < 2 * PURGE_TICK_OPS; i++)
+    {
+        sfree(smalloc(MMAP_THRESHOLD));
+    }
+    REQUIRE(_num_purged_bytes() == 0);
+    REQUIRE(_num_dirty_bytes() == size);
+
+    sfree(a);
+    sfree(c);
+}
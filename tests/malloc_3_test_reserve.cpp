@@ -0,0 +1,118 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define MIN_SPLIT_SIZE (128)
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+#define verify_size(base)                                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(_num_allocated_bytes() + aligned_size(_size_meta_data() * _num_allocated_blocks()) ==                  \
+                (size_t)after - (size_t)base);                                                                         \
+    } while (0)
+
+
+#define verify_size_with_large_blocks(base, diff)                                                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(diff == (size_t)after - (size_t)base);                                                                 \
+    } while (0)
+
+TEST_CASE("sreserve", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    const size_t max_size = 10 * 1024 * 1024;
+
+    char *a = (char *)sreserve(max_size);
+    REQUIRE(a != nullptr);
+    REQUIRE(_num_reserved_bytes() >= max_size);
+    verify_blocks(1, 0, 0, 0);
+    verify_size_with_large_blocks(base, 0);
+
+    REQUIRE(scommit(a, 100) == a);
+    memset(a, 'a', 100);
+    verify_blocks(1, 100, 0, 0);
+
+    // growing never moves the buffer
+    REQUIRE(scommit(a, 5 * 1024 * 1024) == a);
+    memset(a + 100, 'b', 5 * 1024 * 1024 - 100);
+    for (size_t i = 0; i < 100; i++)
+    {
+        REQUIRE(a[i] == 'a');
+    }
+    verify_blocks(1, 5 * 1024 * 1024, 0, 0);
+
+    REQUIRE(scommit(a, max_size) == a);
+    a[max_size - 1] = 'c';
+    REQUIRE(scommit(a, _num_reserved_bytes()) == nullptr);
+    verify_blocks(1, max_size, 0, 0);
+
+    REQUIRE(scommit(a, 1000) == a);
+    REQUIRE(a[999] == 'b');
+    verify_blocks(1, 1000, 0, 0);
+    verify_size_with_large_blocks(base, 0);
+
+    sfree(a);
+    REQUIRE(_num_reserved_bytes() == 0);
+    verify_blocks(0, 0, 0, 0);
+}
+
+TEST_CASE("sreserve invalid", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(sreserve(0) == nullptr);
+    REQUIRE(sreserve(MAX_ALLOCATION_SIZE + 1) == nullptr);
+    REQUIRE(scommit(nullptr, 10) == nullptr);
+
+    char *a = (char *)smalloc(10);
+    REQUIRE(scommit(a, 20) == nullptr);
+    verify_blocks(1, 10, 0, 0);
+    sfree(a);
+}
+
+TEST_CASE("sreserve srealloc", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    char *a = (char *)sreserve(1024 * 1024);
+    REQUIRE(a != nullptr);
+
+    char *b = (char *)srealloc(a, 512 * 1024);
+    REQUIRE(b == a);
+    memset(b, 'b', 512 * 1024);
+    verify_blocks(1, 512 * 1024, 0, 0);
+
+    // past the reservation the block is moved to a regular one
+    char *c = (char *)srealloc(b, 2 * 1024 * 1024);
+    REQUIRE(c != nullptr);
+    REQUIRE(c != b);
+    for (size_t i = 0; i < 512 * 1024; i++)
+    {
+        REQUIRE(c[i] == 'b');
+    }
+    REQUIRE(_num_reserved_bytes() == 0);
+    verify_blocks(1, 2 * 1024 * 1024, 0, 0);
+    sfree(c);
+}
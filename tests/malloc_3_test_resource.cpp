@@ -0,0 +1,122 @@
+#include "my_stdlib.h"
+#include "my_memory_resource.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <string.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <map>
+#include <memory_resource>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define MIN_SPLIT_SIZE (128)
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+#define verify_size(base)                                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(_num_allocated_bytes() + aligned_size(_size_meta_data() * _num_allocated_blocks()) ==                  \
+                (size_t)after - (size_t)base);                                                                         \
+    } while (0)
+
+struct alignas(64) Wide
+{
+    char data[100];
+};
+
+static size_t used_blocks()
+{
+    return _num_allocated_blocks() - _num_free_blocks();
+}
+
+TEST_CASE("pmr resource", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    std::pmr::memory_resource *resource = smalloc_resource();
+
+    // pmr asks for max_align_t alignment by default
+    void *p = resource->allocate(100);
+    REQUIRE((size_t)p % alignof(std::max_align_t) == 0);
+    REQUIRE(used_blocks() == 1);
+    void *q = resource->allocate(200, 64);
+    REQUIRE((size_t)q % 64 == 0);
+    resource->deallocate(q, 200, 64);
+    resource->deallocate(p, 100);
+    REQUIRE(used_blocks() == 0);
+
+    REQUIRE(resource->is_equal(*smalloc_resource()));
+    REQUIRE(!resource->is_equal(*std::pmr::new_delete_resource()));
+    REQUIRE_THROWS_AS(resource->allocate((size_t)MAX_ALLOCATION_SIZE + 1), std::bad_alloc);
+
+    {
+        std::pmr::vector<int> v(resource);
+        for (int i = 0; i < 1000; i++)
+        {
+            v.push_back(i);
+        }
+        REQUIRE(used_blocks() == 1);
+        std::pmr::map<int, int> m(resource);
+        for (int i = 0; i < 100; i++)
+        {
+            m[i] = i;
+        }
+        REQUIRE(used_blocks() == 101);
+    }
+    REQUIRE(used_blocks() == 0);
+}
+
+TEST_CASE("allocator", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    {
+        std::vector<int, SmallocAllocator<int>> v;
+        v.reserve(1000);
+        verify_blocks(1, 4000, 0, 0);
+        v.resize(MMAP_THRESHOLD);
+        verify_blocks(2, 4000 + 4 * MMAP_THRESHOLD, 1, 4000);
+
+        std::map<int, int, std::less<int>, SmallocAllocator<std::pair<const int, int>>> m;
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                           SmallocAllocator<std::pair<const int, int>>> u;
+        for (int i = 0; i < 100; i++)
+        {
+            m[i] = i;
+            u[i] = i;
+        }
+        REQUIRE(m.size() == 100);
+        REQUIRE(u.size() == 100);
+        m.clear();
+        u.clear();
+        REQUIRE(used_blocks() == 2); // v and the buckets of u
+
+        std::vector<Wide, SmallocAllocator<Wide>> w(10);
+        REQUIRE((size_t)w.data() % 64 == 0);
+    }
+    REQUIRE(used_blocks() == 0);
+
+    SmallocAllocator<int> ints;
+    SmallocAllocator<char> chars(ints);
+    REQUIRE(ints == chars);
+    REQUIRE_THROWS_AS(ints.allocate((size_t)MAX_ALLOCATION_SIZE), std::bad_alloc);
+    REQUIRE_THROWS_AS(ints.allocate((size_t)-1), std::bad_array_new_length);
+}
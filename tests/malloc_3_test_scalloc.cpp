@@ -1,6 +1,8 @@
 #include "my_stdlib.h"
 #include <catch2/catch_test_macros.hpp>
 
+#include <string.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
 #define MAX_ALLOCATION_SIZE (1e8)
@@ -110,6 +112,64 @@ TEST_CASE("scalloc taint", "[malloc3]")
     verify_size(base);
 }
 
+static long minor_faults()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+TEST_CASE("scalloc mmap no clear", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    const size_t size = 1024 * 1024;
+    const long pages = size / sysconf(_SC_PAGESIZE);
+
+    long faults_before = minor_faults();
+    char *a = (char *)scalloc(size, 1);
+    long faults = minor_faults() - faults_before;
+    REQUIRE(a != nullptr);
+    REQUIRE(faults < pages / 4);
+    for (size_t i = 0; i < size; i++)
+    {
+        REQUIRE(a[i] == 0);
+    }
+    verify_blocks(1, size, 0, 0);
+    verify_size_with_large_blocks(base, 0);
+
+    sfree(a);
+    verify_blocks(0, 0, 0, 0);
+}
+
+TEST_CASE("scalloc wilderness taint", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(16);
+    REQUIRE(a != nullptr);
+    char *b = (char *)smalloc(100);
+    REQUIRE(b != nullptr);
+    memset(b, 'b', 100);
+    sfree(b);
+    verify_blocks(2, 16 + 100, 1, 100);
+    verify_size(base);
+
+    char *c = (char *)scalloc(50000, 1);
+    REQUIRE(c == b);
+    for (size_t i = 0; i < 50000; i++)
+    {
+        REQUIRE(c[i] == 0);
+    }
+    verify_blocks(2, 16 + 50000, 0, 0);
+    verify_size(base);
+
+    sfree(a);
+    sfree(c);
+    verify_size(base);
+}
+
 TEST_CASE("scalloc 0 size", "[malloc3]")
 {
     verify_blocks(0, 0, 0, 0);
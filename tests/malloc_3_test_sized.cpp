@@ -0,0 +1,151 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define MIN_SPLIT_SIZE (128)
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+#define verify_size(base)                                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(_num_allocated_bytes() + aligned_size(_size_meta_data() * _num_allocated_blocks()) ==                  \
+                (size_t)after - (size_t)base);                                                                         \
+    } while (0)
+
+#define verify_size_with_large_blocks(base, diff)                                                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(diff == (size_t)after - (size_t)base);                                                                 \
+    } while (0)
+
+TEST_CASE("smalloc_usable_size", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(smalloc_usable_size(nullptr) == 0);
+
+    char *a = (char *)smalloc(10);
+    REQUIRE(smalloc_usable_size(a) == 16);
+    char *b = (char *)smalloc(MMAP_THRESHOLD + 100);
+    REQUIRE(smalloc_usable_size(b) == MMAP_THRESHOLD + 104);
+
+    // too little is left over to split, the whole block is usable
+    char *c = (char *)smalloc(1000);
+    char *guard = (char *)smalloc(10);
+    sfree(c);
+    char *d = (char *)smalloc(900);
+    REQUIRE(d == c);
+    REQUIRE(smalloc_usable_size(d) == 1000);
+    memset(d, 'd', 1000);
+
+    sfree(a);
+    sfree(b);
+    sfree(d);
+    sfree(guard);
+}
+
+TEST_CASE("sfree_sized heap", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(100);
+    verify_blocks(2, 208, 0, 0);
+    sfree_sized(a, 100);
+    verify_blocks(2, 208, 1, 104);
+    sfree_sized(b, 100);
+    verify_blocks(1, 208 + _size_meta_data(), 1, 208 + _size_meta_data());
+    verify_size(base);
+
+    // a block with slack is freed with the size it was asked for
+    char *c = (char *)smalloc(200);
+    REQUIRE(c == a);
+    sfree_sized(c, 200);
+    verify_blocks(1, 208 + _size_meta_data(), 1, 208 + _size_meta_data());
+    sfree_sized(nullptr, 10);
+}
+
+TEST_CASE("sfree_sized mapped", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+
+    char *a = (char *)smalloc(MMAP_THRESHOLD + 100);
+    verify_blocks(1, MMAP_THRESHOLD + 100, 0, 0);
+    sfree_sized(a, MMAP_THRESHOLD + 100);
+    verify_blocks(0, 0, 0, 0);
+
+    REQUIRE(smallopt(SM_HUGEPAGE_FILLER, 1) == 1);
+    char *b = (char *)smalloc(10000);
+    REQUIRE(_num_filler_used_pages() > 0);
+    sfree_sized(b, 10000);
+    REQUIRE(_num_filler_used_pages() == 0);
+
+    char *c = (char *)sreserve(1024 * 1024);
+    REQUIRE(scommit(c, 5000) == c);
+    sfree_sized(c, 5000);
+    verify_blocks(0, 0, 0, 0);
+
+    // as large as a mapped block, but still released as a reservation
+    char *d = (char *)sreserve(1024 * 1024);
+    REQUIRE(scommit(d, MMAP_THRESHOLD + 100) == d);
+    sfree_sized(d, MMAP_THRESHOLD + 100);
+    verify_blocks(0, 0, 0, 0);
+    verify_size_with_large_blocks(base, 0);
+}
+
+#ifdef SMALLOC_CHECK_SIZES
+TEST_CASE("sfree_sized wrong size", "[malloc3]")
+{
+    char *a = (char *)smalloc(MMAP_THRESHOLD + 100);
+    char *b = (char *)smalloc(100);
+
+    pid_t child = fork();
+    REQUIRE(child != -1);
+    if (child == 0)
+    {
+        sfree_sized(a, 100); // not the size of a
+        _exit(0);
+    }
+    int status;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFSIGNALED(status));
+    REQUIRE(WTERMSIG(status) == SIGABRT);
+
+    child = fork();
+    REQUIRE(child != -1);
+    if (child == 0)
+    {
+        sfree_sized(b, 1000);
+        _exit(0);
+    }
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFSIGNALED(status));
+    REQUIRE(WTERMSIG(status) == SIGABRT);
+
+    sfree_sized(a, MMAP_THRESHOLD + 100);
+    sfree_sized(b, 100);
+}
+#endif
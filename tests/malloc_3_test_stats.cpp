@@ -0,0 +1,171 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+#define PURGE_TICK_OPS (64)
+#define STATS_INTERVAL_MS (100)
+
+static std::string page_path(pid_t pid)
+{
+    return "/dev/shm/smalloc." + std::to_string(pid);
+}
+
+static const sstats_page *attach()
+{
+    int fd = open(page_path(getpid()).c_str(), O_RDONLY);
+    REQUIRE(fd >= 0);
+    void *mapping = mmap(nullptr, sizeof(sstats_page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    REQUIRE(mapping != MAP_FAILED);
+    return (const sstats_page *)mapping;
+}
+
+// what the page had between two updates
+static sstats_page snapshot(const sstats_page *page)
+{
+    sstats_page copy;
+    uint64_t seq;
+    do
+    {
+        seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        memcpy(&copy, page, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (seq % 2 != 0 || __atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq);
+    return copy;
+}
+
+// enough calls for the engine to look at the clock after the interval
+static void next_update()
+{
+    usleep((STATS_INTERVAL_MS + 20) * 1000);
+    for (int i = 0; i < PURGE_TICK_OPS; i++)
+    {
+        sfree(smalloc(8));
+    }
+}
+
+TEST_CASE("sstats_publish", "[malloc3]")
+{
+    REQUIRE(sstats_publish(0) == -1);
+    REQUIRE(access(page_path(getpid()).c_str(), F_OK) != 0);
+    REQUIRE(sstats_publish(1) == 0);
+    REQUIRE(sstats_publish(1) == -1);
+    const sstats_page *page = attach();
+
+    sstats_page first = snapshot(page);
+    REQUIRE(memcmp(first.magic, SSTATS_MAGIC, 8) == 0);
+    REQUIRE(first.size == sizeof(sstats_page));
+    REQUIRE(first.pid == getpid());
+    REQUIRE(first.seq % 2 == 0);
+    REQUIRE(first.heap_blocks == 0);
+    REQUIRE(first.latency_built_in == 0);
+
+    void *blocks[10];
+    for (void *&block : blocks)
+    {
+        block = smalloc(1000);
+    }
+    void *mapped = smalloc(1 << 20);
+    next_update();
+    sstats_page second = snapshot(page);
+    REQUIRE(second.seq > first.seq);
+    REQUIRE(second.time_ns > first.time_ns);
+    REQUIRE(second.calls > first.calls + 11);
+    REQUIRE(second.calls % PURGE_TICK_OPS == 0); // updates are looked at every PURGE_TICK_OPS calls
+    REQUIRE(second.info.mmap_blocks == 1);
+    REQUIRE(second.info.mmap_bytes >= 1 << 20);
+    REQUIRE(second.info.sbrk_calls > 0);
+    // the ten blocks and the one the loop keeps taking and freeing
+    REQUIRE(second.heap_blocks == 11);
+    REQUIRE(second.heap_blocks + second.info.mmap_blocks == _num_allocated_blocks());
+    REQUIRE(second.frag.free_blocks <= 1);
+
+    // no update before the interval is over
+    for (int i = 0; i < 2 * PURGE_TICK_OPS; i++)
+    {
+        sfree(smalloc(8));
+    }
+    REQUIRE(snapshot(page).seq == second.seq);
+
+    sfree(mapped);
+    for (void *block : blocks)
+    {
+        sfree(block);
+    }
+    REQUIRE(sstats_publish(0) == 0);
+    REQUIRE(access(page_path(getpid()).c_str(), F_OK) != 0);
+    // the old mapping stays readable, it is just not updated any more
+    REQUIRE(snapshot(page).pid == getpid());
+    munmap((void *)page, sizeof(sstats_page));
+}
+
+TEST_CASE("sstats_publish fork", "[malloc3]")
+{
+    REQUIRE(sstats_publish(1) == 0);
+    const sstats_page *page = attach();
+    uint64_t seq = snapshot(page).seq;
+    pid_t child = fork();
+    if (child == 0)
+    {
+        // the child stopped writing to its parent's page, and may publish its own
+        next_update();
+        int status = sstats_publish(0) == -1 && sstats_publish(1) == 0 &&
+                             access(page_path(getpid()).c_str(), F_OK) == 0 && sstats_publish(0) == 0
+                         ? 0
+                         : 1;
+        _exit(status);
+    }
+    int status = 0;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+    REQUIRE(snapshot(page).seq == seq);
+    REQUIRE(snapshot(page).pid == getpid());
+    REQUIRE(sstats_publish(0) == 0);
+    munmap((void *)page, sizeof(sstats_page));
+}
+
+// smalloc_top on this process, see CMakeLists.txt
+TEST_CASE("smalloc_top", "[.][smalloc_top]")
+{
+    const char *tool = getenv("SMALLOC_TOP");
+    REQUIRE(tool != nullptr);
+    REQUIRE(sstats_publish(1) == 0);
+    void *block = smalloc(5000);
+    next_update();
+    std::string command = std::string(tool) + " " + std::to_string(getpid()) + " 10 1";
+    FILE *output = popen(command.c_str(), "r");
+    REQUIRE(output != nullptr);
+    std::string text;
+    char line[256];
+    while (fgets(line, sizeof(line), output) != nullptr)
+    {
+        text += line;
+    }
+    REQUIRE(pclose(output) == 0);
+    INFO(text);
+    REQUIRE(text.find("pid " + std::to_string(getpid())) != std::string::npos);
+    REQUIRE(text.find("sbrk calls") != std::string::npos);
+    REQUIRE(text.find("latencies are not built in") != std::string::npos);
+
+    output = popen(tool, "r");
+    REQUIRE(output != nullptr);
+    text.clear();
+    while (fgets(line, sizeof(line), output) != nullptr)
+    {
+        text += line;
+    }
+    REQUIRE(pclose(output) == 0);
+    REQUIRE(text.find(std::to_string(getpid())) != std::string::npos);
+    sfree(block);
+    REQUIRE(sstats_publish(0) == 0);
+}
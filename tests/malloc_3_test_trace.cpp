@@ -0,0 +1,326 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct trace_event
+{
+    uint64_t thread;
+    int op;
+    uint64_t time;
+    uint64_t size;
+    uint64_t alignment;
+    uint64_t old_id;
+    uint64_t new_id;
+    uint64_t usable; // SR_EXPAND
+};
+
+static uint64_t varint(const std::string &data, size_t &at)
+{
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        REQUIRE(at < data.size());
+        unsigned char byte = data[at++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            return value;
+        }
+    }
+}
+
+static uint64_t id(const std::string &data, size_t &at, uint64_t &last)
+{
+    uint64_t zigzag = varint(data, at);
+    last += (zigzag >> 1) ^ -(zigzag & 1);
+    return last;
+}
+
+// decodes a whole trace, events grouped by chunk
+static std::vector<trace_event> read_trace(const char *path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    REQUIRE(data.size() >= 16);
+    REQUIRE(data.compare(0, 8, SMALLOC_TRACE_MAGIC) == 0);
+    std::vector<trace_event> events;
+    uint64_t last_time[SRECORD_THREADS] = {}, last_id[SRECORD_THREADS] = {};
+    size_t at = 16;
+    while (at < data.size())
+    {
+        uint64_t thread = varint(data, at);
+        uint64_t count = varint(data, at);
+        REQUIRE(thread < SRECORD_THREADS);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            trace_event event = {thread, data[at++], 0, 0, 0, 0, 0, 0};
+            event.time = last_time[thread] += varint(data, at);
+            if (event.op != SR_FREE)
+            {
+                event.size = varint(data, at);
+            }
+            if (event.op == SR_ALIGNED_ALLOC)
+            {
+                event.alignment = varint(data, at);
+            }
+            else if (event.op == SR_REALLOC || event.op == SR_FREE || event.op == SR_EXPAND || event.op == SR_COMMIT)
+            {
+                event.old_id = id(data, at, last_id[thread]);
+            }
+            if (event.op == SR_EXPAND)
+            {
+                event.usable = varint(data, at);
+            }
+            else if (event.op != SR_FREE)
+            {
+                event.new_id = id(data, at, last_id[thread]);
+            }
+            events.push_back(event);
+        }
+    }
+    return events;
+}
+
+static std::string trace_path()
+{
+    char path[] = "/tmp/smalloc_trace_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    return path;
+}
+
+TEST_CASE("srecord calls", "[malloc3]")
+{
+    std::string path = trace_path();
+    REQUIRE(srecord_stop() == -1);
+    REQUIRE(srecord_start("/nonexistent/trace") == -1);
+    REQUIRE(srecord_start("/dev/full") == -1); // the header does not fit
+    REQUIRE(srecord_stop() == -1);
+    void *before = smalloc(10);
+    REQUIRE(srecord_start(path.c_str()) == 0);
+    REQUIRE(srecord_start(path.c_str()) == -1);
+
+    char *a = (char *)smalloc(100);
+    char *b = (char *)scalloc(10, 30);
+    char *c = (char *)saligned_alloc(64, 200);
+    char *d = (char *)srealloc(a, 5000); // moves, its own smalloc and sfree are not logged
+    REQUIRE(d != a);
+    REQUIRE(srealloc(d, 0) == nullptr);
+    sfree(b);
+    sfree_sized(c, 200);
+    sfree(d);
+    sfree(before);
+    sfree(nullptr);
+    REQUIRE(smalloc(0) == nullptr);
+    REQUIRE(srecord_stop() == 0);
+    smalloc(10); // after the recording
+
+    std::vector<trace_event> events = read_trace(path.c_str());
+    unlink(path.c_str());
+    REQUIRE(events.size() == 10);
+    REQUIRE(events[0].op == SR_MALLOC);
+    REQUIRE(events[0].size == 100);
+    REQUIRE(events[0].new_id == (uint64_t)a);
+    REQUIRE(events[1].op == SR_CALLOC);
+    REQUIRE(events[1].size == 300);
+    REQUIRE(events[1].new_id == (uint64_t)b);
+    REQUIRE(events[2].op == SR_ALIGNED_ALLOC);
+    REQUIRE(events[2].size == 200);
+    REQUIRE(events[2].alignment == 64);
+    REQUIRE(events[2].new_id == (uint64_t)c);
+    REQUIRE(events[3].op == SR_REALLOC);
+    REQUIRE(events[3].size == 5000);
+    REQUIRE(events[3].old_id == (uint64_t)a);
+    REQUIRE(events[3].new_id == (uint64_t)d);
+    REQUIRE(events[4].op == SR_REALLOC);
+    REQUIRE(events[4].old_id == (uint64_t)d);
+    REQUIRE(events[4].new_id == 0);
+    REQUIRE(events[5].op == SR_FREE);
+    REQUIRE(events[5].old_id == (uint64_t)b);
+    REQUIRE(events[6].old_id == (uint64_t)c);
+    REQUIRE(events[7].old_id == (uint64_t)d);
+    REQUIRE(events[8].old_id == (uint64_t)before);
+    REQUIRE(events[9].op == SR_MALLOC);
+    REQUIRE(events[9].size == 0);
+    REQUIRE(events[9].new_id == 0);
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        REQUIRE(events[i].thread == events[0].thread);
+        REQUIRE((i == 0 || events[i].time >= events[i - 1].time));
+    }
+}
+
+TEST_CASE("srecord in place calls", "[malloc3]")
+{
+    std::string path = trace_path();
+    REQUIRE(srecord_start(path.c_str()) == 0);
+
+    char *a = (char *)smalloc(100);
+    size_t grown = sexpand(a, 200, 300); // the wilderness grows
+    REQUIRE(grown >= 200);
+    REQUIRE(sexpand(a, (size_t)1 << 40, (size_t)1 << 40) == 0);
+    char *r = (char *)sreserve(1024 * 1024);
+    REQUIRE(scommit(r, 10000) == r);
+    REQUIRE(scommit(r, 2 * 1024 * 1024) == nullptr);
+    sfree(r);
+    sfree(a);
+    REQUIRE(srecord_stop() == 0);
+
+    std::vector<trace_event> events = read_trace(path.c_str());
+    unlink(path.c_str());
+    REQUIRE(events.size() == 8);
+    REQUIRE(events[1].op == SR_EXPAND);
+    REQUIRE(events[1].size == 300);
+    REQUIRE(events[1].old_id == (uint64_t)a);
+    REQUIRE(events[1].usable == grown);
+    REQUIRE(events[2].op == SR_EXPAND);
+    REQUIRE(events[2].usable == 0);
+    REQUIRE(events[3].op == SR_RESERVE);
+    REQUIRE(events[3].size == 1024 * 1024);
+    REQUIRE(events[3].new_id == (uint64_t)r);
+    REQUIRE(events[4].op == SR_COMMIT);
+    REQUIRE(events[4].size == 10000);
+    REQUIRE(events[4].old_id == (uint64_t)r);
+    REQUIRE(events[4].new_id == (uint64_t)r);
+    REQUIRE(events[5].op == SR_COMMIT);
+    REQUIRE(events[5].new_id == 0);
+    REQUIRE(events[6].op == SR_FREE);
+    REQUIRE(events[6].old_id == (uint64_t)r);
+}
+
+TEST_CASE("srecord threads", "[malloc3]")
+{
+    // the engine is single threaded, the calls take turns but are logged per thread
+    const int threads = 4, rounds = 50000; // more than a ring holds
+    std::string path = trace_path();
+    std::mutex engine;
+    REQUIRE(srecord_start(path.c_str()) == 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&engine, t]() {
+            for (int i = 0; i < rounds; i++)
+            {
+                std::lock_guard<std::mutex> guard(engine);
+                sfree(smalloc(16 + t));
+            }
+        });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    REQUIRE(srecord_stop() == 0);
+
+    std::vector<trace_event> events = read_trace(path.c_str());
+    unlink(path.c_str());
+    REQUIRE(events.size() == (size_t)threads * rounds * 2);
+    std::vector<size_t> per_thread(SRECORD_THREADS);
+    std::vector<uint64_t> last(SRECORD_THREADS), live(SRECORD_THREADS);
+    for (const trace_event &event : events)
+    {
+        per_thread[event.thread]++;
+        REQUIRE(event.time >= last[event.thread]);
+        last[event.thread] = event.time;
+        // a thread's events come in order, each smalloc followed by its sfree
+        if (event.op == SR_MALLOC)
+        {
+            REQUIRE(live[event.thread] == 0);
+            live[event.thread] = event.new_id;
+            REQUIRE(event.size >= 16);
+        }
+        else
+        {
+            REQUIRE(event.op == SR_FREE);
+            REQUIRE(event.old_id == live[event.thread]);
+            live[event.thread] = 0;
+        }
+    }
+    size_t recorded = 0;
+    for (size_t count : per_thread)
+    {
+        REQUIRE((count == 0 || count == (size_t)rounds * 2));
+        recorded += count > 0;
+    }
+    REQUIRE(recorded == threads);
+}
+
+TEST_CASE("srecord restarts", "[malloc3]")
+{
+    std::string path = trace_path();
+    for (int round = 1; round <= 3; round++)
+    {
+        REQUIRE(srecord_start(path.c_str()) == 0);
+        for (int i = 0; i < round; i++)
+        {
+            sfree(smalloc(100));
+        }
+        REQUIRE(srecord_stop() == 0);
+        REQUIRE(read_trace(path.c_str()).size() == (size_t)round * 2);
+    }
+    unlink(path.c_str());
+}
+
+// leaves a trace for the trace_replay tests, see CMakeLists.txt
+TEST_CASE("srecord to file", "[.][srecord_file]")
+{
+    const char *path = getenv("SRECORD");
+    REQUIRE(path != nullptr);
+    std::mutex engine;
+    // every thread holds its 100 blocks before any of them frees, the replay tests check the peak
+    pthread_barrier_t filled;
+    REQUIRE(pthread_barrier_init(&filled, nullptr, 3) == 0);
+    REQUIRE(srecord_start(path) == 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 3; t++)
+    {
+        workers.emplace_back([&engine, &filled, t]() {
+            std::vector<void *> blocks(100);
+            for (int i = 0; i < 5000; i++)
+            {
+                std::lock_guard<std::mutex> guard(engine);
+                void *&block = blocks[(i * 7 + t) % blocks.size()];
+                size_t size = 16 + (i * 131 + t) % (i % 50 == 0 ? 200000 : 2000);
+                if (i % 5 == 0)
+                {
+                    block = srealloc(block, size);
+                }
+                else
+                {
+                    sfree(block);
+                    block = i % 3 == 0 ? scalloc(1, size) : smalloc(size);
+                }
+            }
+            pthread_barrier_wait(&filled);
+            std::lock_guard<std::mutex> guard(engine);
+            for (void *block : blocks)
+            {
+                sfree(block);
+            }
+        });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    pthread_barrier_destroy(&filled);
+    char *grows = (char *)sreserve(1024 * 1024);
+    REQUIRE(scommit(grows, 100000) == grows);
+    char *expands = (char *)smalloc(1000);
+    REQUIRE(sexpand(expands, 2000, 4000) >= 2000);
+    sfree(expands);
+    sfree(grows);
+    REQUIRE(srecord_stop() == 0);
+}
@@ -0,0 +1,213 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MAX_ALLOCATION_SIZE (1e8)
+#define MMAP_THRESHOLD (128 * 1024)
+#define MIN_SPLIT_SIZE (128)
+
+static inline size_t aligned_size(size_t size)
+{
+    return (size % 8) ? (size & (size_t)(-8)) + 8 : size;
+}
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == aligned_size(allocated_bytes));                                              \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == aligned_size(free_bytes));                                                        \
+        REQUIRE(_num_meta_data_bytes() == aligned_size(_size_meta_data() * allocated_blocks));                         \
+    } while (0)
+
+#define verify_size(base)                                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(_num_allocated_bytes() + aligned_size(_size_meta_data() * _num_allocated_blocks()) ==                  \
+                (size_t)after - (size_t)base);                                                                         \
+    } while (0)
+
+TEST_CASE("trim disabled", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+
+    char *a = (char *)smalloc(16);
+    char *b = (char *)smalloc(100000);
+    REQUIRE(b != nullptr);
+    sfree(b);
+    verify_blocks(2, 16 + 100000, 1, 100000);
+    verify_size(base);
+
+    sfree(a);
+    verify_blocks(1, 16 + 100000 + _size_meta_data(), 1, 16 + 100000 + _size_meta_data());
+    verify_size(base);
+}
+
+TEST_CASE("trim threshold", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    REQUIRE(smallopt(SM_TRIM_THRESHOLD, 64 * 1024) == 1);
+    REQUIRE(smallopt(SM_TOP_PAD, 0) == 1);
+
+    char *a = (char *)smalloc(16);
+    char *b = (char *)smalloc(100);
+    REQUIRE(b != nullptr);
+    sfree(b);
+    verify_blocks(2, 16 + 100, 1, 100);
+    verify_size(base);
+
+    b = (char *)smalloc(100000);
+    REQUIRE(b != nullptr);
+    sfree(b);
+    verify_blocks(1, 16, 0, 0);
+    verify_size(base);
+
+    // merging into a large free tail trims as well
+    b = (char *)smalloc(60000);
+    char *c = (char *)smalloc(60000);
+    REQUIRE(c != nullptr);
+    sfree(c);
+    verify_blocks(3, 16 + 60000 + 60000, 1, 60000);
+    sfree(b);
+    verify_blocks(1, 16, 0, 0);
+    verify_size(base);
+
+    sfree(a);
+    verify_size(base);
+}
+
+TEST_CASE("trim top pad", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    REQUIRE(smallopt(SM_TRIM_THRESHOLD, 64 * 1024) == 1);
+    REQUIRE(smallopt(SM_TOP_PAD, 4096) == 1);
+    REQUIRE(smallopt(SM_TOP_PAD, -1) == 0);
+
+    char *a = (char *)smalloc(16);
+    char *b = (char *)smalloc(100000);
+    REQUIRE(b != nullptr);
+    sfree(b);
+    verify_blocks(2, 16 + 4096, 1, 4096);
+    verify_size(base);
+
+    // the pad is reused without moving the break
+    void *brk = sbrk(0);
+    char *c = (char *)smalloc(4000);
+    REQUIRE(c == b);
+    REQUIRE(sbrk(0) == brk);
+    verify_blocks(2, 16 + 4096, 0, 0);
+    verify_size(base);
+
+    sfree(a);
+    sfree(c);
+}
+
+TEST_CASE("strim", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+
+    char *a = (char *)smalloc(16);
+    char *b = (char *)smalloc(100000);
+    REQUIRE(b != nullptr);
+    REQUIRE(strim(0) == 0);
+
+    sfree(b);
+    REQUIRE(spurge() > 0);
+    REQUIRE(strim(200000) == 0);
+    verify_blocks(2, 16 + 100000, 1, 100000);
+    REQUIRE(strim(1000) == 1);
+    verify_blocks(2, 16 + 1000, 1, 1000);
+    verify_size(base);
+    REQUIRE(strim(0) == 1);
+    verify_blocks(1, 16, 0, 0);
+    verify_size(base);
+    REQUIRE(strim(0) == 0);
+
+    sfree(a);
+    verify_size(base);
+}
+
+TEST_CASE("trim regrow", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+
+    char *a = (char *)smalloc(20);
+    char *b = (char *)smalloc(100000);
+    REQUIRE(b != nullptr);
+    memset(b, 'b', 100000);
+    sfree(b);
+    REQUIRE(strim(0) == 1);
+    verify_size(base);
+
+    // the page the break was lowered into keeps its old bytes
+    char *c = (char *)scalloc(100000, 1);
+    REQUIRE(c == b);
+    for (size_t i = 0; i < 100000; i++)
+    {
+        REQUIRE(c[i] == 0);
+    }
+    verify_blocks(2, 24 + 100000, 0, 0);
+    verify_size(base);
+
+    sfree(a);
+    sfree(c);
+}
+
+TEST_CASE("trim foreign break", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(smallopt(SM_TRIM_THRESHOLD, 0) == 1);
+
+    char *a = (char *)smalloc(16);
+    char *b = (char *)smalloc(100000);
+    REQUIRE(b != nullptr);
+    REQUIRE(sbrk(4096) != (void *)-1);
+    sfree(b);
+    verify_blocks(2, 16 + 100000, 1, 100000);
+    strim(0);
+    verify_blocks(2, 16 + 100000, 1, 100000);
+
+    sfree(a);
+}
+
+TEST_CASE("foreign break fence", "[malloc3]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    char *a = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    memset(a, 'a', 100);
+    char *foreign = (char *)sbrk(4096);
+    REQUIRE(foreign != (void *)-1);
+    memset(foreign, 'f', 4096);
+
+    // a cannot grow into the foreign memory, it has to move
+    char *b = (char *)srealloc(a, 1000);
+    REQUIRE(b != nullptr);
+    REQUIRE(b != a);
+    REQUIRE(b > foreign);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(b[i] == 'a');
+    }
+    memset(b, 'b', 1000);
+    verify_blocks(2, 100 + 1000, 1, 100);
+
+    // the free block before the gap and b are never merged across it
+    sfree(b);
+    verify_blocks(2, 100 + 1000, 2, 100 + 1000);
+    for (int i = 0; i < 4096; i++)
+    {
+        REQUIRE(foreign[i] == 'f');
+    }
+}
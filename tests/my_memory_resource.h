@@ -0,0 +1,128 @@
+#ifndef MY_MEMORY_RESOURCE_H
+#define MY_MEMORY_RESOURCE_H
+
+#include <stddef.h>
+
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include "my_stdlib.h"
+
+/* Containers on the engine without replacing the global malloc or operator new, either
+ * through std::pmr or as an allocator template argument. Frees pass the size back to
+ * sfree_sized, alignments above 8 go to saligned_alloc. Given a heap handle, both allocate
+ * from that heap instead of the global one. */
+
+inline void *smalloc_or_throw(size_t bytes, size_t alignment, sheap_t heap = NULL)
+{
+    if (bytes == 0)
+    {
+        bytes = 1;
+    }
+    void *p;
+    if (heap != NULL)
+    {
+        p = sheap_aligned_alloc(heap, alignment > 8 ? alignment : 8, bytes);
+    }
+    else
+    {
+        p = alignment > 8 ? saligned_alloc(alignment, bytes) : smalloc(bytes);
+    }
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+inline void sfree_from(void *p, size_t bytes, sheap_t heap)
+{
+    if (heap != NULL)
+    {
+        sheap_free(heap, p);
+    }
+    else
+    {
+        sfree_sized(p, bytes ? bytes : 1);
+    }
+}
+
+class SmallocResource : public std::pmr::memory_resource
+{
+public:
+    explicit SmallocResource(sheap_t heap = NULL) noexcept : heap_(heap) {}
+
+    sheap_t heap() const noexcept { return heap_; }
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        return smalloc_or_throw(bytes, alignment, heap_);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t) override
+    {
+        sfree_from(p, bytes, heap_);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const SmallocResource *resource = dynamic_cast<const SmallocResource *>(&other);
+        return resource != nullptr && resource->heap_ == heap_;
+    }
+
+private:
+    sheap_t heap_;
+};
+
+/* the resource for the engine's global heap */
+inline SmallocResource *smalloc_resource()
+{
+    static SmallocResource resource;
+    return &resource;
+}
+
+template <typename T>
+class SmallocAllocator
+{
+public:
+    typedef T value_type;
+
+    SmallocAllocator() noexcept : heap(NULL) {}
+
+    explicit SmallocAllocator(sheap_t heap) noexcept : heap(heap) {}
+
+    template <typename U>
+    SmallocAllocator(const SmallocAllocator<U> &other) noexcept : heap(other.heap) {}
+
+    T *allocate(size_t n)
+    {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T))
+        {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(smalloc_or_throw(n * sizeof(T), alignof(T), heap));
+    }
+
+    void deallocate(T *p, size_t n) noexcept
+    {
+        sfree_from(p, n * sizeof(T), heap);
+    }
+
+    sheap_t heap; /* NULL for the global heap */
+};
+
+template <typename T, typename U>
+bool operator==(const SmallocAllocator<T> &a, const SmallocAllocator<U> &b) noexcept
+{
+    return a.heap == b.heap;
+}
+
+template <typename T, typename U>
+bool operator!=(const SmallocAllocator<T> &a, const SmallocAllocator<U> &b) noexcept
+{
+    return a.heap != b.heap;
+}
+
+#endif /* MY_MEMORY_RESOURCE_H */
@@ -2,11 +2,299 @@
 #define MY_STDLIB_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 void *smalloc(size_t size);
 void *scalloc(size_t num, size_t size);
 void sfree(void *p);
 void *srealloc(void *oldp, size_t size);
+void *saligned_alloc(size_t alignment, size_t size);
+size_t smalloc_usable_size(void *p);
+
+/* sfree for callers that know the size they allocated */
+void sfree_sized(void *p, size_t size);
+
+/* reserve address space for a buffer that grows in place, free it with sfree */
+void *sreserve(size_t max_size);
+void *scommit(void *p, size_t new_size);
+
+/* resize p without ever moving it: to preferred_size if there is room, else to at least
+ * min_size. Returns the usable size of p, or 0 if it could not reach min_size. */
+size_t sexpand(void *p, size_t min_size, size_t preferred_size);
+
+/* independent heaps: each grows in mappings of its own and is destroyed as a whole, without
+ * freeing its blocks one by one. Blocks of a heap are freed with sheap_free, not sfree. */
+typedef struct SmallocHeap *sheap_t;
+struct sheap_info
+{
+    size_t allocated_blocks;
+    size_t allocated_bytes;
+    size_t free_blocks;
+    size_t free_bytes;
+    size_t meta_data_bytes;
+    size_t segments;      /* mappings the heap grew into */
+    size_t segment_bytes; /* their total length */
+};
+sheap_t sheap_create();
+void *sheap_alloc(sheap_t heap, size_t size);
+void *sheap_aligned_alloc(sheap_t heap, size_t alignment, size_t size);
+void sheap_free(sheap_t heap, void *p);
+void *sheap_realloc(sheap_t heap, void *oldp, size_t size);
+struct sheap_info sheap_stats(sheap_t heap);
+void sheap_destroy(sheap_t heap);
+
+/* the blocks of a heap handle, or of the engine's heap for NULL, as a binary stream for
+ * tools/heap_dump_view: a sheap_dump_header, then a sheap_dump_record per heap block in
+ * address order, then for the engine's heap one per mmap, sreserve and huge page filler
+ * block. Written without allocating. Returns 0, or -1 when a write failed. */
+#define SHEAP_DUMP_MAGIC "smheap02"
+#define SHEAP_DUMP_HEAP (0)
+#define SHEAP_DUMP_MMAP (1)
+#define SHEAP_DUMP_FILLER (2)
+#define SHEAP_DUMP_RESERVE (3)
+#define SHEAP_DUMP_FENCE (4) /* an empty used block after memory someone else took */
+struct sheap_dump_header
+{
+    char magic[8];
+    uint64_t heap_start; /* header of the first heap block, offsets in the heap are from here */
+    uint64_t heap_end;   /* end of the last heap block */
+    uint32_t record_size;
+    uint32_t header_size; /* in front of each block's payload */
+    uint32_t page_size;
+    uint32_t reserved;
+};
+struct sheap_dump_record
+{
+    uint64_t address; /* of the block's header */
+    uint64_t size;    /* payload bytes, the header is not included */
+    uint64_t site;    /* allocation stack hash of blocks the heap profiler sampled, else 0 */
+    uint8_t kind;     /* SHEAP_DUMP_* */
+    uint8_t is_free;
+    uint8_t reserved[6];
+};
+int sheap_dump(sheap_t heap, int fd);
+
+/* pools of fixed-size objects without a header per object. Objects are aligned to align
+ * (0 for 8) and freed with spool_free into the pool they came from. Slabs are kept until
+ * spool_destroy. spool_cache gives each thread a front cache of up to objects objects, only
+ * a pool with caches may be used from several threads. A cache goes back to its pool when
+ * its thread exits. */
+typedef struct SmallocPool *spool_t;
+struct spool_info
+{
+    size_t obj_size;
+    size_t stride; /* bytes between two objects */
+    size_t slabs;
+    size_t slab_bytes;
+    size_t used_objects;
+    size_t free_objects; /* carved and not in use, the front caches included */
+};
+spool_t spool_create(size_t obj_size, size_t align);
+int spool_cache(spool_t pool, size_t objects);
+void *spool_alloc(spool_t pool);
+void spool_free(spool_t pool, void *p);
+struct spool_info spool_stats(spool_t pool);
+void spool_destroy(spool_t pool);
+
+/* smallopt parameters */
+#define SM_DECAY_MS (1)     /* ms a free heap page stays resident before it is purged, negative disables */
+#define SM_PURGE_ADVICE (2) /* MADV_DONTNEED or MADV_FREE */
+#define SM_TRIM_THRESHOLD (3) /* free wilderness size that triggers trimming the break, negative disables */
+#define SM_TOP_PAD (4)        /* bytes of wilderness kept when trimming */
+#define SM_HUGEPAGE_FILLER (5) /* non-zero packs 4KB..128KB blocks into shared 2MB huge pages */
+#define SM_MAP_SIZE (6)        /* blocks this large are mapped on their own, 128KB by default */
+#define SM_MIN_SPLIT_SIZE (7)  /* smallest free block split off a larger one, 128 by default */
+#define SM_MAX_SIZE (8)        /* largest allocation, 1e8 by default, PTRDIFF_MAX under malloc and new */
+#define SM_PROFILE_RATE (9)    /* mean bytes between two sampled allocations, 0 (off) by default */
+
+/* engine counters, kept up to date as it runs, so smalloc_info is O(1) */
+struct smallinfo
+{
+    size_t heap_bytes;          /* the sbrk heap, what the engine moved the break by */
+    size_t mmap_blocks;         /* blocks mapped one by one */
+    size_t mmap_bytes;
+    size_t free_blocks;         /* length of the free list */
+    size_t largest_free_block;  /* its largest block, 0 if it is empty */
+    size_t sbrk_calls;          /* system calls of the engine, sbrk(0) not included */
+    size_t mmap_calls;          /* mremap included */
+    size_t munmap_calls;
+    size_t madvise_calls;
+    size_t realloc_moved_bytes; /* data srealloc moved inside the heap or copied */
+    size_t splits;
+    size_t merges;
+    size_t realloc_cases[8];    /* srealloc calls by case, A to H */
+};
+int smalloc_info(struct smallinfo *info);
+
+/* fragmentation of the sbrk heap, from counters the free list keeps, so O(1) */
+#define SMALLFRAG_BUCKETS (32)
+struct smallfrag
+{
+    size_t free_blocks;
+    size_t free_bytes;
+    size_t largest_free_block;
+    double external_fragmentation; /* 1 - largest_free_block / free_bytes, 0 with nothing free */
+    size_t heap_bytes;             /* the sbrk heap, as in smallinfo */
+    size_t live_bytes;             /* heap_bytes not in free blocks or headers */
+    double heap_to_live;           /* heap_bytes / live_bytes, 0 with nothing live */
+    size_t stranded_blocks;        /* free blocks smaller than min_split_size */
+    size_t stranded_bytes;
+    size_t histogram_blocks[SMALLFRAG_BUCKETS]; /* free blocks by size, bucket i from 2^(i-1) up to 2^i, the last one all larger */
+    size_t histogram_bytes[SMALLFRAG_BUCKETS];
+};
+int smalloc_frag(struct smallfrag *frag);
+
+int smallopt(int param, long value);
+/* the smallopt parameters by name: decay_ms, purge_advice, trim_threshold, top_pad,
+ * hugepage_filler, map_size, min_split_size, max_size, profile_rate. Reads into old_value, then sets
+ * new_value, either may be NULL. Returns 0, ENOENT or EINVAL. The same names set them at
+ * startup through the environment: SMALLOC_CONF="map_size:65536,min_split_size:64" */
+int smallctl(const char *name, long *old_value, const long *new_value);
+
+/* sampling heap profiler: about one allocation per sample_rate bytes gets its stack
+ * recorded until it is freed, 0 stops sampling. sprofile_dump writes the live and total
+ * samples per stack in the legacy pprof heap format. SMALLOC_PROFILE=path samples from
+ * startup at 512KB and writes the profile to path at exit. At rate 1 every allocation is
+ * sampled. sprofile_retained writes the sites, by stack hash, that hold the most sampled
+ * bytes and blocks, up to sites of each. SMALLOC_RETAIN=path samples every allocation from
+ * startup and writes that report to path at exit, and on signal SMALLOC_RETAIN_SIGNAL when
+ * set, at the next call after it. */
+int sprofile(size_t sample_rate);
+int sprofile_dump(int fd);
+int sprofile_retained(int fd, size_t sites);
+/* lifetime profile of the sampled objects, one line of key=value fields per record: a
+ * "lifetimes" header, a "site=<stack hash>" line per stack and a "size=<upper bound>" line
+ * per log2 size class. Each has sampled, freed and live counts, a class (short when nine in
+ * ten died within 1024 allocations, immortal when nine in ten are still live, - otherwise or
+ * under 16 samples), p50 and p90 lifetimes and "bound:count" histograms of the freed ones in
+ * allocations made in between (allocs=) and in ns (ns=). SMALLOC_LIFETIME=path samples from
+ * startup at 512KB unless sampling is on already and writes the profile to path at exit. */
+int sprofile_lifetimes(int fd);
+
+/* allocation trace recorder: from srecord_start every smalloc, scalloc, saligned_alloc,
+ * srealloc, sexpand, sreserve, scommit, sfree and sfree_sized is written to path until
+ * srecord_stop, by a thread the recording runs, in per-thread batches. SMALLOC_TRACE=path
+ * records from startup to exit.
+ * Both return 0, or -1 when already (not) recording or the file cannot be written.
+ * The stream: SMALLOC_TRACE_MAGIC, the start time in CLOCK_MONOTONIC ns as 8 bytes, then
+ * chunks of one thread's events in the order they happened: varint thread, varint count,
+ * then per event its op byte, varint ns since the thread's last event (the first since the
+ * start), and the op's fields as varints, ids as zigzag deltas from the thread's last id:
+ *   SR_MALLOC, SR_CALLOC   size, new id
+ *   SR_ALIGNED_ALLOC       size, alignment, new id
+ *   SR_REALLOC             size, old id, new id (0 when it failed and old is kept)
+ *   SR_FREE                old id
+ *   SR_EXPAND              preferred size, old id, usable size after (0 when it failed)
+ *   SR_RESERVE             max size, new id
+ *   SR_COMMIT              new size, old id, new id (old, or 0 when it failed)
+ * Varints are LEB128. An id is the address handed out, 0 for NULL, so a freed id can come
+ * back. Threads are numbered from 0 in the order they first called in, all threads from
+ * SRECORD_THREADS - 1 on are recorded as that one. */
+#define SMALLOC_TRACE_MAGIC "smtrace1"
+#define SRECORD_THREADS (64)
+#define SR_MALLOC (0)
+#define SR_CALLOC (1)
+#define SR_ALIGNED_ALLOC (2)
+#define SR_REALLOC (3)
+#define SR_FREE (4)
+#define SR_EXPAND (5)
+#define SR_RESERVE (6)
+#define SR_COMMIT (7)
+int srecord_start(const char *path);
+int srecord_stop();
+
+/* latency histograms, built in with -DSMALLOC_LATENCY (cmake -DSMALLOC_LATENCY=ON). Every
+ * call is timed in cycles and counted by operation and by the path it took inside the
+ * engine. slatency and slatency_dump return -1 when they are not built in.
+ * SMALLOC_LATENCY=path writes the table to path at exit. */
+#define SL_SMALLOC (0)
+#define SL_SCALLOC (1)
+#define SL_SALIGNED_ALLOC (2)
+#define SL_SFREE (3) /* sfree_sized too */
+#define SL_SREALLOC (4)
+#define SL_OPS (5)
+#define SL_PATH_REUSE (0)      /* a free block as it was */
+#define SL_PATH_SPLIT (1)      /* a free block split */
+#define SL_PATH_WILDERNESS (2) /* the free block at the break grown */
+#define SL_PATH_SBRK (3)       /* a new block at the break */
+#define SL_PATH_MMAP (4)       /* a block mapped or unmapped on its own */
+#define SL_PATH_FILLER (5)     /* a huge page filler block */
+#define SL_PATH_FREE (6)       /* a block freed without a free neighbour */
+#define SL_PATH_MERGE (7)      /* a block merged with a free neighbour */
+#define SL_PATH_TRIM (8)       /* the wilderness given back with sbrk */
+#define SL_PATH_REALLOC_A (9)  /* srealloc case A, B to H follow */
+#define SL_PATHS (17)
+#define SL_BUCKETS (64)
+struct slatency
+{
+    size_t count;
+    unsigned long long total; /* cycles, or ns where there is no cycle counter */
+    unsigned long long max;
+    size_t buckets[SL_BUCKETS]; /* bucket i counts latencies from 2^(i-1) up to 2^i */
+};
+int slatency(int op, int path, struct slatency *latency);
+void slatency_reset();
+int slatency_dump(int fd);
+
+/* instrumentation policies, one per build: -DSMALLOC_COUNTING counts the engine's internal
+ * events and their bytes, -DSMALLOC_TRACING keeps the last 4096 of them, -DSMALLOC_LATENCY
+ * is the latency histograms above. None of it is in the default build. sinstrument
+ * returns -1 without the counting policy, sinstrument_trace 0 without the tracing one.
+ * SMALLOC_INSTRUMENT=path writes sinstrument_dump to path at exit. */
+#define SI_SPLIT (0)     /* bytes: the free block split off */
+#define SI_MERGE (1)     /* bytes: the block merged into its neighbour, header included */
+#define SI_GROW (2)      /* bytes: the break increment */
+#define SI_MMAP (3)      /* bytes: the block's payload */
+#define SI_MUNMAP (4)
+#define SI_REALLOC_A (5) /* srealloc case A, B to H follow, bytes: the size asked for */
+#define SI_EVENTS (13)
+struct sinstrument
+{
+    size_t count;
+    size_t bytes;
+};
+struct sinstrument_event
+{
+    uint64_t seq;     /* events seen before this one */
+    int32_t op;       /* SL_ operation of the call it happened in, -1 outside of one */
+    int32_t event;
+    uint64_t address; /* block header */
+    uint64_t bytes;
+};
+int sinstrument(int event, struct sinstrument *result);
+size_t sinstrument_trace(struct sinstrument_event *events, size_t count);
+void sinstrument_reset();
+int sinstrument_dump(int fd);
+
+/* live stats page: sstats_publish(1) maps /dev/shm/smalloc.<pid> and the engine keeps
+ * copying its counters there, at most every 100ms, for tools/smalloc_top to read from
+ * another process. sstats_publish(0) removes it, as does exit. SMALLOC_STATS=1 publishes
+ * from startup. Returns 0, or -1 when it already (not) publishes or the page cannot be
+ * set up. Readers copy the page and retry until seq was even and the same before and after. */
+#define SSTATS_MAGIC "smstats1"
+struct sstats_page
+{
+    char magic[8];
+    uint64_t seq;  /* odd while the engine writes the page */
+    uint64_t size; /* of the page, for readers built against another version */
+    int64_t pid;
+    uint64_t time_ns; /* CLOCK_MONOTONIC of the last update */
+    uint64_t calls;   /* smalloc, scalloc, saligned_alloc, srealloc, sfree... on the engine's heap */
+    size_t heap_blocks;
+    size_t filler_blocks;
+    size_t filler_bytes;
+    size_t filler_regions;
+    size_t reserved_blocks;
+    size_t reserved_bytes;
+    size_t purged_bytes;
+    struct smallinfo info;
+    struct smallfrag frag;
+    int64_t latency_built_in; /* latencies are zero without SMALLOC_LATENCY */
+    struct slatency latencies[SL_OPS][SL_PATHS];
+};
+int sstats_publish(int on);
+size_t spurge();
+int strim(size_t pad);
 
 size_t _num_free_blocks();
 size_t _num_free_bytes();
@@ -14,5 +302,15 @@ size_t _num_allocated_blocks();
 size_t _num_allocated_bytes();
 size_t _num_meta_data_bytes();
 size_t _size_meta_data();
+size_t _num_purged_bytes();
+size_t _num_dirty_bytes();
+size_t _num_filler_regions();
+size_t _num_filler_hugetlb_regions();
+size_t _num_filler_used_pages();
+size_t _num_filler_total_pages();
+size_t _num_reserved_bytes();
+size_t _num_pools();
+size_t _num_pool_objects(); /* in use, over all pools */
+size_t _num_pool_bytes();   /* slabs of all pools */
 
 #endif /* MY_STDLIB_H */
@@ -0,0 +1,142 @@
+#include "my_stdlib.h"
+#include "my_memory_resource.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <functional>
+#include <map>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+// std::vector, std::map and std::unordered_map with std::allocator, with SmallocAllocator,
+// with the pmr resource and with a pmr resource on a heap of its own, on the same workload. Usage: container_bench [elements] [rounds]
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// grow a vector element by element, then drop it
+template <typename Vector>
+static long vectorRound(Vector& v, int elements) {
+    long sum = 0;
+    for (int i = 0; i < elements; i++) {
+        v.push_back(i);
+    }
+    for (int x : v) {
+        sum += x;
+    }
+    v.clear();
+    v.shrink_to_fit();
+    return sum;
+}
+
+// fill a map, erase every other key, refill, then clear: nodes are freed and reused
+template <typename Map>
+static long mapRound(Map& m, int elements) {
+    long sum = 0;
+    for (int i = 0; i < elements; i++) {
+        m[i] = i;
+    }
+    for (int i = 0; i < elements; i += 2) {
+        m.erase(i);
+    }
+    for (int i = 0; i < elements; i += 2) {
+        m[i] = i;
+    }
+    for (auto& kv : m) {
+        sum += kv.second;
+    }
+    m.clear();
+    return sum;
+}
+
+static double timeRounds(int rounds, const std::function<long()>& round) {
+    long checksum = 0;
+    double start = nowSeconds();
+    for (int r = 0; r < rounds; r++) {
+        checksum += round();
+    }
+    double elapsed = nowSeconds() - start;
+    if (checksum == -1) { // keeps the work from being optimized out
+        printf("\n");
+    }
+    return elapsed;
+}
+
+static void report(const char* container, const char* allocator, double seconds, long ops) {
+    printf("%-14s %-16s %10.3f ms %10.1f ns/op\n", container, allocator, seconds * 1e3, seconds * 1e9 / ops);
+}
+
+int main(int argc, char* argv[]) {
+    int elements = argc > 1 ? atoi(argv[1]) : 10000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    long vector_ops = (long) elements * rounds;
+    long map_ops = 2L * elements * rounds;
+    std::pmr::memory_resource* resource = smalloc_resource();
+    sheap_t heap = sheap_create();
+    SmallocResource heap_resource(heap);
+
+    printf("%d elements, %d rounds\n", elements, rounds);
+
+    {
+        std::vector<int> v;
+        report("vector", "std::allocator", timeRounds(rounds, [&] { return vectorRound(v, elements); }), vector_ops);
+    }
+    {
+        std::vector<int, SmallocAllocator<int>> v;
+        report("vector", "SmallocAllocator", timeRounds(rounds, [&] { return vectorRound(v, elements); }), vector_ops);
+    }
+    {
+        std::pmr::vector<int> v(resource);
+        report("vector", "pmr", timeRounds(rounds, [&] { return vectorRound(v, elements); }), vector_ops);
+    }
+    {
+        std::pmr::vector<int> v(&heap_resource);
+        report("vector", "pmr heap", timeRounds(rounds, [&] { return vectorRound(v, elements); }), vector_ops);
+    }
+
+    {
+        std::map<int, int> m;
+        report("map", "std::allocator", timeRounds(rounds, [&] { return mapRound(m, elements); }), map_ops);
+    }
+    {
+        std::map<int, int, std::less<int>, SmallocAllocator<std::pair<const int, int>>> m;
+        report("map", "SmallocAllocator", timeRounds(rounds, [&] { return mapRound(m, elements); }), map_ops);
+    }
+    {
+        std::pmr::map<int, int> m(resource);
+        report("map", "pmr", timeRounds(rounds, [&] { return mapRound(m, elements); }), map_ops);
+    }
+    {
+        std::pmr::map<int, int> m(&heap_resource);
+        report("map", "pmr heap", timeRounds(rounds, [&] { return mapRound(m, elements); }), map_ops);
+    }
+
+    {
+        std::unordered_map<int, int> u;
+        report("unordered_map", "std::allocator", timeRounds(rounds, [&] { return mapRound(u, elements); }), map_ops);
+    }
+    {
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                           SmallocAllocator<std::pair<const int, int>>> u;
+        report("unordered_map", "SmallocAllocator", timeRounds(rounds, [&] { return mapRound(u, elements); }), map_ops);
+    }
+    {
+        std::pmr::unordered_map<int, int> u(resource);
+        report("unordered_map", "pmr", timeRounds(rounds, [&] { return mapRound(u, elements); }), map_ops);
+    }
+    {
+        std::pmr::unordered_map<int, int> u(&heap_resource);
+        report("unordered_map", "pmr heap", timeRounds(rounds, [&] { return mapRound(u, elements); }), map_ops);
+    }
+
+    printf("engine: %zu blocks, %zu free\n", _num_allocated_blocks(), _num_free_blocks());
+    printf("heap: %zu segments, %zu bytes\n", sheap_stats(heap).segments, sheap_stats(heap).segment_bytes);
+    sheap_destroy(heap);
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "my_stdlib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+// Reads a sheap_dump stream and prints an occupancy strip chart of the heap, where each
+// column covers an equal slice of [heap_start, heap_end), and log2 size histograms of the
+// used, free and separately mapped blocks. With sites, also the sampled sites by bytes.
+// Usage: heap_dump_view dump [width] [rows]
+
+static const char* const SHADES = " .:-=+*%#"; // ' ' not heap blocks, '.' free, '#' all used
+
+static int log2Bucket(uint64_t size) {
+    int bucket = 0;
+    while (size > 1) {
+        size >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void printHistogram(const char* title, const std::vector<sheap_dump_record>& records) {
+    uint64_t blocks[64] = {}, bytes[64] = {};
+    int last = -1;
+    for (const sheap_dump_record& record : records) {
+        int bucket = log2Bucket(record.size);
+        blocks[bucket]++;
+        bytes[bucket] += record.size;
+        last = std::max(last, bucket);
+    }
+    printf("\n%s: %zu blocks\n", title, records.size());
+    uint64_t most = *std::max_element(blocks, blocks + 64);
+    for (int bucket = 0; bucket <= last; bucket++) {
+        if (blocks[bucket] == 0) {
+            continue;
+        }
+        int bar = (int) ((blocks[bucket] * 40 + most - 1) / most);
+        printf("  %10llu+ %8llu %12llu  %.*s\n", 1ULL << bucket, (unsigned long long) blocks[bucket],
+               (unsigned long long) bytes[bucket], bar, "########################################");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s dump [width] [rows]\n", argv[0]);
+        return 2;
+    }
+    size_t width = argc > 2 ? strtoul(argv[2], NULL, 10) : 64;
+    size_t rows = argc > 3 ? strtoul(argv[3], NULL, 10) : 8;
+    FILE* file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    sheap_dump_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, SHEAP_DUMP_MAGIC, sizeof(header.magic)) != 0 ||
+        header.record_size != sizeof(sheap_dump_record)) {
+        fprintf(stderr, "%s: not a sheap_dump stream\n", argv[1]);
+        return 1;
+    }
+    std::vector<sheap_dump_record> heap, used_blocks, free_blocks, mapped;
+    sheap_dump_record record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.kind == SHEAP_DUMP_HEAP || record.kind == SHEAP_DUMP_FENCE) {
+            heap.push_back(record);
+            (record.is_free ? free_blocks : used_blocks).push_back(record);
+        } else {
+            mapped.push_back(record);
+        }
+    }
+    fclose(file);
+
+    uint64_t span = header.heap_end - header.heap_start;
+    printf("heap %#llx-%#llx, %llu bytes in %zu blocks, page %u\n", (unsigned long long) header.heap_start,
+           (unsigned long long) header.heap_end, (unsigned long long) span, heap.size(), header.page_size);
+
+    // bytes per column, headers count as used
+    size_t columns = width * rows;
+    if (span > 0 && columns > 0) {
+        std::vector<double> covered(columns), in_use(columns);
+        double column_bytes = (double) span / columns;
+        for (const sheap_dump_record& block : heap) {
+            double start = block.address - header.heap_start;
+            double end = start + block.size + header.header_size;
+            end = std::min(end, (double) span);
+            for (size_t column = (size_t) (start / column_bytes); column < columns && column * column_bytes < end; column++) {
+                double left = std::max(start, column * column_bytes);
+                double right = std::min(end, (column + 1) * column_bytes);
+                covered[column] += right - left;
+                if (!block.is_free) {
+                    in_use[column] += right - left;
+                }
+            }
+        }
+        printf("\n");
+        for (size_t row = 0; row < rows; row++) {
+            printf("  |");
+            for (size_t column = row * width; column < (row + 1) * width; column++) {
+                int shade = 0;
+                if (covered[column] > 0) {
+                    shade = 1 + (int) (in_use[column] / covered[column] * (strlen(SHADES) - 2) + 0.5);
+                }
+                putchar(SHADES[shade]);
+            }
+            printf("|\n");
+        }
+    }
+
+    printHistogram("used heap blocks", used_blocks);
+    printHistogram("free heap blocks", free_blocks);
+    printHistogram("mapped blocks", mapped);
+
+    std::map<uint64_t, std::pair<uint64_t, uint64_t>> sites;
+    for (const std::vector<sheap_dump_record>* records : {&used_blocks, &mapped}) {
+        for (const sheap_dump_record& block : *records) {
+            if (block.site != 0 && !block.is_free) {
+                sites[block.site].first++;
+                sites[block.site].second += block.size;
+            }
+        }
+    }
+    if (!sites.empty()) {
+        std::vector<std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> order(sites.begin(), sites.end());
+        std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.second.second > b.second.second; });
+        printf("\nsampled sites by bytes\n");
+        for (size_t i = 0; i < order.size() && i < 10; i++) {
+            printf("  %016llx %8llu blocks %12llu bytes\n", (unsigned long long) order[i].first,
+                   (unsigned long long) order[i].second.first, (unsigned long long) order[i].second.second);
+        }
+    }
+    return 0;
+}
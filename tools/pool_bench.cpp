@@ -0,0 +1,68 @@
+#include "my_stdlib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// smalloc/sfree against spool_alloc/spool_free for the object sizes pools are meant for:
+// fill, free in random order, refill. Reports time per call and bytes taken per object.
+// Usage: pool_bench [objects] [rounds]
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <typename Alloc, typename Free>
+static double run(std::vector<void*>& objects, int rounds, unsigned int seed, Alloc alloc, Free dealloc) {
+    std::mt19937 random(seed);
+    double start = nowSeconds();
+    for (int r = 0; r < rounds; r++) {
+        for (void*& p : objects) {
+            p = alloc();
+            *(char*) p = 1;
+        }
+        std::shuffle(objects.begin(), objects.end(), random);
+        for (void* p : objects) {
+            dealloc(p);
+        }
+    }
+    return nowSeconds() - start;
+}
+
+static void report(size_t size, const char* allocator, double seconds, long calls, double bytes_per_object) {
+    printf("%4zu B  %-14s %10.1f ns/call %8.1f B/object\n", size, allocator, seconds * 1e9 / calls, bytes_per_object);
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? atoi(argv[1]) : 20000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+    long calls = 2L * count * rounds;
+    const size_t sizes[] = {48, 64, 96};
+    std::vector<void*> objects(count);
+
+    printf("%zu objects, %d rounds\n", count, rounds);
+    for (size_t size : sizes) {
+        double seconds = run(objects, rounds, 1, [&] { return smalloc(size); }, [](void* p) { sfree(p); });
+        report(size, "smalloc", seconds, calls,
+               (double) (_num_allocated_bytes() + _num_meta_data_bytes()) / count);
+        strim(0);
+
+        spool_t pool = spool_create(size, 0);
+        seconds = run(objects, rounds, 1, [&] { return spool_alloc(pool); }, [&](void* p) { spool_free(pool, p); });
+        report(size, "spool", seconds, calls, (double) spool_stats(pool).slab_bytes / count);
+        spool_destroy(pool);
+
+        pool = spool_create(size, 0);
+        spool_cache(pool, 256);
+        seconds = run(objects, rounds, 1, [&] { return spool_alloc(pool); }, [&](void* p) { spool_free(pool, p); });
+        report(size, "spool cached", seconds, calls, (double) spool_stats(pool).slab_bytes / count);
+        spool_destroy(pool);
+    }
+    return 0;
+}
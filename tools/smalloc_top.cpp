@@ -0,0 +1,204 @@
+#include "my_stdlib.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Watches the stats page a process publishes with sstats_publish or SMALLOC_STATS=1: its
+// counters, their rates since the previous update, and call latencies when the engine has
+// them built in. Without a pid, lists the processes that publish one.
+// Usage: smalloc_top [pid [interval_ms [updates]]]
+
+static const char* const OP_NAMES[] = {"smalloc", "scalloc", "saligned_alloc", "sfree", "srealloc"};
+static const char* const REALLOC_NAMES = "ABCDEFGH";
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// a copy of the page from between two updates
+static bool snapshot(const sstats_page* page, sstats_page* copy) {
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        uint64_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq % 2 == 0) {
+            memcpy(copy, page, sizeof(*copy));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq) {
+                return true;
+            }
+        }
+        usleep(100);
+    }
+    return false;
+}
+
+static const sstats_page* attach(long pid) {
+    char name[64];
+    snprintf(name, sizeof(name), "/dev/shm/smalloc.%ld", pid);
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    void* mapping = mmap(nullptr, sizeof(sstats_page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+    const sstats_page* page = (const sstats_page*) mapping;
+    if (memcmp(page->magic, SSTATS_MAGIC, sizeof(page->magic)) != 0 || page->size != sizeof(sstats_page)) {
+        munmap(mapping, sizeof(sstats_page));
+        return nullptr;
+    }
+    return page;
+}
+
+static int list() {
+    DIR* dir = opendir("/dev/shm");
+    if (dir == nullptr) {
+        perror("/dev/shm");
+        return 1;
+    }
+    printf("%8s %14s %14s %10s\n", "pid", "calls", "live bytes", "age");
+    for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+        long pid = 0;
+        if (sscanf(entry->d_name, "smalloc.%ld", &pid) != 1) {
+            continue;
+        }
+        const sstats_page* page = attach(pid);
+        sstats_page copy;
+        if (page == nullptr || !snapshot(page, &copy)) {
+            continue;
+        }
+        bool alive = kill(pid, 0) == 0;
+        printf("%8ld %14llu %14zu %9.1fs%s\n", pid, (unsigned long long) copy.calls, copy.frag.live_bytes,
+               (nowNs() - copy.time_ns) / 1e9, alive ? "" : "  (gone)");
+        munmap((void*) page, sizeof(sstats_page));
+    }
+    closedir(dir);
+    return 0;
+}
+
+static double rate(size_t now, size_t before, double seconds) {
+    return seconds > 0 ? (long long) (now - before) / seconds : 0;
+}
+
+static void row(const char* name, size_t now, size_t before, double seconds) {
+    printf("  %-22s %14zu %+12lld %12.0f/s\n", name, now, (long long) (now - before), rate(now, before, seconds));
+}
+
+// latency quantile of what the buckets gained since before
+static unsigned long long quantile(const size_t* now, const size_t* before, size_t count, double q) {
+    size_t rank = (size_t) (q * count), seen = 0;
+    for (int i = 0; i < SL_BUCKETS; i++) {
+        seen += now[i] - before[i];
+        if (seen > rank) {
+            return 1ull << i;
+        }
+    }
+    return 1ull << (SL_BUCKETS - 1);
+}
+
+static void show(const sstats_page& now, const sstats_page& before, long pid) {
+    double seconds = (now.time_ns - before.time_ns) / 1e9;
+    printf("smalloc_top: pid %ld, updated %.1fs ago, %.1fs between updates\n\n", pid,
+           (nowNs() - now.time_ns) / 1e9, seconds);
+    printf("  %-22s %14s %12s %14s\n", "", "now", "delta", "rate");
+    row("calls", now.calls, before.calls, seconds);
+    row("heap bytes", now.info.heap_bytes, before.info.heap_bytes, seconds);
+    row("live heap bytes", now.frag.live_bytes, before.frag.live_bytes, seconds);
+    row("heap blocks", now.heap_blocks, before.heap_blocks, seconds);
+    row("free blocks", now.frag.free_blocks, before.frag.free_blocks, seconds);
+    row("free bytes", now.frag.free_bytes, before.frag.free_bytes, seconds);
+    row("largest free block", now.frag.largest_free_block, before.frag.largest_free_block, seconds);
+    row("stranded free bytes", now.frag.stranded_bytes, before.frag.stranded_bytes, seconds);
+    row("purged bytes", now.purged_bytes, before.purged_bytes, seconds);
+    row("mmap blocks", now.info.mmap_blocks, before.info.mmap_blocks, seconds);
+    row("mmap bytes", now.info.mmap_bytes, before.info.mmap_bytes, seconds);
+    row("filler blocks", now.filler_blocks, before.filler_blocks, seconds);
+    row("filler regions", now.filler_regions, before.filler_regions, seconds);
+    row("reserved blocks", now.reserved_blocks, before.reserved_blocks, seconds);
+    row("sbrk calls", now.info.sbrk_calls, before.info.sbrk_calls, seconds);
+    row("mmap calls", now.info.mmap_calls, before.info.mmap_calls, seconds);
+    row("munmap calls", now.info.munmap_calls, before.info.munmap_calls, seconds);
+    row("madvise calls", now.info.madvise_calls, before.info.madvise_calls, seconds);
+    row("splits", now.info.splits, before.info.splits, seconds);
+    row("merges", now.info.merges, before.info.merges, seconds);
+    row("realloc moved bytes", now.info.realloc_moved_bytes, before.info.realloc_moved_bytes, seconds);
+    for (size_t i = 0; i < sizeof(now.info.realloc_cases) / sizeof(now.info.realloc_cases[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "srealloc case %c", REALLOC_NAMES[i]);
+        row(name, now.info.realloc_cases[i], before.info.realloc_cases[i], seconds);
+    }
+    printf("  %-22s %14.3f\n", "external fragmentation", now.frag.external_fragmentation);
+
+    if (!now.latency_built_in) {
+        printf("\n  latencies are not built in, see SMALLOC_LATENCY\n");
+        return;
+    }
+    printf("\n  %-22s %14s %12s %12s %12s  (cycles, since the last update)\n", "latency", "calls", "mean", "p50",
+           "p99");
+    for (int op = 0; op < SL_OPS; op++) {
+        size_t count = 0, buckets[SL_BUCKETS] = {}, buckets_before[SL_BUCKETS] = {};
+        unsigned long long total = 0;
+        for (int path = 0; path < SL_PATHS; path++) {
+            count += now.latencies[op][path].count - before.latencies[op][path].count;
+            total += now.latencies[op][path].total - before.latencies[op][path].total;
+            for (int i = 0; i < SL_BUCKETS; i++) {
+                buckets[i] += now.latencies[op][path].buckets[i];
+                buckets_before[i] += before.latencies[op][path].buckets[i];
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+        printf("  %-22s %14zu %12llu %12llu %12llu\n", OP_NAMES[op], count, total / count,
+               quantile(buckets, buckets_before, count, 0.5), quantile(buckets, buckets_before, count, 0.99));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        return list();
+    }
+    long pid = atol(argv[1]);
+    long interval_ms = argc > 2 ? atol(argv[2]) : 1000;
+    long updates = argc > 3 ? atol(argv[3]) : -1;
+    const sstats_page* page = attach(pid);
+    if (page == nullptr) {
+        fprintf(stderr, "no stats page for pid %ld, it needs sstats_publish(1) or SMALLOC_STATS=1\n", pid);
+        return 1;
+    }
+    // the last two updates seen, rates are between them
+    static sstats_page before, now, next;
+    if (!snapshot(page, &now)) {
+        fprintf(stderr, "pid %ld keeps writing its stats page\n", pid);
+        return 1;
+    }
+    before = now;
+    bool screen = isatty(STDOUT_FILENO) && updates < 0;
+    for (long update = 0; updates < 0 || update < updates; update++) {
+        usleep(interval_ms * 1000);
+        if (snapshot(page, &next) && next.seq != now.seq) {
+            before = now;
+            now = next;
+        }
+        if (screen) {
+            printf("\033[H\033[J");
+        }
+        show(now, before, pid);
+        fflush(stdout);
+        if (kill(pid, 0) != 0) {
+            printf("\npid %ld is gone\n", pid);
+            return 0;
+        }
+    }
+    return 0;
+}
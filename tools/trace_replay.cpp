@@ -0,0 +1,513 @@
+#include "my_stdlib.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Replays an srecord trace on the engine it is linked with, see tools/CMakeLists.txt.
+// Every recorded thread gets a replay thread. The engines are single threaded, so the calls
+// take turns in the order they were recorded, each on the thread that made it. Blocks are
+// written to one byte per page, so that RSS follows what the program had in use. Engines
+// without scalloc or srealloc get smalloc, and sfree, instead. Without sreserve a block of
+// one byte stands in for the reservation, and scommit and sexpand become an srealloc that
+// may move the block.
+// Reports call latency percentiles per op, peak RSS and heap span, and the engine's stats.
+// Usage: malloc_N_trace_replay trace [-n (do not touch the blocks)]
+
+// what not every engine has
+void* scalloc(size_t num, size_t size) __attribute__((weak));
+void sfree(void* p) __attribute__((weak));
+void* srealloc(void* oldp, size_t size) __attribute__((weak));
+void* saligned_alloc(size_t alignment, size_t size) __attribute__((weak));
+size_t sexpand(void* p, size_t min_size, size_t preferred_size) __attribute__((weak));
+void* sreserve(size_t max_size) __attribute__((weak));
+void* scommit(void* p, size_t new_size) __attribute__((weak));
+size_t _num_free_blocks() __attribute__((weak));
+size_t _num_free_bytes() __attribute__((weak));
+size_t _num_allocated_blocks() __attribute__((weak));
+size_t _num_allocated_bytes() __attribute__((weak));
+size_t _num_meta_data_bytes() __attribute__((weak));
+size_t _size_meta_data() __attribute__((weak));
+
+#define RSS_EVERY (4096) // calls between two looks at the resident set
+
+static const char* const OP_NAMES[] = {"smalloc", "scalloc", "saligned_alloc", "srealloc", "sfree",
+                                       "sexpand", "sreserve", "scommit"};
+#define OPS (8)
+
+struct Event {
+    uint64_t order; // of the call over all threads
+    uint64_t size;
+    uint64_t old_id;
+    uint64_t new_id;
+    uint64_t alignment;
+    uint64_t usable; // the size an sexpand left the block with, 0 when it failed
+    int op;
+};
+
+struct Timed {
+    uint64_t time;
+    unsigned int thread;
+    size_t index;
+};
+
+static uint64_t varint(const std::string& data, size_t& at) {
+    uint64_t value = 0;
+    for (int shift = 0; at < data.size() && shift < 64; shift += 7) {
+        unsigned char byte = data[at++];
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+    fprintf(stderr, "trace ends in the middle of an event\n");
+    exit(1);
+}
+
+static uint64_t id(const std::string& data, size_t& at, uint64_t& last) {
+    uint64_t zigzag = varint(data, at);
+    last += (zigzag >> 1) ^ -(zigzag & 1);
+    return last;
+}
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Ids to the blocks the replay got for them, open addressing sized before the replay so
+// that it does not allocate from the C library while the engine runs.
+class IdMap {
+private:
+    std::vector<uint64_t> ids; // 0 is an empty slot, ids of blocks are never 0
+    std::vector<void*> blocks;
+    size_t mask;
+
+    size_t slot(uint64_t id) const {
+        size_t i = (id * 0x9e3779b97f4a7c15ull) >> 20 & mask;
+        while (ids[i] != 0 && ids[i] != id) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+public:
+    explicit IdMap(size_t live) {
+        size_t size = 16;
+        while (size < 2 * live) {
+            size *= 2;
+        }
+        ids.assign(size, 0);
+        blocks.assign(size, nullptr);
+        mask = size - 1;
+    }
+
+    void* find(uint64_t id) const {
+        return ids[slot(id)] == id ? blocks[slot(id)] : nullptr;
+    }
+
+    void put(uint64_t id, void* block) {
+        size_t i = slot(id);
+        ids[i] = id;
+        blocks[i] = block;
+    }
+
+    // backward shift, so lookups never need tombstones
+    void erase(uint64_t id) {
+        size_t hole = slot(id);
+        if (ids[hole] != id) {
+            return;
+        }
+        ids[hole] = 0;
+        for (size_t i = (hole + 1) & mask; ids[i] != 0; i = (i + 1) & mask) {
+            size_t home = (ids[i] * 0x9e3779b97f4a7c15ull) >> 20 & mask;
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                ids[hole] = ids[i];
+                blocks[hole] = blocks[i];
+                ids[i] = 0;
+                hole = i;
+            }
+        }
+    }
+};
+
+struct Replay {
+    std::vector<std::vector<Event>> threads;
+    std::vector<std::vector<uint64_t>> latencies; // per op, only the thread whose turn it is writes
+    std::atomic<uint64_t> turn{0};
+    IdMap* map = nullptr;
+    bool touch = true;
+    size_t page_size = 4096;
+    int statm = -1;
+    size_t base_rss = 0;
+    size_t peak_rss = 0;
+    char* base_break = nullptr;
+    size_t peak_span = 0;
+    size_t unknown_ids = 0; // blocks allocated before the recording started
+    size_t failed = 0; // calls that failed in the replay but not in the trace
+    size_t calls = 0;
+};
+
+static size_t residentBytes(Replay& replay) {
+    char text[64];
+    ssize_t length = pread(replay.statm, text, sizeof(text) - 1, 0);
+    if (length <= 0) {
+        return 0;
+    }
+    text[length] = '\0';
+    unsigned long pages = 0, resident = 0;
+    sscanf(text, "%lu %lu", &pages, &resident);
+    return resident * replay.page_size;
+}
+
+static void touchBlock(Replay& replay, void* block, uint64_t size) {
+    if (!replay.touch || block == nullptr) {
+        return;
+    }
+    for (uint64_t offset = 0; offset < size; offset += replay.page_size) {
+        ((volatile char*) block)[offset] = 1;
+    }
+}
+
+static void replayEvent(Replay& replay, const Event& event) {
+    IdMap& map = *replay.map;
+    void* result = nullptr;
+    uint64_t start = 0, end = 0;
+    switch (event.op) {
+        case SR_MALLOC:
+        case SR_CALLOC:
+        case SR_ALIGNED_ALLOC: {
+            uint64_t size = event.size;
+            start = nowNs();
+            if (event.op == SR_CALLOC && scalloc != nullptr) {
+                result = scalloc(1, size);
+            } else if (event.op == SR_ALIGNED_ALLOC && saligned_alloc != nullptr) {
+                result = saligned_alloc(event.alignment, size);
+            } else {
+                result = smalloc(size);
+            }
+            end = nowNs();
+            if (event.new_id == 0) {
+                if (result != nullptr && sfree != nullptr) {
+                    sfree(result); // failed when it was recorded
+                }
+            } else if (result == nullptr) {
+                replay.failed++;
+            } else {
+                touchBlock(replay, result, size);
+                map.put(event.new_id, result);
+            }
+            break;
+        }
+        case SR_REALLOC: {
+            void* old = event.old_id != 0 ? map.find(event.old_id) : nullptr;
+            if (event.old_id != 0 && old == nullptr) {
+                replay.unknown_ids++;
+                return;
+            }
+            start = nowNs();
+            if (srealloc != nullptr) {
+                result = srealloc(old, event.size);
+            } else {
+                result = smalloc(event.size); // what moving costs besides the copy
+                if (result != nullptr && old != nullptr && sfree != nullptr) {
+                    sfree(old);
+                }
+            }
+            end = nowNs();
+            if (result == nullptr) {
+                // the old block is still there, under the id the trace keeps using
+                replay.failed += event.new_id != 0;
+                if (old != nullptr && event.new_id != 0 && event.new_id != event.old_id) {
+                    map.erase(event.old_id);
+                    map.put(event.new_id, old);
+                }
+                break;
+            }
+            touchBlock(replay, result, event.size);
+            if (event.old_id != 0) {
+                map.erase(event.old_id);
+            }
+            map.put(event.new_id != 0 ? event.new_id : event.old_id, result);
+            break;
+        }
+        case SR_FREE: {
+            void* old = map.find(event.old_id);
+            if (old == nullptr) {
+                replay.unknown_ids++;
+                return;
+            }
+            map.erase(event.old_id);
+            start = nowNs();
+            if (sfree != nullptr) {
+                sfree(old);
+            }
+            end = nowNs();
+            break;
+        }
+        case SR_EXPAND: {
+            if (event.usable == 0) {
+                break; // nothing changed when it was recorded
+            }
+            void* old = map.find(event.old_id);
+            if (old == nullptr) {
+                replay.unknown_ids++;
+                return;
+            }
+            // the program may use what it got, the preferred size only if there is room
+            size_t usable = 0;
+            start = nowNs();
+            if (sexpand != nullptr) {
+                usable = sexpand(old, event.usable, std::max(event.size, event.usable));
+                result = usable != 0 ? old : nullptr;
+            } else if (srealloc != nullptr) {
+                usable = event.usable;
+                result = srealloc(old, usable);
+            }
+            end = nowNs();
+            if (result == nullptr) {
+                replay.failed++;
+                break;
+            }
+            touchBlock(replay, result, usable);
+            map.put(event.old_id, result);
+            break;
+        }
+        case SR_RESERVE: {
+            start = nowNs();
+            result = sreserve != nullptr ? sreserve(event.size) : smalloc(1);
+            end = nowNs();
+            if (event.new_id == 0) {
+                if (result != nullptr && sfree != nullptr) {
+                    sfree(result);
+                }
+            } else if (result == nullptr) {
+                replay.failed++;
+            } else {
+                map.put(event.new_id, result); // nothing is committed yet
+            }
+            break;
+        }
+        case SR_COMMIT: {
+            if (event.new_id == 0) {
+                break; // failed when it was recorded, the block is as it was
+            }
+            void* old = map.find(event.old_id);
+            if (old == nullptr) {
+                replay.unknown_ids++;
+                return;
+            }
+            start = nowNs();
+            if (sreserve != nullptr && scommit != nullptr) {
+                result = scommit(old, event.size);
+            } else if (srealloc != nullptr) {
+                result = srealloc(old, event.size);
+            }
+            end = nowNs();
+            if (result == nullptr) {
+                replay.failed++;
+                break;
+            }
+            touchBlock(replay, result, event.size);
+            map.put(event.old_id, result);
+            break;
+        }
+    }
+    replay.latencies[event.op].push_back(end - start);
+    replay.calls++;
+    size_t span = (char*) sbrk(0) - replay.base_break;
+    replay.peak_span = std::max(replay.peak_span, span);
+    if (replay.calls % RSS_EVERY == 0) {
+        replay.peak_rss = std::max(replay.peak_rss, residentBytes(replay));
+    }
+}
+
+static void replayThread(Replay& replay, unsigned int thread) {
+    for (const Event& event : replay.threads[thread]) {
+        for (int spins = 0; replay.turn.load(std::memory_order_acquire) != event.order; spins++) {
+            if (spins > 64) {
+                sched_yield();
+            }
+        }
+        replayEvent(replay, event);
+        replay.turn.store(event.order + 1, std::memory_order_release);
+    }
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double q) {
+    return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, (size_t) (q * sorted.size()))];
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s trace [-n]\n", argv[0]);
+        return 2;
+    }
+    std::ifstream file(argv[1], std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() < 16 || data.compare(0, 8, SMALLOC_TRACE_MAGIC) != 0) {
+        fprintf(stderr, "%s: not an srecord trace\n", argv[1]);
+        return 1;
+    }
+
+    Replay replay;
+    replay.touch = !(argc > 2 && strcmp(argv[2], "-n") == 0);
+    replay.page_size = sysconf(_SC_PAGESIZE);
+    replay.threads.resize(SRECORD_THREADS);
+    std::vector<Timed> order;
+    uint64_t last_time[SRECORD_THREADS] = {}, last_id[SRECORD_THREADS] = {};
+    for (size_t at = 16; at < data.size();) {
+        uint64_t thread = varint(data, at);
+        uint64_t count = varint(data, at);
+        if (thread >= SRECORD_THREADS) {
+            fprintf(stderr, "%s: bad thread %llu\n", argv[1], (unsigned long long) thread);
+            return 1;
+        }
+        for (uint64_t i = 0; i < count && at < data.size(); i++) {
+            Event event = {0, 0, 0, 0, 0, 0, (unsigned char) data[at++]};
+            if (event.op >= OPS) {
+                fprintf(stderr, "%s: bad op %d\n", argv[1], event.op);
+                return 1;
+            }
+            last_time[thread] += varint(data, at);
+            if (event.op != SR_FREE) {
+                event.size = varint(data, at);
+            }
+            if (event.op == SR_ALIGNED_ALLOC) {
+                event.alignment = varint(data, at);
+            } else if (event.op == SR_REALLOC || event.op == SR_FREE || event.op == SR_EXPAND ||
+                       event.op == SR_COMMIT) {
+                event.old_id = id(data, at, last_id[thread]);
+            }
+            if (event.op == SR_EXPAND) {
+                event.usable = varint(data, at);
+            } else if (event.op != SR_FREE) {
+                event.new_id = id(data, at, last_id[thread]);
+            }
+            order.push_back({last_time[thread], (unsigned int) thread, replay.threads[thread].size()});
+            replay.threads[thread].push_back(event);
+        }
+    }
+    std::string().swap(data);
+
+    // a thread's events are in time order already, ties between threads keep chunk order
+    std::stable_sort(order.begin(), order.end(), [](const Timed& a, const Timed& b) { return a.time < b.time; });
+    std::unordered_set<uint64_t> live;
+    size_t peak_live = 0, counts[OPS] = {};
+    for (size_t i = 0; i < order.size(); i++) {
+        Event& event = replay.threads[order[i].thread][order[i].index];
+        event.order = i;
+        counts[event.op]++;
+        if (event.old_id != 0 && (event.op == SR_FREE || event.new_id != 0)) {
+            live.erase(event.old_id); // a failed srealloc leaves the old block
+        }
+        if (event.new_id != 0) {
+            live.insert(event.new_id);
+        }
+        peak_live = std::max(peak_live, live.size());
+    }
+    size_t recorded_threads = 0;
+    for (const std::vector<Event>& events : replay.threads) {
+        recorded_threads += !events.empty();
+    }
+    uint64_t recorded_ns = order.empty() ? 0 : order.back().time;
+    std::vector<Timed>().swap(order);
+    std::unordered_set<uint64_t>().swap(live);
+
+    // nothing below allocates from the C library until the replay is over, so the break and
+    // the resident set only move with the engine
+    IdMap map(peak_live + 1);
+    replay.map = &map;
+    replay.latencies.resize(OPS);
+    for (int op = 0; op < OPS; op++) {
+        replay.latencies[op].reserve(counts[op]);
+    }
+    replay.statm = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    std::vector<std::thread> workers;
+    std::atomic<bool> go{false};
+    for (unsigned int thread = 0; thread < SRECORD_THREADS; thread++) {
+        if (!replay.threads[thread].empty()) {
+            workers.emplace_back([&replay, &go, thread]() {
+                while (!go.load(std::memory_order_acquire)) {
+                    sched_yield();
+                }
+                replayThread(replay, thread);
+            });
+        }
+    }
+    replay.base_rss = residentBytes(replay);
+    replay.peak_rss = replay.base_rss;
+    replay.base_break = (char*) sbrk(0);
+    uint64_t start = nowNs();
+    go.store(true, std::memory_order_release);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    uint64_t wall = nowNs() - start;
+    replay.peak_rss = std::max(replay.peak_rss, residentBytes(replay));
+
+    printf("trace %s: %zu calls on %zu threads over %.3f s\n", argv[1], replay.calls + replay.unknown_ids,
+           recorded_threads, recorded_ns / 1e9);
+    uint64_t in_calls = 0;
+    for (int op = 0; op < OPS; op++) {
+        for (uint64_t ns : replay.latencies[op]) {
+            in_calls += ns;
+        }
+    }
+    printf("replay on %s: %.3f s wall, %.3f s in the engine\n", ENGINE_NAME, wall / 1e9, in_calls / 1e9);
+    printf("\n%-15s %10s %8s %8s %8s %8s %10s  (ns)\n", "op", "calls", "p50", "p90", "p99", "p99.9", "max");
+    for (int op = 0; op < OPS; op++) {
+        std::vector<uint64_t>& sorted = replay.latencies[op];
+        if (sorted.empty()) {
+            continue;
+        }
+        std::sort(sorted.begin(), sorted.end());
+        printf("%-15s %10zu %8llu %8llu %8llu %8llu %10llu\n", OP_NAMES[op], sorted.size(),
+               (unsigned long long) percentile(sorted, 0.5), (unsigned long long) percentile(sorted, 0.9),
+               (unsigned long long) percentile(sorted, 0.99), (unsigned long long) percentile(sorted, 0.999),
+               (unsigned long long) sorted.back());
+    }
+    printf("\npeak RSS          %12zu bytes over the %zu before the replay\n", replay.peak_rss - replay.base_rss,
+           replay.base_rss);
+    printf("peak heap span    %12zu bytes\n", replay.peak_span);
+    printf("peak live blocks  %12zu\n", peak_live);
+    if (replay.unknown_ids > 0) {
+        printf("skipped           %12zu calls on blocks from before the recording\n", replay.unknown_ids);
+    }
+    if (replay.failed > 0) {
+        printf("failed            %12zu calls that succeeded when recorded\n", replay.failed);
+    }
+
+    const struct {
+        const char* name;
+        size_t (*stat)();
+    } stats[] = {
+        {"_num_free_blocks", _num_free_blocks},
+        {"_num_free_bytes", _num_free_bytes},
+        {"_num_allocated_blocks", _num_allocated_blocks},
+        {"_num_allocated_bytes", _num_allocated_bytes},
+        {"_num_meta_data_bytes", _num_meta_data_bytes},
+        {"_size_meta_data", _size_meta_data},
+    };
+    printf("\n");
+    for (const auto& stat : stats) {
+        if (stat.stat != nullptr) {
+            printf("%-22s %12zu\n", stat.name, stat.stat());
+        }
+    }
+    return 0;
+}